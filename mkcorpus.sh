@@ -0,0 +1,107 @@
+#!/bin/bash
+
+# Adds a benchmark corpus to the FAT partition of a disk image built by
+# make, for the kernel's FAT workload (bench fat in the shell). Every file
+# is listed in /CORPUS.TXT as "PATH SIZE", which is all the kernel needs
+# to know about the layout. File contents and cluster placement depend only
+# on the layout chosen, so runs on two builds see the same volume.
+#
+# Usage: ./mkcorpus.sh IMAGE LAYOUT
+#   tree   2048 small files, 256 in each of 8 nested directories
+#   large  four 4 MB files, each in one contiguous run of clusters
+#   frag   a file scattered over 1024 gaps between other files, and a
+#          contiguous file of the same size to compare it with
+
+set -e
+
+if [ $# -ne 2 ]; then
+  echo "Usage: $0 IMAGE tree|large|frag" >&2
+  exit 1
+fi
+
+IMG="$1@@1M"        # The partition starts at sector 2048, as in the Makefile
+LAYOUT=$2
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+MANIFEST=$WORK/CORPUS.TXT
+: > "$MANIFEST"
+
+# make_file LOCAL PATH SIZE: write SIZE bytes for the volume file PATH
+make_file() {
+  yes "$2" | head -c "$3" > "$1"
+  echo "$2 $3" >> "$MANIFEST"
+}
+
+# Bytes per cluster and bytes free, from mtools
+cluster_bytes() {
+  echo $(( $(minfo -i "$IMG" | sed -n 's/.*sectors per cluster: *\([0-9]*\).*/\1/p') * 512 ))
+}
+
+free_bytes() {
+  mdir -i "$IMG" ::/ | sed -n 's/ bytes free//p' | tr -dc '0-9'
+}
+
+case $LAYOUT in
+tree)
+  # Sizes from 512 bytes to 8 KB, spread by a fixed stride
+  dir=$WORK/T1
+  path=/T1
+  for level in 1 2 3 4 5 6 7 8; do
+    mkdir -p "$dir"
+    for i in $(seq 0 255); do
+      name=$(printf "F%03d.DAT" "$i")
+      make_file "$dir/$name" "$path/$name" $(( 512 + (level * 256 + i) * 7919 % 7680 ))
+    done
+    dir=$dir/T$((level + 1))
+    path=$path/T$((level + 1))
+  done
+  mcopy -s -i "$IMG" "$WORK/T1" ::/
+  ;;
+
+large)
+  for i in 0 1 2 3; do
+    make_file "$WORK/BIG$i.DAT" "/BIG$i.DAT" $(( 4 * 1024 * 1024 ))
+    mcopy -i "$IMG" "$WORK/BIG$i.DAT" ::/
+  done
+  ;;
+
+frag)
+  # Gaps of one to four clusters between one-cluster spacers, copied in
+  # one go so they alternate on disk
+  cluster=$(cluster_bytes)
+  mkdir -p "$WORK/FRAG"
+  holes=0
+  files=()
+  for i in $(seq 0 1023); do
+    gap=$(printf "G%04d.DAT" "$i")
+    spacer=$(printf "S%04d.DAT" "$i")
+    yes "$gap" | head -c $(( (1 + i % 4) * cluster )) > "$WORK/FRAG/$gap"
+    make_file "$WORK/FRAG/$spacer" "/FRAG/$spacer" "$cluster"
+    files+=("$WORK/FRAG/$gap" "$WORK/FRAG/$spacer")
+    holes=$(( holes + (1 + i % 4) * cluster ))
+  done
+  mmd -i "$IMG" FRAG
+  mcopy -i "$IMG" "${files[@]}" ::/FRAG
+
+  make_file "$WORK/CONTIG.DAT" /CONTIG.DAT "$holes"
+  mcopy -i "$IMG" "$WORK/CONTIG.DAT" ::/
+  make_file "$WORK/SCATTER.DAT" /SCATTER.DAT "$holes"
+
+  # Use up the rest of the volume, free the gaps, and the next file can
+  # only go into them
+  head -c "$(free_bytes)" /dev/zero > "$WORK/PAD.DAT"
+  mcopy -i "$IMG" "$WORK/PAD.DAT" ::/
+  mdel -i "$IMG" "::/FRAG/G*.DAT"
+  mcopy -i "$IMG" "$WORK/SCATTER.DAT" ::/
+  mdel -i "$IMG" ::/PAD.DAT
+  ;;
+
+*)
+  echo "$0: unknown layout $LAYOUT" >&2
+  exit 1
+  ;;
+esac
+
+mcopy -i "$IMG" "$MANIFEST" ::/
+echo "$LAYOUT corpus: $(wc -l < "$MANIFEST") files, $(free_bytes) bytes free"
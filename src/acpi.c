@@ -0,0 +1,212 @@
+#include "acpi.h"
+#include <stddef.h>
+
+// MADT entry types
+#define MADT_LAPIC              0
+#define MADT_IOAPIC             1
+#define MADT_ISO                2
+
+// MP configuration table entry types
+#define MP_PROCESSOR            0
+#define MP_BUS                  1
+#define MP_IOAPIC               2
+
+#define DEFAULT_LAPIC_ADDR      0xFEE00000
+
+static struct acpi_rsdp *rsdp = NULL;
+
+static int signature_matches(const char *a, const char *b, int n) {
+    for (int i = 0; i < n; i++) {
+        if (a[i] != b[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static uint8_t checksum(const void *data, uint32_t len) {
+    const uint8_t *p = data;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        sum += p[i];
+    }
+    return sum;
+}
+
+/*
+ * find_signature - Scans a memory range on 16-byte boundaries
+ *
+ * Both the RSDP and the MP floating pointer live either in the first KB of
+ * the EBDA or in the BIOS ROM area, and must checksum to zero.
+ */
+static void *find_signature(uint32_t start, uint32_t end, const char *sig, int siglen, int sumlen) {
+    for (uint32_t addr = start; addr + sumlen <= end; addr += 16) {
+        if (signature_matches((const char *)addr, sig, siglen) &&
+            checksum((void *)addr, sumlen) == 0) {
+            return (void *)addr;
+        }
+    }
+    return NULL;
+}
+
+static void *scan_bios_areas(const char *sig, int siglen, int sumlen) {
+    uint32_t ebda = (uint32_t)(*(uint16_t *)0x40E) << 4;
+    void *found = NULL;
+
+    if (ebda != 0) {
+        found = find_signature(ebda, ebda + 1024, sig, siglen, sumlen);
+    }
+    if (found == NULL) {
+        found = find_signature(0xE0000, 0x100000, sig, siglen, sumlen);
+    }
+    return found;
+}
+
+// Default ISA wiring: IRQ n is IO-APIC input n, edge triggered, active high
+static void set_default_irqs(struct smp_info *info) {
+    for (int i = 0; i < 16; i++) {
+        info->irq_gsi[i] = i;
+        info->irq_flags[i] = 0;
+    }
+}
+
+/*
+ * acpi_find_table - Looks up an ACPI table through the RSDT
+ *
+ * Must run before paging is enabled or with the tables mapped: firmware
+ * usually puts them just past the end of usable RAM.
+ */
+struct acpi_sdt_header *acpi_find_table(const char *signature) {
+    if (rsdp == NULL) {
+        rsdp = scan_bios_areas("RSD PTR ", 8, 20);
+        if (rsdp == NULL) {
+            return NULL;
+        }
+    }
+
+    struct acpi_sdt_header *rsdt = (struct acpi_sdt_header *)rsdp->rsdt_address;
+    if (!signature_matches(rsdt->signature, "RSDT", 4)) {
+        return NULL;
+    }
+
+    uint32_t entries = (rsdt->length - sizeof(struct acpi_sdt_header)) / 4;
+    uint32_t *tables = (uint32_t *)(rsdt + 1);
+    for (uint32_t i = 0; i < entries; i++) {
+        struct acpi_sdt_header *h = (struct acpi_sdt_header *)tables[i];
+        if (signature_matches(h->signature, signature, 4) && checksum(h, h->length) == 0) {
+            return h;
+        }
+    }
+    return NULL;
+}
+
+static int parse_madt(struct smp_info *info) {
+    struct acpi_madt *madt = (struct acpi_madt *)acpi_find_table("APIC");
+    if (madt == NULL) {
+        return -1;
+    }
+
+    info->lapic_addr = madt->lapic_addr;
+
+    uint8_t *p = (uint8_t *)(madt + 1);
+    uint8_t *end = (uint8_t *)madt + madt->header.length;
+    while (p < end) {
+        uint8_t type = p[0];
+        uint8_t len = p[1];
+        if (len == 0) {
+            break;
+        }
+
+        if (type == MADT_LAPIC) {
+            uint8_t apic_id = p[3];
+            uint32_t flags = *(uint32_t *)(p + 4);
+            if ((flags & 1) && info->num_cpus < MAX_CPUS) {
+                info->apic_ids[info->num_cpus++] = apic_id;
+            }
+        } else if (type == MADT_IOAPIC && info->ioapic_addr == 0) {
+            info->ioapic_id = p[2];
+            info->ioapic_addr = *(uint32_t *)(p + 4);
+            info->ioapic_gsi_base = *(uint32_t *)(p + 8);
+        } else if (type == MADT_ISO) {
+            uint8_t source = p[3];
+            uint32_t gsi = *(uint32_t *)(p + 4);
+            uint16_t flags = *(uint16_t *)(p + 8);
+            if (source < 16) {
+                info->irq_gsi[source] = gsi;
+                info->irq_flags[source] = 0;
+                if ((flags & 0x3) == 0x3) {
+                    info->irq_flags[source] |= IRQ_FLAG_ACTIVE_LOW;
+                }
+                if (((flags >> 2) & 0x3) == 0x3) {
+                    info->irq_flags[source] |= IRQ_FLAG_LEVEL;
+                }
+            }
+        }
+        p += len;
+    }
+    return 0;
+}
+
+// Intel MultiProcessor Specification 1.4 tables, for firmware without ACPI
+static int parse_mp_table(struct smp_info *info) {
+    uint8_t *fp = scan_bios_areas("_MP_", 4, 16);
+    if (fp == NULL) {
+        return -1;
+    }
+
+    uint8_t *config = (uint8_t *)*(uint32_t *)(fp + 4);
+    if (config == NULL || !signature_matches((char *)config, "PCMP", 4)) {
+        return -1;
+    }
+
+    uint16_t entry_count = *(uint16_t *)(config + 34);
+    info->lapic_addr = *(uint32_t *)(config + 36);
+
+    uint8_t *p = config + 44;
+    for (uint16_t i = 0; i < entry_count; i++) {
+        if (p[0] == MP_PROCESSOR) {
+            if ((p[3] & 1) && info->num_cpus < MAX_CPUS) {
+                info->apic_ids[info->num_cpus++] = p[1];
+            }
+            p += 20;
+        } else {
+            if (p[0] == MP_IOAPIC && (p[3] & 1) && info->ioapic_addr == 0) {
+                info->ioapic_id = p[1];
+                info->ioapic_addr = *(uint32_t *)(p + 4);
+                info->ioapic_gsi_base = 0;
+            }
+            p += 8;
+        }
+    }
+    return 0;
+}
+
+/*
+ * smp_discover - Finds the processors and interrupt controllers
+ *
+ * Tries the ACPI MADT first and falls back to the MP table. Call before
+ * paging is enabled, since both live outside the memory we identity map.
+ *
+ * Returns: 0 on success, -1 if neither table was found
+ */
+int smp_discover(struct smp_info *info) {
+    info->num_cpus = 0;
+    info->lapic_addr = DEFAULT_LAPIC_ADDR;
+    info->ioapic_addr = 0;
+    info->ioapic_id = 0;
+    info->ioapic_gsi_base = 0;
+    set_default_irqs(info);
+
+    if (parse_madt(info) == 0 && info->num_cpus > 0) {
+        return 0;
+    }
+
+    info->num_cpus = 0;
+    set_default_irqs(info);
+    if (parse_mp_table(info) == 0 && info->num_cpus > 0) {
+        return 0;
+    }
+
+    info->num_cpus = 0;
+    return -1;
+}
@@ -0,0 +1,60 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stdint.h>
+
+#define MAX_CPUS 16
+
+// ISA IRQ to IO-APIC input mapping flags
+#define IRQ_FLAG_ACTIVE_LOW     0x1
+#define IRQ_FLAG_LEVEL          0x2
+
+/*
+ * What the firmware tells us about processors and interrupt controllers,
+ * from the ACPI MADT or, failing that, the Intel MP table.
+ */
+struct smp_info {
+    int num_cpus;
+    uint8_t apic_ids[MAX_CPUS];
+    uint32_t lapic_addr;
+    uint32_t ioapic_addr;       // 0 if there is no IO-APIC
+    uint8_t ioapic_id;
+    uint32_t ioapic_gsi_base;
+    uint32_t irq_gsi[16];       // IO-APIC input each ISA IRQ is wired to
+    uint8_t irq_flags[16];
+};
+
+// Common header of every ACPI system description table
+struct acpi_sdt_header {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed));
+
+struct acpi_rsdp {
+    char signature[8];          // "RSD PTR "
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+} __attribute__((packed));
+
+struct acpi_madt {
+    struct acpi_sdt_header header;
+    uint32_t lapic_addr;
+    uint32_t flags;
+} __attribute__((packed));
+
+/*
+ * Function declarations
+ */
+int smp_discover(struct smp_info *info);
+struct acpi_sdt_header *acpi_find_table(const char *signature);
+
+#endif
@@ -0,0 +1,379 @@
+#include "ahci.h"
+#include "pci.h"
+#include "blk.h"
+#include "mmu.h"
+#include "page.h"
+#include "interrupt.h"
+#include "spinlock.h"
+#include "atomic.h"
+#include "apic.h"
+#include "rprintf.h"
+#include "string.h"
+#include <stddef.h>
+
+extern int putc(int c);
+
+static volatile uint8_t *abar;
+static int port = -1;               // The port with a disk on it
+static int ncq = 0;                 // Using READ/WRITE FPDMA QUEUED
+static unsigned int num_slots;
+
+// Command list, received FISes and one command table per slot, from one
+// run of contiguous frames
+static struct ahci_cmd_header *cmd_list;
+static uint8_t *fis_area;
+static struct ahci_cmd_table *cmd_tables;
+
+// Slot bookkeeping, protected by ahci_lock
+static uint32_t slots_busy = 0;
+static volatile int port_failed = 0;    // Stopped by an error until port_restart
+static struct blk_request *slot_batch[AHCI_MAX_SLOTS];
+static struct spinlock ahci_lock = SPINLOCK_INIT("ahci");
+
+static uint16_t identify_data[256];
+
+static int ahci_submit(unsigned int lba, unsigned int count, struct blk_request *batch);
+
+static struct blk_device ahci_device = {
+    .name = "ahci",
+    .max_sectors = BLK_MAX_SECTORS,
+    .max_segments = AHCI_MAX_SEGMENTS,
+    .submit = ahci_submit,
+};
+
+static uint32_t hba_read(uint32_t reg) {
+    return *(volatile uint32_t *)(abar + reg);
+}
+
+static void hba_write(uint32_t reg, uint32_t val) {
+    *(volatile uint32_t *)(abar + reg) = val;
+}
+
+static uint32_t port_read(uint32_t reg) {
+    return hba_read(PORT_BASE(port) + reg);
+}
+
+static void port_write(uint32_t reg, uint32_t val) {
+    hba_write(PORT_BASE(port) + reg, val);
+}
+
+// Spin until (register & mask) == value, for at most ~timeout microseconds
+static int port_wait(uint32_t reg, uint32_t mask, uint32_t value, uint32_t timeout) {
+    while ((port_read(reg) & mask) != value) {
+        if (timeout-- == 0) {
+            return -1;
+        }
+        udelay(1);
+    }
+    return 0;
+}
+
+static void port_stop(void) {
+    port_write(PORT_CMD, port_read(PORT_CMD) & ~(PORT_CMD_ST | PORT_CMD_FRE));
+    port_wait(PORT_CMD, PORT_CMD_CR | PORT_CMD_FR, 0, 500000);
+}
+
+static void port_start(void) {
+    port_wait(PORT_CMD, PORT_CMD_CR, 0, 500000);
+    port_write(PORT_CMD, port_read(PORT_CMD) | PORT_CMD_FRE);
+    port_write(PORT_CMD, port_read(PORT_CMD) | PORT_CMD_ST);
+}
+
+/*
+ * On a task file error the port stops processing commands until it is
+ * stopped and started again, which can take hundreds of milliseconds, so
+ * the interrupt handler leaves that to the next submit.
+ */
+static void port_restart(void) {
+    port_stop();
+    port_write(PORT_SERR, 0xFFFFFFFF);
+    port_write(PORT_IS, 0xFFFFFFFF);
+    port_start();
+    port_failed = 0;
+}
+
+/*
+ * Add PRD entries for a buffer, one per physically contiguous piece, as
+ * a vmalloc buffer's pages are scattered. The HBA needs word aligned
+ * addresses and even byte counts. Returns -1 if the buffer is misaligned,
+ * outside lowmem, or would overflow the table.
+ */
+static int add_prds(struct ahci_cmd_table *table, unsigned int *prds, void *buffer, uint32_t bytes) {
+    if (((uint32_t)buffer & 1) || (bytes & 1)) {
+        return -1;
+    }
+    for (uint32_t off = 0; off < bytes; ) {
+        uint32_t paddr;
+        uint32_t run = dma_segment((uint8_t *)buffer + off, bytes - off, &paddr);
+        if (run == 0 || *prds == AHCI_MAX_PRDS) {
+            return -1;
+        }
+        table->prdt[*prds].dba = paddr;
+        table->prdt[*prds].dbau = 0;
+        table->prdt[*prds].dbc = run - 1;
+        (*prds)++;
+        off += run;
+    }
+    return 0;
+}
+
+/*
+ * Fill in slot's command header and table for an ATA command.
+ * The requests in the batch are transferred straight to and from their
+ * own buffers, so no bounce buffer is needed. With a NULL batch the
+ * command transfers buffer/bytes instead.
+ *
+ * Returns: 0, or -1 if a buffer can't be given to the HBA
+ */
+static int build_command(int slot, uint8_t command, unsigned int lba, unsigned int count,
+                         struct blk_request *batch, void *buffer, uint32_t bytes, int write) {
+    struct ahci_cmd_table *table = &cmd_tables[slot];
+    struct fis_reg_h2d *fis = (struct fis_reg_h2d *)table->cfis;
+    memset(fis, 0, sizeof(*fis));
+
+    unsigned int prds = 0;
+    if (batch == NULL) {
+        if (add_prds(table, &prds, buffer, bytes) != 0) {
+            return -1;
+        }
+    } else {
+        for (struct blk_request *r = batch; r != NULL; r = r->next) {
+            if (add_prds(table, &prds, r->buffer, r->count * 512) != 0) {
+                return -1;
+            }
+        }
+    }
+    table->prdt[prds - 1].dbc |= 1u << 31;  // Interrupt when the last one is done
+
+    fis->type = FIS_TYPE_REG_H2D;
+    fis->flags = 0x80;
+    fis->command = command;
+    fis->device = 0x40;             // LBA mode
+    fis->lba0 = lba;
+    fis->lba1 = lba >> 8;
+    fis->lba2 = lba >> 16;
+    fis->lba3 = lba >> 24;
+    if (command == ATA_CMD_READ_FPDMA || command == ATA_CMD_WRITE_FPDMA) {
+        // NCQ moves the sector count to the feature field; the tag goes in count
+        fis->feature_low = count;
+        fis->feature_high = count >> 8;
+        fis->count_low = slot << 3;
+    } else {
+        fis->count_low = count;
+        fis->count_high = count >> 8;
+    }
+
+    struct ahci_cmd_header *hdr = &cmd_list[slot];
+    hdr->flags = (sizeof(*fis) / 4) | (write ? (1 << 6) : 0);
+    hdr->prdtl = prds;
+    hdr->prdbc = 0;
+    hdr->ctba = (uint32_t)table;
+    hdr->ctbau = 0;
+    return 0;
+}
+
+static void issue(int slot) {
+    barrier();
+    if (ncq) {
+        port_write(PORT_SACT, 1u << slot);
+    }
+    port_write(PORT_CI, 1u << slot);
+}
+
+/*
+ * ahci_submit - Start a batch in a free command slot
+ *
+ * With NCQ up to num_slots commands are outstanding at once and the drive
+ * completes them in whatever order suits it.
+ */
+static int ahci_submit(unsigned int lba, unsigned int count, struct blk_request *batch) {
+    int write = batch->write;
+    uint8_t command;
+    if (ncq) {
+        command = write ? ATA_CMD_WRITE_FPDMA : ATA_CMD_READ_FPDMA;
+    } else {
+        command = write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+    }
+
+    // Restart a port an error stopped before giving it more work. Only the
+    // block dispatcher thread submits, so waiting for the HBA is fine here.
+    uint32_t flags;
+    for (;;) {
+        if (port_failed) {
+            port_restart();
+        }
+        flags = spin_lock_irqsave(&ahci_lock);
+        if (!port_failed) {
+            break;
+        }
+        spin_unlock_irqrestore(&ahci_lock, flags);
+    }
+
+    int slot = -1;
+    for (unsigned int i = 0; i < num_slots; i++) {
+        if (!(slots_busy & (1u << i))) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0) {
+        spin_unlock_irqrestore(&ahci_lock, flags);
+        return -1;
+    }
+
+    if (build_command(slot, command, lba, count, batch, NULL, 0, write) != 0) {
+        spin_unlock_irqrestore(&ahci_lock, flags);
+        return -1;
+    }
+    slots_busy |= 1u << slot;
+    slot_batch[slot] = batch;
+    issue(slot);
+    spin_unlock_irqrestore(&ahci_lock, flags);
+    return 0;
+}
+
+static void ahci_irq_handler(struct interrupt_frame *frame) {
+    struct blk_request *done_batch[AHCI_MAX_SLOTS];
+    int done_status[AHCI_MAX_SLOTS];
+    int ndone = 0;
+
+    if (!(hba_read(HBA_IS) & (1u << port))) {
+        return;
+    }
+
+    spin_lock(&ahci_lock);
+    uint32_t is = port_read(PORT_IS);
+    port_write(PORT_IS, is);
+
+    // A slot is done once the HBA clears its bit in SACT (NCQ) or CI. After
+    // an error the ones still set will never finish.
+    uint32_t outstanding = ncq ? port_read(PORT_SACT) : port_read(PORT_CI);
+    uint32_t failed = 0;
+    if (is & PORT_IS_ERRORS) {
+        failed = slots_busy & outstanding;
+        port_failed = 1;
+    }
+    uint32_t finished = (slots_busy & ~outstanding) | failed;
+    for (unsigned int slot = 0; slot < num_slots; slot++) {
+        if (finished & (1u << slot)) {
+            done_batch[ndone] = slot_batch[slot];
+            done_status[ndone] = (failed & (1u << slot)) ? -1 : 0;
+            ndone++;
+        }
+    }
+    slots_busy &= ~finished;
+    hba_write(HBA_IS, 1u << port);
+    spin_unlock(&ahci_lock);
+
+    for (int i = 0; i < ndone; i++) {
+        blk_complete(done_batch[i], done_status[i]);
+    }
+}
+
+// Polled IDENTIFY DEVICE in slot 0, before interrupts are turned on
+static int identify(void) {
+    if (build_command(0, ATA_CMD_IDENTIFY, 0, 0, NULL, identify_data, sizeof(identify_data), 0) != 0) {
+        return -1;
+    }
+    port_write(PORT_IS, 0xFFFFFFFF);
+    port_write(PORT_CI, 1);
+    if (port_wait(PORT_CI, 1, 0, 1000000) != 0 || (port_read(PORT_TFD) & PORT_TFD_ERR)) {
+        return -1;
+    }
+    port_write(PORT_IS, 0xFFFFFFFF);
+    return 0;
+}
+
+static int find_disk_port(void) {
+    uint32_t implemented = hba_read(HBA_PI);
+    for (int i = 0; i < 32; i++) {
+        if (!(implemented & (1u << i))) continue;
+        uint32_t ssts = hba_read(PORT_BASE(i) + PORT_SSTS);
+        if ((ssts & 0xF) == SSTS_DET_PRESENT && hba_read(PORT_BASE(i) + PORT_SIG) == SATA_SIG_ATA) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Command list (1 KB) and FIS area (256 bytes) share the first frame; the
+// command tables follow
+static int port_setup(void) {
+    unsigned int bytes = PAGE_SIZE + AHCI_MAX_SLOTS * AHCI_CMD_TABLE_SIZE;
+    struct ppage *pages = allocate_contiguous_pages(bytes / PAGE_SIZE);
+    if (pages == NULL) {
+        return -1;
+    }
+    uint8_t *mem = pages->physical_addr;
+    memset(mem, 0, bytes);
+    cmd_list = (struct ahci_cmd_header *)mem;
+    fis_area = mem + 1024;
+    cmd_tables = (struct ahci_cmd_table *)(mem + PAGE_SIZE);
+
+    port_stop();
+    port_write(PORT_CLB, (uint32_t)cmd_list);
+    port_write(PORT_CLBU, 0);
+    port_write(PORT_FB, (uint32_t)fis_area);
+    port_write(PORT_FBU, 0);
+    port_write(PORT_SERR, 0xFFFFFFFF);
+    port_write(PORT_IS, 0xFFFFFFFF);
+    port_start();
+    return 0;
+}
+
+/*
+ * ahci_init - Bring up the first SATA disk on an AHCI controller and make
+ * it the block layer's backend
+ *
+ * Uses NCQ when both the HBA and the drive support it, with as many
+ * commands in flight as both allow; otherwise one DMA command at a time.
+ * Expects pci_init and blk_init to have run. Returns 0 if a disk was
+ * registered, -1 otherwise.
+ */
+int ahci_init(void) {
+    struct pci_device *dev = pci_find_class(AHCI_CLASS, AHCI_SUBCLASS, AHCI_PROG_IF);
+    if (dev == NULL) {
+        return -1;
+    }
+    uint32_t abar_phys = dev->bar[AHCI_ABAR] & ~0xF;
+    abar = map_mmio(abar_phys, AHCI_ABAR_SIZE);
+    if (abar == NULL) {
+        return -1;
+    }
+    pci_enable(dev, PCI_COMMAND_MEMORY | PCI_COMMAND_BUS_MASTER);
+    hba_write(HBA_GHC, hba_read(HBA_GHC) | HBA_GHC_AE);
+
+    port = find_disk_port();
+    if (port < 0) {
+        esp_printf(putc, "ahci: no disk attached\r\n");
+        return -1;
+    }
+    if (port_setup() != 0 || identify() != 0) {
+        esp_printf(putc, "ahci: port %d did not respond\r\n", port);
+        return -1;
+    }
+
+    // Slots the HBA has, and the queue depth the drive accepts (word 75)
+    uint32_t cap = hba_read(HBA_CAP);
+    num_slots = ((cap >> 8) & 0x1F) + 1;
+    unsigned int drive_depth = (identify_data[75] & 0x1F) + 1;
+    if ((cap & HBA_CAP_SNCQ) && (identify_data[76] & (1 << 8))) {
+        ncq = 1;
+        if (drive_depth < num_slots) num_slots = drive_depth;
+    } else {
+        num_slots = 1;
+    }
+    ahci_device.queue_depth = num_slots;
+
+    register_interrupt_handler(IRQ_BASE + dev->irq_line, ahci_irq_handler);
+    irq_unmask(dev->irq_line);
+    port_write(PORT_IE, PORT_IS_DHRS | PORT_IS_SDBS | PORT_IS_ERRORS);
+    hba_write(HBA_GHC, hba_read(HBA_GHC) | HBA_GHC_IE);
+
+    uint32_t sectors = identify_data[100] | ((uint32_t)identify_data[101] << 16);
+    esp_printf(putc, "ahci: port %d, %d MB, %s, %d commands in flight\r\n",
+               port, sectors / 2048, ncq ? "NCQ" : "no NCQ", num_slots);
+
+    blk_register_device(&ahci_device);
+    return 0;
+}
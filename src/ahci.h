@@ -0,0 +1,120 @@
+#ifndef AHCI_H
+#define AHCI_H
+
+#include <stdint.h>
+
+// PCI class of an AHCI controller: mass storage, SATA, AHCI 1.0
+#define AHCI_CLASS    0x01
+#define AHCI_SUBCLASS 0x06
+#define AHCI_PROG_IF  0x01
+
+#define AHCI_ABAR     5         // BAR holding the HBA registers
+#define AHCI_ABAR_SIZE 0x1100   // Generic registers plus 32 ports
+
+// Generic host control registers
+#define HBA_CAP  0x00
+#define HBA_GHC  0x04
+#define HBA_IS   0x08
+#define HBA_PI   0x0C
+
+#define HBA_CAP_SNCQ   (1u << 30)   // Native command queuing supported
+#define HBA_GHC_AE     (1u << 31)   // AHCI enable
+#define HBA_GHC_IE     (1u << 1)    // Interrupt enable
+
+// Port registers, at 0x100 + 0x80 * port
+#define PORT_BASE(n) (0x100 + 0x80 * (n))
+#define PORT_CLB   0x00
+#define PORT_CLBU  0x04
+#define PORT_FB    0x08
+#define PORT_FBU   0x0C
+#define PORT_IS    0x10
+#define PORT_IE    0x14
+#define PORT_CMD   0x18
+#define PORT_TFD   0x20
+#define PORT_SIG   0x24
+#define PORT_SSTS  0x28
+#define PORT_SERR  0x30
+#define PORT_SACT  0x34
+#define PORT_CI    0x38
+
+#define PORT_CMD_ST   (1u << 0)     // Start processing the command list
+#define PORT_CMD_FRE  (1u << 4)     // FIS receive enable
+#define PORT_CMD_FR   (1u << 14)    // FIS receive running
+#define PORT_CMD_CR   (1u << 15)    // Command list running
+
+#define PORT_IS_DHRS  (1u << 0)     // D2H register FIS received
+#define PORT_IS_SDBS  (1u << 3)     // Set device bits FIS (NCQ completion)
+#define PORT_IS_TFES  (1u << 30)    // Task file error
+#define PORT_IS_ERRORS 0x7DC00050   // Every error status bit
+
+#define PORT_TFD_BSY  0x80
+#define PORT_TFD_DRQ  0x08
+#define PORT_TFD_ERR  0x01
+
+#define SATA_SIG_ATA  0x00000101
+#define SSTS_DET_PRESENT 3          // Device detected, phy communication up
+
+// ATA commands
+#define ATA_CMD_IDENTIFY        0xEC
+#define ATA_CMD_READ_DMA_EXT    0x25
+#define ATA_CMD_WRITE_DMA_EXT   0x35
+#define ATA_CMD_READ_FPDMA      0x60
+#define ATA_CMD_WRITE_FPDMA     0x61
+
+#define FIS_TYPE_REG_H2D 0x27
+
+#define AHCI_MAX_SLOTS 32
+#define AHCI_MAX_SEGMENTS 16        // Requests merged into one command
+// A batch is at most BLK_MAX_SECTORS (16 pages) in up to 16 requests, and
+// each request can start and end partway into a page
+#define AHCI_MAX_PRDS  48           // Physically contiguous pieces per command
+#define AHCI_CMD_TABLE_SIZE 1024    // 128 byte header area + 48 PRDs, 128 aligned
+
+// Command list entry
+struct ahci_cmd_header {
+    uint16_t flags;         // Bits 0-4 FIS length in dwords, bit 6 write
+    uint16_t prdtl;         // PRD entries
+    uint32_t prdbc;         // Bytes transferred
+    uint32_t ctba;
+    uint32_t ctbau;
+    uint32_t reserved[4];
+} __attribute__((packed));
+
+// Host to device register FIS
+struct fis_reg_h2d {
+    uint8_t type;
+    uint8_t flags;          // Bit 7: command rather than control
+    uint8_t command;
+    uint8_t feature_low;
+    uint8_t lba0;
+    uint8_t lba1;
+    uint8_t lba2;
+    uint8_t device;
+    uint8_t lba3;
+    uint8_t lba4;
+    uint8_t lba5;
+    uint8_t feature_high;
+    uint8_t count_low;
+    uint8_t count_high;
+    uint8_t icc;
+    uint8_t control;
+    uint8_t reserved[4];
+} __attribute__((packed));
+
+struct ahci_prd {
+    uint32_t dba;
+    uint32_t dbau;
+    uint32_t reserved;
+    uint32_t dbc;           // Byte count - 1, bit 31 interrupt on completion
+} __attribute__((packed));
+
+struct ahci_cmd_table {
+    uint8_t cfis[64];
+    uint8_t acmd[16];
+    uint8_t reserved[48];
+    struct ahci_prd prdt[AHCI_MAX_PRDS];
+} __attribute__((packed));
+
+int ahci_init(void);
+
+#endif
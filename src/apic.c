@@ -0,0 +1,236 @@
+#include "apic.h"
+#include "mmu.h"
+#include "io.h"
+#include "interrupt.h"
+#include "timer.h"
+#include "smp.h"
+#include <stddef.h>
+
+// Local APIC register offsets
+#define LAPIC_ID        0x020
+#define LAPIC_TPR       0x080
+#define LAPIC_EOI       0x0B0
+#define LAPIC_SVR       0x0F0
+#define LAPIC_ICR_LOW   0x300
+#define LAPIC_ICR_HIGH  0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_LVT_LINT0 0x350
+#define LAPIC_LVT_LINT1 0x360
+#define LAPIC_LVT_ERROR 0x370
+#define LAPIC_TIMER_INIT 0x380
+#define LAPIC_TIMER_CUR 0x390
+#define LAPIC_TIMER_DIV 0x3E0
+
+#define LAPIC_SVR_ENABLE        0x100
+#define LAPIC_LVT_MASKED        0x10000
+#define LAPIC_TIMER_PERIODIC    0x20000
+#define ICR_DELIVERY_PENDING    0x1000
+
+// IO-APIC registers
+#define IOAPIC_REGSEL   0x00
+#define IOAPIC_WINDOW   0x10
+#define IOAPIC_VERSION  0x01
+#define IOAPIC_REDTBL   0x10
+
+#define IOREDTBL_MASKED         0x10000
+#define IOREDTBL_LEVEL          0x8000
+#define IOREDTBL_ACTIVE_LOW     0x2000
+
+static volatile uint32_t *lapic = NULL;
+static volatile uint32_t *ioapic = NULL;
+static struct smp_info *smp;
+static uint32_t lapic_ticks_per_tick = 0;
+static int active = 0;
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return lapic[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t val) {
+    lapic[reg / 4] = val;
+    (void)lapic[LAPIC_ID / 4];  // Read back to make sure the write landed
+}
+
+static uint32_t ioapic_read(uint32_t reg) {
+    ioapic[IOAPIC_REGSEL / 4] = reg;
+    return ioapic[IOAPIC_WINDOW / 4];
+}
+
+static void ioapic_write(uint32_t reg, uint32_t val) {
+    ioapic[IOAPIC_REGSEL / 4] = reg;
+    ioapic[IOAPIC_WINDOW / 4] = val;
+}
+
+// Roughly usec microseconds: each write to port 0x80 takes about 1us
+void udelay(uint32_t usec) {
+    for (uint32_t i = 0; i < usec; i++) {
+        io_wait();
+    }
+}
+
+int apic_active(void) {
+    return active;
+}
+
+uint8_t lapic_id(void) {
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_eoi(void) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+static void lapic_spurious_handler(struct interrupt_frame *frame) {
+    // Spurious interrupts must not be acknowledged
+}
+
+static void lapic_timer_handler(struct interrupt_frame *frame) {
+    timer_handle_tick(this_cpu()->id == 0);
+}
+
+// Enable this CPU's local APIC. Runs on every CPU.
+void lapic_init(void) {
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+}
+
+/*
+ * lapic_timer_calibrate - Measure the local APIC timer against the PIT
+ *
+ * Runs on the BSP with interrupts enabled and the PIT ticking. All CPUs'
+ * APIC timers run at the bus clock, so the result is shared.
+ */
+void lapic_timer_calibrate(void) {
+    lapic_write(LAPIC_TIMER_DIV, 0x3);          // Divide by 16
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+
+    // Wait for a tick edge, then count for 10 ticks
+    uint32_t start = timer_ticks();
+    while (timer_ticks() == start) {
+        asm volatile("pause");
+    }
+    start = timer_ticks();
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    while (timer_ticks() - start < 10) {
+        asm volatile("pause");
+    }
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CUR);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+
+    lapic_ticks_per_tick = elapsed / 10;
+}
+
+// Start this CPU's periodic scheduler tick at HZ
+void lapic_timer_start(void) {
+    lapic_write(LAPIC_TIMER_DIV, 0x3);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INIT, lapic_ticks_per_tick);
+}
+
+static void lapic_wait_icr(void) {
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_DELIVERY_PENDING) {
+        asm volatile("pause");
+    }
+}
+
+void lapic_send_ipi(uint8_t apic_id, uint8_t vector) {
+    lapic_write(LAPIC_ICR_HIGH, (uint32_t)apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, vector);
+    lapic_wait_icr();
+}
+
+void lapic_send_init(uint8_t apic_id) {
+    lapic_write(LAPIC_ICR_HIGH, (uint32_t)apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, 0x4500);         // INIT, level assert
+    lapic_wait_icr();
+}
+
+// STARTUP IPI: the AP begins in real mode at trampoline_addr (4 KB aligned, below 1 MB)
+void lapic_send_startup(uint8_t apic_id, uint32_t trampoline_addr) {
+    lapic_write(LAPIC_ICR_HIGH, (uint32_t)apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, 0x4600 | (trampoline_addr >> 12));
+    lapic_wait_icr();
+}
+
+static void ioapic_set_entry(uint32_t gsi, uint32_t low, uint32_t high) {
+    uint32_t pin = gsi - smp->ioapic_gsi_base;
+    ioapic_write(IOAPIC_REDTBL + 2 * pin + 1, high);
+    ioapic_write(IOAPIC_REDTBL + 2 * pin, low);
+}
+
+void ioapic_unmask(uint8_t irq) {
+    uint32_t gsi = smp->irq_gsi[irq];
+    uint32_t pin = gsi - smp->ioapic_gsi_base;
+    uint32_t low = ioapic_read(IOAPIC_REDTBL + 2 * pin);
+    ioapic_write(IOAPIC_REDTBL + 2 * pin, low & ~IOREDTBL_MASKED);
+}
+
+void ioapic_mask(uint8_t irq) {
+    uint32_t gsi = smp->irq_gsi[irq];
+    uint32_t pin = gsi - smp->ioapic_gsi_base;
+    uint32_t low = ioapic_read(IOAPIC_REDTBL + 2 * pin);
+    ioapic_write(IOAPIC_REDTBL + 2 * pin, low | IOREDTBL_MASKED);
+}
+
+/*
+ * apic_init - Switch interrupt delivery from the 8259 PIC to the APICs
+ *
+ * Maps the local and IO-APIC registers, routes every ISA IRQ through the
+ * IO-APIC to the BSP (masked until irq_unmask is called) and disables the
+ * PIC. The PIT is left masked: each CPU's local APIC timer drives the
+ * scheduler tick from here on.
+ *
+ * Returns: 0 on success, -1 if there is no IO-APIC to route IRQs through
+ */
+int apic_init(struct smp_info *info) {
+    if (info->ioapic_addr == 0) {
+        return -1;
+    }
+    smp = info;
+
+    lapic = map_mmio(info->lapic_addr, 0x1000);
+    ioapic = map_mmio(info->ioapic_addr, 0x1000);
+    if (lapic == NULL || ioapic == NULL) {
+        return -1;
+    }
+
+    register_interrupt_handler(LAPIC_SPURIOUS_VECTOR, lapic_spurious_handler);
+    register_interrupt_handler(LAPIC_TIMER_VECTOR, lapic_timer_handler);
+    lapic_init();
+
+    uint8_t bsp_apic_id = lapic_id();
+    uint32_t max_entry = (ioapic_read(IOAPIC_VERSION) >> 16) & 0xFF;
+    for (uint32_t pin = 0; pin <= max_entry; pin++) {
+        ioapic_write(IOAPIC_REDTBL + 2 * pin, IOREDTBL_MASKED);
+    }
+
+    for (int irq = 0; irq < 16; irq++) {
+        uint32_t low = (IRQ_BASE + irq) | IOREDTBL_MASKED;
+        if (info->irq_flags[irq] & IRQ_FLAG_ACTIVE_LOW) {
+            low |= IOREDTBL_ACTIVE_LOW;
+        }
+        if (info->irq_flags[irq] & IRQ_FLAG_LEVEL) {
+            low |= IOREDTBL_LEVEL;
+        }
+        ioapic_set_entry(info->irq_gsi[irq], low, (uint32_t)bsp_apic_id << 24);
+    }
+
+    // Measure the APIC timer while the PIT is still running, then hand
+    // every line the PIC had enabled over to the IO-APIC
+    lapic_timer_calibrate();
+
+    uint32_t flags = irq_save();
+    uint16_t pic_mask = pic_disable();
+    active = 1;
+    for (int irq = 1; irq < 16; irq++) {
+        if (irq != 2 && !(pic_mask & (1 << irq))) {
+            ioapic_unmask(irq);
+        }
+    }
+    lapic_timer_start();
+    irq_restore(flags);
+
+    return 0;
+}
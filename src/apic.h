@@ -0,0 +1,30 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include <stdint.h>
+#include "acpi.h"
+
+// Vectors used by the local APIC
+#define LAPIC_TIMER_VECTOR      0xF0
+#define RESCHEDULE_VECTOR       0xF1
+#define TLB_SHOOTDOWN_VECTOR    0xF2
+#define LAPIC_SPURIOUS_VECTOR   0xFF
+
+/*
+ * Function declarations
+ */
+int apic_init(struct smp_info *info);
+int apic_active(void);
+void lapic_init(void);
+uint8_t lapic_id(void);
+void lapic_eoi(void);
+void lapic_timer_calibrate(void);
+void lapic_timer_start(void);
+void lapic_send_ipi(uint8_t apic_id, uint8_t vector);
+void lapic_send_init(uint8_t apic_id);
+void lapic_send_startup(uint8_t apic_id, uint32_t trampoline_addr);
+void ioapic_unmask(uint8_t irq);
+void ioapic_mask(uint8_t irq);
+void udelay(uint32_t usec);
+
+#endif
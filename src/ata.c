@@ -0,0 +1,67 @@
+#include "ide.h"
+#include "interrupt.h"
+#include "thread.h"
+#include "blk.h"
+
+// Serializes use of the primary ATA channel between threads
+static struct mutex ata_lock;
+
+// Threads waiting for the drive to interrupt
+static struct wait_queue ata_wq;
+static volatile int ata_irq_pending = 0;
+
+// The sector count register is 8 bits wide
+static struct blk_device ata_device = {
+    .name = "ata",
+    .max_sectors = 255,
+    .read = ide_read,
+    .write = ide_write,
+};
+
+static void ata_irq_handler(struct interrupt_frame *frame) {
+    ata_irq_pending = 1;
+    wake_up(&ata_wq);
+}
+
+void ide_init(void) {
+    mutex_init(&ata_lock, "ata_mutex");
+    wait_queue_init(&ata_wq, "ata_irq");
+    register_interrupt_handler(IRQ_BASE + IRQ_PRIMARY_ATA, ata_irq_handler);
+    irq_unmask(2);      // Cascade, so the slave PIC's IRQs get through
+    irq_unmask(IRQ_PRIMARY_ATA);
+    blk_register_device(&ata_device);
+}
+
+/*
+ * ata_wait_irq - Called from ata_lba_read before each sector is transferred
+ *
+ * Blocks the calling thread until the drive signals that data is ready,
+ * letting other threads run instead of spinning on the status port.
+ * Before the scheduler starts (or with interrupts off) it returns at once
+ * and ata_lba_read polls as before.
+ */
+void ata_wait_irq(void) {
+    if (!scheduler_running() || in_interrupt() || !interrupts_enabled()) {
+        return;
+    }
+
+    wait_event(&ata_wq, ata_irq_pending);
+    ata_irq_pending = 0;
+}
+
+// Thread-safe read of numsectors sectors starting at lba
+int ide_read(unsigned int lba, unsigned char *buffer, unsigned int numsectors) {
+    mutex_lock(&ata_lock);
+    ata_irq_pending = 0;
+    int result = ata_lba_read(lba, buffer, numsectors);
+    mutex_unlock(&ata_lock);
+    return result;
+}
+
+int ide_write(unsigned int lba, const unsigned char *buffer, unsigned int numsectors) {
+    mutex_lock(&ata_lock);
+    ata_irq_pending = 0;
+    int result = ata_lba_write(lba, buffer, numsectors);
+    mutex_unlock(&ata_lock);
+    return result;
+}
@@ -0,0 +1,79 @@
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+#include <stdint.h>
+
+/*
+ * Atomic operations for data shared between CPUs and interrupt handlers.
+ * The lock prefix makes the read-modify-write atomic across CPUs and acts
+ * as a full memory barrier. cmpxchg and xadd need a 486 or later.
+ */
+
+typedef struct {
+    volatile int counter;
+} atomic_t;
+
+#define ATOMIC_INIT(i) { (i) }
+
+// Compiler barrier: stop gcc from caching or reordering memory accesses
+#define barrier() asm volatile("" : : : "memory")
+
+static inline void cpu_relax(void) {
+    asm volatile("pause" : : : "memory");
+}
+
+// Atomically add v to *p and return the old value
+static inline uint32_t xadd(volatile uint32_t *p, uint32_t v) {
+    asm volatile("lock xaddl %0, %1" : "+r"(v), "+m"(*p) : : "memory");
+    return v;
+}
+
+// Atomically set *p to new if it equals old. Returns the value *p had.
+static inline uint32_t cmpxchg(volatile uint32_t *p, uint32_t old, uint32_t new) {
+    uint32_t prev;
+    asm volatile("lock cmpxchgl %2, %1"
+                 : "=a"(prev), "+m"(*p)
+                 : "r"(new), "0"(old)
+                 : "memory");
+    return prev;
+}
+
+// Atomically swap in v and return the old value (xchg is always locked)
+static inline uint32_t xchg(volatile uint32_t *p, uint32_t v) {
+    asm volatile("xchgl %0, %1" : "+r"(v), "+m"(*p) : : "memory");
+    return v;
+}
+
+static inline int atomic_read(const atomic_t *a) {
+    return a->counter;
+}
+
+static inline void atomic_set(atomic_t *a, int i) {
+    a->counter = i;
+}
+
+// Returns the new value
+static inline int atomic_add_return(atomic_t *a, int i) {
+    return (int)xadd((volatile uint32_t *)&a->counter, i) + i;
+}
+
+static inline void atomic_inc(atomic_t *a) {
+    asm volatile("lock incl %0" : "+m"(a->counter) : : "memory");
+}
+
+static inline void atomic_dec(atomic_t *a) {
+    asm volatile("lock decl %0" : "+m"(a->counter) : : "memory");
+}
+
+// Decrement and return true if the result is zero
+static inline int atomic_dec_and_test(atomic_t *a) {
+    uint8_t zero;
+    asm volatile("lock decl %0; sete %1" : "+m"(a->counter), "=qm"(zero) : : "memory");
+    return zero;
+}
+
+static inline int atomic_cmpxchg(atomic_t *a, int old, int new) {
+    return (int)cmpxchg((volatile uint32_t *)&a->counter, old, new);
+}
+
+#endif
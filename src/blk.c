@@ -0,0 +1,320 @@
+#include "blk.h"
+#include "thread.h"
+#include "timer.h"
+#include "vm.h"
+#include "rprintf.h"
+#include "string.h"
+#include <stddef.h>
+
+extern int putc(int c);
+
+#define SECTOR_BYTES 512
+
+static struct blk_device *blk_dev = NULL;
+
+// Pending requests sorted by LBA. The dispatcher sleeps on blk_wq, whose
+// lock also protects the queue, so a submit can't slip in unnoticed
+static struct wait_queue blk_wq;
+static struct blk_request *queue_head = NULL;
+static unsigned int queue_len = 0;
+static unsigned int head_pos = 0;      // LBA just past the last dispatch
+static unsigned int inflight = 0;      // Batches handed to the device
+
+// Synchronous callers sleep here until their request completes
+static struct wait_queue blk_done_wq;
+
+static unsigned char *bounce = NULL;    // Staging area for merged transfers
+static int blk_running = 0;
+
+static struct {
+    uint32_t submitted;
+    uint32_t dispatched;                // Commands sent to the device
+    uint32_t merged;                    // Requests that rode along with another
+    uint32_t sectors;
+    uint32_t deadline_expired;
+    uint32_t max_queue;
+    uint32_t max_inflight;
+} stats;
+
+void blk_register_device(struct blk_device *dev) {
+    blk_dev = dev;
+    esp_printf(putc, "Block device: %s\r\n", dev->name);
+}
+
+static unsigned int max_transfer(void) {
+    return (blk_dev->max_sectors < BLK_MAX_SECTORS) ? blk_dev->max_sectors : BLK_MAX_SECTORS;
+}
+
+static unsigned int queue_depth(void) {
+    return (blk_dev->submit != NULL) ? blk_dev->queue_depth : 1;
+}
+
+// Perform a single request directly on a synchronous device
+static int blk_do_request(struct blk_request *req) {
+    if (blk_dev->read == NULL) {
+        return -1;
+    }
+    if (req->write) {
+        return blk_dev->write(req->lba, req->buffer, req->count);
+    }
+    return blk_dev->read(req->lba, req->buffer, req->count);
+}
+
+/*
+ * Choose the next request to dispatch and unlink it.
+ *
+ * C-SCAN: the lowest LBA at or beyond the head position, wrapping to the
+ * start of the queue. A request that has waited longer than BLK_DEADLINE
+ * ticks goes first, so a stream of nearby requests can't starve it.
+ * Returns the link that pointed at it, where merging continues from.
+ */
+static struct blk_request **pick_request(void) {
+    struct blk_request **oldest = &queue_head;
+    struct blk_request **next = NULL;
+
+    for (struct blk_request **pp = &queue_head; *pp != NULL; pp = &(*pp)->next) {
+        if ((*pp)->submitted < (*oldest)->submitted) {
+            oldest = pp;
+        }
+        if (next == NULL && (*pp)->lba >= head_pos) {
+            next = pp;
+        }
+    }
+
+    if (timer_ticks() - (*oldest)->submitted > BLK_DEADLINE) {
+        stats.deadline_expired++;
+        return oldest;
+    }
+    return (next != NULL) ? next : &queue_head;
+}
+
+/*
+ * Take the next request and every queued request that can share its
+ * device command: same direction, and starting inside or right after the
+ * range so far. Reads may overlap; writes only merge when adjacent, so
+ * two writes to one sector still land in submission order. Batches for
+ * submit devices must be exactly adjacent, since each request becomes one
+ * scatter/gather segment.
+ * Called with the queue lock held. Returns the batch linked through next.
+ */
+static struct blk_request *build_batch(unsigned int *start, unsigned int *end) {
+    struct blk_request **pp = pick_request();
+    struct blk_request *first = *pp;
+    *pp = first->next;
+    first->next = NULL;
+    queue_len--;
+
+    struct blk_request *tail = first;
+    *start = first->lba;
+    *end = first->lba + first->count;
+
+    int overlap_ok = !first->write && blk_dev->submit == NULL;
+    unsigned int segments = 1;
+    while (*pp != NULL) {
+        struct blk_request *r = *pp;
+        if (r->write != first->write) break;
+        if (overlap_ok ? (r->lba > *end) : (r->lba != *end)) break;
+        if (blk_dev->max_segments != 0 && segments == blk_dev->max_segments) break;
+
+        unsigned int r_end = r->lba + r->count;
+        unsigned int new_end = (r_end > *end) ? r_end : *end;
+        if (new_end - *start > max_transfer()) break;
+
+        *pp = r->next;
+        r->next = NULL;
+        tail->next = r;
+        tail = r;
+        *end = new_end;
+        segments++;
+        queue_len--;
+        stats.merged++;
+    }
+    return first;
+}
+
+// Run one batch on the device, through the bounce buffer if it was merged
+static void dispatch_batch(struct blk_request *batch, unsigned int start, unsigned int end) {
+    int status;
+
+    if (batch->next == NULL) {
+        status = blk_do_request(batch);
+    } else if (batch->write) {
+        for (struct blk_request *r = batch; r != NULL; r = r->next) {
+            memcpy(bounce + (r->lba - start) * SECTOR_BYTES, r->buffer, r->count * SECTOR_BYTES);
+        }
+        status = blk_dev->write(start, bounce, end - start);
+    } else {
+        status = blk_dev->read(start, bounce, end - start);
+        if (status == 0) {
+            for (struct blk_request *r = batch; r != NULL; r = r->next) {
+                memcpy(r->buffer, bounce + (r->lba - start) * SECTOR_BYTES, r->count * SECTOR_BYTES);
+            }
+        }
+    }
+    blk_complete(batch, status);
+}
+
+/*
+ * blk_complete - Finish a dispatched batch
+ *
+ * Sets every request's status and calls its done callback, then lets the
+ * dispatcher send another batch. Safe to call from an interrupt handler.
+ */
+void blk_complete(struct blk_request *batch, int status) {
+    while (batch != NULL) {
+        struct blk_request *next = batch->next;
+        batch->status = status;
+        batch->done(batch);
+        batch = next;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&blk_wq.lock);
+    inflight--;
+    spin_unlock_irqrestore(&blk_wq.lock, flags);
+    wake_up(&blk_wq);
+}
+
+static void blk_dispatcher(void *arg) {
+    for (;;) {
+        wait_event(&blk_wq, queue_head != NULL && inflight < queue_depth());
+
+        unsigned int start, end;
+        uint32_t flags = spin_lock_irqsave(&blk_wq.lock);
+        struct blk_request *batch = build_batch(&start, &end);
+        head_pos = end;
+        if (++inflight > stats.max_inflight) {
+            stats.max_inflight = inflight;
+        }
+        stats.dispatched++;
+        stats.sectors += end - start;
+        spin_unlock_irqrestore(&blk_wq.lock, flags);
+
+        if (blk_dev->submit == NULL) {
+            dispatch_batch(batch, start, end);
+        } else if (blk_dev->submit(start, end - start, batch) != 0) {
+            blk_complete(batch, -1);
+        }
+    }
+}
+
+/*
+ * blk_submit - Queue a request for the dispatcher
+ *
+ * Returns 0 once queued, or -1 if the request is malformed or there is no
+ * device. Until blk_init has started the dispatcher the request is
+ * performed on the spot and done is called before returning; only
+ * synchronous devices can be used that way.
+ */
+int blk_submit(struct blk_request *req) {
+    if (blk_dev == NULL || req->count == 0 || req->count > max_transfer()) {
+        return -1;
+    }
+
+    req->status = 0;
+    req->next = NULL;
+    if (!blk_running) {
+        req->status = blk_do_request(req);
+        req->done(req);
+        return 0;
+    }
+
+    req->submitted = timer_ticks();
+    uint32_t flags = spin_lock_irqsave(&blk_wq.lock);
+    struct blk_request **pp = &queue_head;
+    while (*pp != NULL && (*pp)->lba <= req->lba) {
+        pp = &(*pp)->next;
+    }
+    req->next = *pp;
+    *pp = req;
+    stats.submitted++;
+    if (++queue_len > stats.max_queue) {
+        stats.max_queue = queue_len;
+    }
+    spin_unlock_irqrestore(&blk_wq.lock, flags);
+
+    wake_up(&blk_wq);
+    return 0;
+}
+
+static void blk_sync_done(struct blk_request *req) {
+    *(volatile int *)req->private = 1;
+    wake_up(&blk_done_wq);
+}
+
+// Submit and sleep until done, splitting anything larger than one transfer.
+// Must not be called from the dispatcher itself (i.e. from a done callback).
+static int blk_sync(int write, unsigned int lba, unsigned char *buffer, unsigned int count) {
+    if (blk_dev == NULL) {
+        return -1;
+    }
+
+    while (count > 0) {
+        volatile int done = 0;
+        struct blk_request req;
+        req.lba = lba;
+        req.count = (count < max_transfer()) ? count : max_transfer();
+        req.write = write;
+        req.buffer = buffer;
+        req.done = blk_sync_done;
+        req.private = (void *)&done;
+
+        if (blk_submit(&req) != 0) {
+            return -1;
+        }
+        wait_event(&blk_done_wq, done);
+        if (req.status != 0) {
+            return req.status;
+        }
+
+        lba += req.count;
+        buffer += req.count * SECTOR_BYTES;
+        count -= req.count;
+    }
+    return 0;
+}
+
+int blk_read_sync(unsigned int lba, unsigned char *buffer, unsigned int count) {
+    return blk_sync(0, lba, buffer, count);
+}
+
+int blk_write_sync(unsigned int lba, const unsigned char *buffer, unsigned int count) {
+    return blk_sync(1, lba, (unsigned char *)buffer, count);
+}
+
+/*
+ * blk_init - Start the request queue
+ *
+ * Needs the scheduler and a registered device. Until this runs, requests
+ * go straight to the device.
+ */
+void blk_init(void) {
+    wait_queue_init(&blk_wq, "blk_queue");
+    wait_queue_init(&blk_done_wq, "blk_done");
+
+    // Only synchronous (PIO) devices use it, so it needn't be physically contiguous
+    if (blk_dev != NULL) {
+        bounce = vmalloc(BLK_MAX_SECTORS * SECTOR_BYTES);
+    }
+    if (bounce == NULL) {
+        esp_printf(putc, "Block queue disabled, requests go straight to the device\r\n");
+        return;
+    }
+
+    if (thread_create(blk_dispatcher, NULL, PRIORITY_HIGH, "blkd") == NULL) {
+        vfree(bounce);
+        return;
+    }
+    blk_running = 1;
+}
+
+// Requests submitted since boot, to check what has touched the disk
+uint32_t blk_request_count(void) {
+    return stats.submitted;
+}
+
+void blk_stats_dump(void) {
+    esp_printf(putc, "blk: %d requests, %d commands, %d merged, %d sectors, "
+               "%d past deadline, queue peak %d, in flight peak %d\r\n",
+               stats.submitted, stats.dispatched, stats.merged, stats.sectors,
+               stats.deadline_expired, stats.max_queue, stats.max_inflight);
+}
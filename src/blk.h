@@ -0,0 +1,58 @@
+#ifndef BLK_H
+#define BLK_H
+
+#include <stdint.h>
+
+#define BLK_MAX_SECTORS 128     // Largest merged transfer (64 KB bounce buffer)
+#define BLK_DEADLINE    50      // Ticks a request may wait before it jumps the elevator
+
+struct blk_request;
+typedef void (*blk_done_t)(struct blk_request *req);
+
+/*
+ * A storage backend. Calls are made from the dispatcher thread only.
+ *
+ * Synchronous devices provide read and write. Devices that can have many
+ * commands outstanding provide submit instead, which starts a batch of
+ * requests covering count sectors at lba (one buffer segment per request,
+ * in order) and returns; the device later calls blk_complete, typically
+ * from its interrupt handler. Up to queue_depth batches are in flight.
+ */
+struct blk_device {
+    const char *name;
+    unsigned int max_sectors;   // Largest transfer a single command can do
+    unsigned int max_segments;  // Most requests per batch for submit, 0 = no limit
+    unsigned int queue_depth;   // Batches in flight at once for submit
+    int (*read)(unsigned int lba, unsigned char *buffer, unsigned int count);
+    int (*write)(unsigned int lba, const unsigned char *buffer, unsigned int count);
+    int (*submit)(unsigned int lba, unsigned int count, struct blk_request *batch);
+};
+
+/*
+ * A read or write of count sectors at lba. The caller owns the request and
+ * must keep it (and buffer) alive until done is called. done runs in the
+ * dispatcher thread, or in interrupt context for devices with submit, with
+ * status 0 on success.
+ */
+struct blk_request {
+    unsigned int lba;
+    unsigned int count;
+    int write;
+    unsigned char *buffer;
+    blk_done_t done;
+    void *private;              // For the submitter's use
+    int status;
+    uint32_t submitted;         // Tick the request was queued at
+    struct blk_request *next;   // Queue link, then batch link once dispatched
+};
+
+void blk_register_device(struct blk_device *dev);
+void blk_init(void);
+int blk_submit(struct blk_request *req);
+void blk_complete(struct blk_request *batch, int status);
+int blk_read_sync(unsigned int lba, unsigned char *buffer, unsigned int count);
+int blk_write_sync(unsigned int lba, const unsigned char *buffer, unsigned int count);
+uint32_t blk_request_count(void);
+void blk_stats_dump(void);
+
+#endif
@@ -0,0 +1,31 @@
+# Kernel entry point
+# GRUB jumps here with EAX = multiboot2 magic and EBX = physical address of
+# the multiboot2 information structure. We switch to our own stack and pass
+# both on to main(magic, mbi).
+
+    .code32
+    .section .text
+    .global _start
+_start:
+    cli
+    movl $boot_stack_top, %esp
+    xorl %ebp, %ebp
+
+    pushl %ebx              # multiboot2 info address
+    pushl %eax              # multiboot2 magic
+    call main
+
+.halt:
+    hlt
+    jmp .halt
+
+# The boot stack becomes the stack of the "main" kernel thread
+    .section .stack, "aw", @nobits
+    .align 16
+    .global boot_stack_bottom
+boot_stack_bottom:
+    .skip 16384
+    .global boot_stack_top
+boot_stack_top:
+
+.section .note.GNU-stack,"",@progbits
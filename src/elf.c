@@ -0,0 +1,152 @@
+#include "elf.h"
+#include "page.h"
+#include "timer.h"
+#include "rprintf.h"
+#include <stddef.h>
+
+extern int putc(int c);
+
+static int header_valid(struct elf_header *eh) {
+    return eh->e_magic == ELF_MAGIC && eh->e_class == ELFCLASS32 &&
+           eh->e_data == ELFDATA2LSB && eh->e_type == ET_EXEC &&
+           eh->e_machine == EM_386 &&
+           eh->e_phentsize >= sizeof(struct elf_program_header);
+}
+
+/*
+ * elf_fault - Supply one page of a segment
+ *
+ * The part of the page inside the segment's file contents is read from
+ * the file into a zeroed frame; anything beyond them (.bss) stays zero.
+ * Reading from disk sleeps, which the page fault handler allows for
+ * regions with a fault callback.
+ *
+ * Returns: 0 if the page is mapped, -1 on a read error or out of memory
+ */
+static int elf_fault(struct vm_region *region, uint32_t addr) {
+    struct elf_segment *seg = region->private;
+    struct ppage *frame = allocate_page(PFA_ZERO);
+    if (frame == NULL) {
+        return -1;
+    }
+
+    uint32_t lo = (addr > seg->vaddr) ? addr : seg->vaddr;
+    uint32_t hi = addr + PAGE_SIZE;
+    if (hi > seg->vaddr + seg->filesz) {
+        hi = seg->vaddr + seg->filesz;
+    }
+    if (lo < hi) {
+        // RAM is identity mapped, so the frame can be read into directly
+        char *dest = (char *)frame->physical_addr + (lo - addr);
+        int bytes = fatReadAt(seg->image->file, seg->offset + (lo - seg->vaddr), dest, hi - lo);
+        if (bytes != (int)(hi - lo)) {
+            put_page(frame);
+            return -1;
+        }
+    }
+    return vm_install_page(region, addr, frame);
+}
+
+// Check a PT_LOAD header and register its region
+static int map_segment(struct elf_image *image, struct elf_program_header *ph) {
+    uint32_t end = ph->p_vaddr + ph->p_memsz;
+
+    if (image->nsegments == ELF_MAX_SEGMENTS || ph->p_filesz > ph->p_memsz ||
+        ph->p_vaddr < VM_USER_START || end > VM_USER_END || end < ph->p_vaddr) {
+        return -1;
+    }
+
+    struct elf_segment *seg = &image->segments[image->nsegments];
+    seg->image = image;
+    seg->vaddr = ph->p_vaddr;
+    seg->offset = ph->p_offset;
+    seg->filesz = ph->p_filesz;
+
+    struct vm_region *r = &seg->region;
+    r->start = ph->p_vaddr & ~(PAGE_SIZE - 1);
+    r->end = (end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    r->flags = VM_USER | ((ph->p_flags & PF_W) ? VM_WRITE : 0) | ((ph->p_flags & PF_X) ? VM_EXEC : 0);
+    r->name = (ph->p_flags & PF_X) ? "elf text" : "elf data";
+    // Pure .bss needs nothing from the file
+    r->fault = (ph->p_filesz > 0) ? elf_fault : NULL;
+    r->private = seg;
+    if (vm_region_add(r) != 0) {
+        return -1;      // Overlaps another segment or program
+    }
+    image->nsegments++;
+    return 0;
+}
+
+/*
+ * elf_load - Map an i386 executable from the FAT volume
+ *
+ * path: File to load, e.g. "/HELLO.ELF"
+ * image: Filled in with the entry point and segments
+ *
+ * Only the headers are read here. Every PT_LOAD segment becomes a region
+ * in the user window (VM_USER_START to VM_USER_END) whose pages are read
+ * from the file when first touched, so loading costs the same whatever
+ * the size of the program. Must be called from a thread.
+ *
+ * Returns: 0 on success, -1 if the file is missing or not a loadable
+ * executable
+ */
+int elf_load(const char *path, struct elf_image *image) {
+    uint64_t start = rdtsc();
+    struct elf_header eh;
+    struct elf_program_header ph;
+
+    image->nsegments = 0;
+    image->file = fatOpen(path);
+    if (image->file == NULL) {
+        return -1;
+    }
+    image->file_size = image->file->rde.file_size;
+
+    if (fatReadAt(image->file, 0, (char *)&eh, sizeof(eh)) != sizeof(eh) || !header_valid(&eh)) {
+        esp_printf(putc, "%s: not an i386 executable\r\n", path);
+        elf_unload(image);
+        return -1;
+    }
+    image->entry = eh.e_entry;
+
+    for (int i = 0; i < eh.e_phnum; i++) {
+        if (fatReadAt(image->file, eh.e_phoff + i * eh.e_phentsize, (char *)&ph, sizeof(ph)) != sizeof(ph)) {
+            esp_printf(putc, "%s: truncated program headers\r\n", path);
+            elf_unload(image);
+            return -1;
+        }
+        if (ph.p_type != PT_LOAD || ph.p_memsz == 0) {
+            continue;
+        }
+        if (map_segment(image, &ph) != 0) {
+            esp_printf(putc, "%s: can't map segment at 0x%x\r\n", path, ph.p_vaddr);
+            elf_unload(image);
+            return -1;
+        }
+    }
+
+    esp_printf(putc, "Loaded %s: %d segments, %d KB file, entry 0x%x, %d Kcycles\r\n",
+               path, image->nsegments, image->file_size / 1024, image->entry,
+               kcycles(rdtsc() - start));
+    return 0;
+}
+
+// Unmap a program and close its file. Must be called from a thread.
+void elf_unload(struct elf_image *image) {
+    for (int i = 0; i < image->nsegments; i++) {
+        vm_region_remove(&image->segments[i].region);
+    }
+    image->nsegments = 0;
+    fatClose(image->file);
+    image->file = NULL;
+}
+
+// Pages of the program read or zero-filled so far
+uint32_t elf_pages_present(struct elf_image *image) {
+    uint32_t pages = 0;
+    for (int i = 0; i < image->nsegments; i++) {
+        pages += image->segments[i].region.pages;
+    }
+    return pages;
+}
@@ -0,0 +1,80 @@
+#ifndef ELF_H
+#define ELF_H
+
+#include <stdint.h>
+#include "vm.h"
+#include "fat.h"
+
+#define ELF_MAGIC   0x464C457F      // "\x7FELF" read as a little endian word
+#define ELFCLASS32  1
+#define ELFDATA2LSB 1
+#define ET_EXEC     2
+#define EM_386      3
+
+#define PT_LOAD     1
+
+// Segment permissions
+#define PF_X        0x1
+#define PF_W        0x2
+#define PF_R        0x4
+
+#define ELF_MAX_SEGMENTS 4
+
+struct elf_header {
+    uint32_t e_magic;
+    uint8_t e_class;
+    uint8_t e_data;
+    uint8_t e_ident_version;
+    uint8_t e_pad[9];
+    uint16_t e_type;
+    uint16_t e_machine;
+    uint32_t e_version;
+    uint32_t e_entry;
+    uint32_t e_phoff;
+    uint32_t e_shoff;
+    uint32_t e_flags;
+    uint16_t e_ehsize;
+    uint16_t e_phentsize;
+    uint16_t e_phnum;
+    uint16_t e_shentsize;
+    uint16_t e_shnum;
+    uint16_t e_shstrndx;
+} __attribute__((packed));
+
+struct elf_program_header {
+    uint32_t p_type;
+    uint32_t p_offset;
+    uint32_t p_vaddr;
+    uint32_t p_paddr;
+    uint32_t p_filesz;
+    uint32_t p_memsz;
+    uint32_t p_flags;
+    uint32_t p_align;
+} __attribute__((packed));
+
+struct elf_image;
+
+// A PT_LOAD segment, mapped as one lazily populated region
+struct elf_segment {
+    struct vm_region region;
+    struct elf_image *image;
+    uint32_t vaddr;             // Where the file contents start
+    uint32_t offset;            // Their position in the file
+    uint32_t filesz;            // Bytes from the file; the rest is zero
+};
+
+// A program loaded from the FAT volume. The file stays open while it is
+// mapped, since pages are read from it on first touch.
+struct elf_image {
+    struct file *file;
+    uint32_t entry;
+    uint32_t file_size;
+    int nsegments;
+    struct elf_segment segments[ELF_MAX_SEGMENTS];
+};
+
+int elf_load(const char *path, struct elf_image *image);
+void elf_unload(struct elf_image *image);
+uint32_t elf_pages_present(struct elf_image *image);
+
+#endif
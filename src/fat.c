@@ -1,135 +1,504 @@
 #include "fat.h"
 #include "sd.h"
 #include "rprintf.h"
+#include "printk.h"
+#include "spinlock.h"
+#include "seqlock.h"
+#include "atomic.h"
+#include "string.h"
+#include "initrd.h"
 #include <stdint.h>
 
-#define PARTITION_START_SECTOR 2048
-
-// External putc function for printing
 extern int putc(int c);
 
+#define PARTITION_START_SECTOR 2048
+#define MAX_OPEN_FILES 32
+#define CLUSTER_READ_ERROR 1    // From file_cluster; real clusters start at 2
+
 // Global variables - keep these small
 struct boot_sector boot_sec;  // Store boot sector as struct, not buffer
 struct boot_sector *bs = &boot_sec;
 unsigned int root_sector;
 
+// Written once by fatInit, read on every call: readers use the seqlock to
+// get a consistent snapshot without taking a lock
+static struct seqlock geometry_lock;
+
+// Open files come from a fixed pool, linked through next/prev while free
+static struct file file_pool[MAX_OPEN_FILES];
+static struct file *free_files = NULL;
+static int file_pool_ready = 0;
+static struct spinlock file_pool_lock = SPINLOCK_INIT("fat_files");
+
+// The parts of the boot sector the read paths need
+struct fat_geometry {
+    unsigned int root_sector;
+    unsigned int root_dir_entries;
+    unsigned int sectors_per_cluster;
+    unsigned int fat_start;
+    unsigned int data_start;
+};
+
+/*
+ * Metadata traffic since boot. chain_hint is the only cache in front of
+ * the FAT, so hint_hits against cluster_lookups, and fat_sectors against
+ * chain_steps, show how often it saves a walk from the first cluster.
+ */
+static struct {
+    atomic_t opens;             // Disk lookups by fatOpen
+    atomic_t dir_sectors;       // Directory sectors read by lookups and fatReadDir
+    atomic_t cluster_lookups;
+    atomic_t hint_hits;         // Lookups that started from chain_hint
+    atomic_t chain_steps;       // FAT entries followed
+    atomic_t fat_sectors;       // FAT sectors read to follow them
+} stats;
+
 // Helper functions
-int strcmp(const char *s1, const char *s2);
-int strncmp(const char *s1, const char *s2, int n);
 void toupper_str(char *dest, const char *src);
 void extract_filename(struct root_directory_entry *rde, char *fname);
+static unsigned int file_cluster(struct file *file, struct fat_geometry *g, unsigned int index);
+
+static void get_geometry(struct fat_geometry *g) {
+    uint32_t seq;
+    do {
+        seq = read_seqbegin(&geometry_lock);
+        g->root_sector = root_sector;
+        g->root_dir_entries = bs->num_root_dir_entries;
+        g->sectors_per_cluster = bs->num_sectors_per_cluster;
+        g->fat_start = PARTITION_START_SECTOR + bs->num_reserved_sectors;
+    } while (read_seqretry(&geometry_lock, seq));
+
+    unsigned int root_dir_sectors = (g->root_dir_entries * 32 + 511) / 512;
+    g->data_start = g->root_sector + root_dir_sectors;
+}
 
 int fatInit() {
     char temp_buffer[512];
     
-    esp_printf(putc, "Initializing FAT filesystem...\r\n");
+    klog(LOG_DEBUG, LOG_FAT, "Initializing FAT filesystem");
+
+    seqlock_init(&geometry_lock, "fat_geometry");
     
     // Read boot sector
     sd_readblock(PARTITION_START_SECTOR, temp_buffer, 1);
     
     // Copy to our boot sector struct
     struct boot_sector *temp_bs = (struct boot_sector*)temp_buffer;
+    write_seqlock(&geometry_lock);
     boot_sec = *temp_bs;
+    write_sequnlock(&geometry_lock);
     
-    esp_printf(putc, "Bytes per sector: %d\r\n", bs->bytes_per_sector);
-    esp_printf(putc, "Sectors per cluster: %d\r\n", bs->num_sectors_per_cluster);
-    esp_printf(putc, "Number of FATs: %d\r\n", bs->num_fat_tables);
-    esp_printf(putc, "Root directory entries: %d\r\n", bs->num_root_dir_entries);
+    klog(LOG_DEBUG, LOG_FAT, "%d bytes per sector, %d sectors per cluster, %d FATs, %d root entries",
+         bs->bytes_per_sector, bs->num_sectors_per_cluster, bs->num_fat_tables,
+         bs->num_root_dir_entries);
     
     // Validate boot signature
     if (bs->boot_signature != 0xAA55) {
-        esp_printf(putc, "Error: Invalid boot signature\r\n");
+        klog(LOG_ERR, LOG_FAT, "Invalid boot signature 0x%x", bs->boot_signature);
         return -1;
     }
-    esp_printf(putc, "Boot signature valid\r\n");
     
     // Calculate root directory sector
+    write_seqlock(&geometry_lock);
     root_sector = PARTITION_START_SECTOR + bs->num_reserved_sectors + 
                   (bs->num_fat_tables * bs->num_sectors_per_fat);
+    write_sequnlock(&geometry_lock);
     
-    esp_printf(putc, "Root directory at sector: %d\r\n", root_sector);
-    esp_printf(putc, "FAT init complete!\r\n\r\n");
+    klog(LOG_INFO, LOG_FAT, "FAT16 volume, root directory at sector %d", root_sector);
     
     return 0;
 }
 
-struct file* fatOpen(const char *path) {
-    static struct file f;
-    static char root_buffer[8192];  // Enough for typical root directory
-    
-    esp_printf(putc, "Opening file: %s\r\n", path);
-    
-    // Skip leading /
-    if (path[0] == '/') path++;
-    
-    // Convert to uppercase
-    char upper_name[13];
-    toupper_str(upper_name, path);
-    
-    // Calculate root directory size
-    unsigned int root_dir_sectors = (bs->num_root_dir_entries * 32 + 511) / 512;
-    if (root_dir_sectors > 16) root_dir_sectors = 16;  // Limit to buffer size
-    
-    // Read root directory
-    sd_readblock(root_sector, root_buffer, root_dir_sectors);
-    
-    struct root_directory_entry *rde = (struct root_directory_entry*)root_buffer;
-    
-    // Search for file
-    for (unsigned int i = 0; i < bs->num_root_dir_entries; i++) {
-        if (rde[i].file_name[0] == 0x00) break;
-        if (rde[i].file_name[0] == 0xE5) continue;
-        if (rde[i].attribute & 0x08) continue;  // Skip volume labels
-        
+// The pool is built on first use, since initramfs files can be opened
+// before fatInit
+static struct file *alloc_file(void) {
+    uint32_t flags = spin_lock_irqsave(&file_pool_lock);
+    if (!file_pool_ready) {
+        for (int i = 0; i < MAX_OPEN_FILES; i++) {
+            file_pool[i].next = free_files;
+            file_pool[i].prev = NULL;
+            free_files = &file_pool[i];
+        }
+        file_pool_ready = 1;
+    }
+    struct file *f = free_files;
+    if (f != NULL) {
+        free_files = f->next;
+        f->next = NULL;
+        f->prev = NULL;
+    }
+    spin_unlock_irqrestore(&file_pool_lock, flags);
+    return f;
+}
+
+// Release a handle returned by fatOpen
+void fatClose(struct file *file) {
+    if (file == NULL) return;
+
+    uint32_t flags = spin_lock_irqsave(&file_pool_lock);
+    file->next = free_files;
+    free_files = file;
+    spin_unlock_irqrestore(&file_pool_lock, flags);
+}
+
+static void dir_start(struct fat_dir *dir, unsigned int cluster) {
+    dir->cluster = cluster;
+    dir->index = 0;
+    dir->sector = 0;
+    dir->error = 0;
+    dir->chain.start_cluster = cluster;
+    dir->chain.chain_hint = cluster;
+}
+
+/*
+ * dir_next - Next entry in use in a directory
+ *
+ * Each directory sector is read once, when its first entry is reached,
+ * and kept in dir->buf for the rest. Subdirectories are cluster chains
+ * like files, so they are followed with file_cluster.
+ *
+ * Returns: The entry, pointing into dir->buf, or NULL at the end of the
+ * directory or on a disk error, which also sets dir->error
+ */
+static struct root_directory_entry *dir_next(struct fat_dir *dir, struct fat_geometry *g) {
+    unsigned int entries_per_sector = 512 / sizeof(struct root_directory_entry);
+
+    for (;;) {
+        if (dir->sector == 0 || dir->index % entries_per_sector == 0) {
+            unsigned int s = dir->index / entries_per_sector;
+            unsigned int sector;
+            if (dir->cluster == 0) {
+                if (dir->index >= g->root_dir_entries) {
+                    return NULL;
+                }
+                sector = g->root_sector + s;
+            } else {
+                unsigned int cluster = file_cluster(&dir->chain, g, s / g->sectors_per_cluster);
+                if (cluster == CLUSTER_READ_ERROR) {
+                    dir->error = 1;
+                }
+                if (cluster < 2) {
+                    return NULL;
+                }
+                sector = g->data_start + (cluster - 2) * g->sectors_per_cluster + s % g->sectors_per_cluster;
+            }
+            if (sector != dir->sector) {
+                if (sd_readblock(sector, dir->buf, 1) != 0) {
+                    dir->sector = 0;
+                    dir->error = 1;
+                    return NULL;
+                }
+                dir->sector = sector;
+                atomic_inc(&stats.dir_sectors);
+            }
+        }
+
+        struct root_directory_entry *e =
+            (struct root_directory_entry*)dir->buf + (dir->index % entries_per_sector);
+        if (e->file_name[0] == 0x00) {
+            return NULL;    // Nothing after this; index stays here
+        }
+        dir->index++;
+        if ((uint8_t)e->file_name[0] == 0xE5) continue;
+        if (e->attribute & 0x08) continue;  // Skip volume labels and long names
+        return e;
+    }
+}
+
+/*
+ * dir_lookup - Finds a name in one directory
+ *
+ * dir_cluster: First cluster of a subdirectory, or 0 for the root
+ * directory, which has its own area before the data clusters
+ * name: Upper case 8.3 name
+ * rde: Receives the matching entry
+ *
+ * Returns: 0 if found, -1 if not or on a disk error
+ */
+static int dir_lookup(struct fat_geometry *g, unsigned int dir_cluster, const char *name,
+                      struct root_directory_entry *rde) {
+    struct fat_dir dir;
+    struct root_directory_entry *e;
+
+    dir_start(&dir, dir_cluster);
+    while ((e = dir_next(&dir, g)) != NULL) {
         char fname[13];
-        extract_filename(&rde[i], fname);
-        
-        if (strcmp(fname, upper_name) == 0) {
-            esp_printf(putc, "Found: %s (cluster %d, size %d)\r\n", 
-                      fname, rde[i].cluster, rde[i].file_size);
-            f.rde = rde[i];
-            f.start_cluster = rde[i].cluster;
-            f.next = NULL;
-            f.prev = NULL;
-            return &f;
+        extract_filename(e, fname);
+        if (strcmp(fname, name) == 0) {
+            *rde = *e;
+            return 0;
         }
     }
+    return -1;
+}
+
+// Find the entry for a path, one directory at a time from the root
+static int path_lookup(struct fat_geometry *g, const char *path, struct root_directory_entry *rde) {
+    unsigned int dir_cluster = 0;
+
+    for (;;) {
+        while (*path == '/') path++;
+
+        // Convert to uppercase
+        char upper_name[13];
+        int n = 0;
+        while (*path != '/' && *path != '\0') {
+            if (n == 12) {
+                return -1;  // Too long for an 8.3 name, so it can't match
+            }
+            upper_name[n++] = *path++;
+        }
+        upper_name[n] = '\0';
+        toupper_str(upper_name, upper_name);
+
+        if (n == 0 || dir_lookup(g, dir_cluster, upper_name, rde) != 0) {
+            return -1;
+        }
+        while (*path == '/') path++;
+        if (*path == '\0') {
+            return 0;
+        }
+        if (!(rde->attribute & FILE_ATTRIBUTE_SUBDIRECTORY)) {
+            return -1;
+        }
+        dir_cluster = rde->cluster;     // 0 again for a ".." back to the root
+    }
+}
+
+/*
+ * fatOpen - Opens a file by path, e.g. "/TREE/D1/FILE.TXT"
+ *
+ * Names are 8.3 and matched without regard to case; each directory on
+ * the way is read until the name turns up.
+ *
+ * Files in the initramfs take precedence and are opened without touching
+ * the disk, so they can be used before fatInit or without a disk at all.
+ *
+ * Returns: A handle for fatReadAt and fatClose, or NULL if not found
+ */
+struct file* fatOpen(const char *path) {
+    struct fat_geometry g;
     
-    esp_printf(putc, "File not found\r\n");
+    klog(LOG_DEBUG, LOG_FAT, "Opening file: %s", path);
+
+    struct initrd_file *rf = initrd_lookup(path);
+    if (rf != NULL) {
+        struct file *f = alloc_file();
+        if (f == NULL) {
+            klog(LOG_WARN, LOG_FAT, "Too many open files");
+            return NULL;
+        }
+        memset(&f->rde, 0, sizeof(f->rde));
+        f->rde.file_size = rf->size;
+        f->start_cluster = 0;
+        f->chain_hint = 0;
+        f->data = rf->data;
+        klog(LOG_DEBUG, LOG_FAT, "Found: %s (initramfs, size %d)", rf->name, rf->size);
+        return f;
+    }
+
+    get_geometry(&g);
+    if (g.root_sector == 0) {
+        klog(LOG_DEBUG, LOG_FAT, "%s not found, no volume mounted", path);
+        return NULL;
+    }
+    atomic_inc(&stats.opens);
+
+    struct root_directory_entry rde;
+    if (path_lookup(&g, path, &rde) == 0) {
+        klog(LOG_DEBUG, LOG_FAT, "Found: %s (cluster %d, size %d)",
+             path, rde.cluster, rde.file_size);
+        struct file *f = alloc_file();
+        if (f == NULL) {
+            klog(LOG_WARN, LOG_FAT, "Too many open files");
+            return NULL;
+        }
+        f->rde = rde;
+        f->start_cluster = rde.cluster;
+        f->chain_hint = rde.cluster;
+        f->data = NULL;
+        return f;
+    }
+
+    klog(LOG_DEBUG, LOG_FAT, "%s not found", path);
     return NULL;
 }
 
+/*
+ * file_cluster - Finds the index'th cluster of a file
+ *
+ * Follows the FAT16 chain from the file's first cluster, or from the last
+ * cluster looked up if that comes before index, so reading a file front to
+ * back costs one step per cluster. The hint is a single word, so
+ * concurrent readers of the same file can't see it half updated.
+ *
+ * Returns: The cluster number, 0 if the chain ends first, or
+ * CLUSTER_READ_ERROR if a FAT sector couldn't be read
+ */
+static unsigned int file_cluster(struct file *file, struct fat_geometry *g, unsigned int index) {
+    uint16_t fat_buf[256];
+    unsigned int fat_sector = 0;
+    uint32_t hint = file->chain_hint;
+    unsigned int i = hint >> 16;
+    unsigned int cluster = hint & 0xFFFF;
+
+    atomic_inc(&stats.cluster_lookups);
+    if (index < i) {
+        i = 0;
+        cluster = file->start_cluster;
+    } else {
+        atomic_inc(&stats.hint_hits);
+    }
+    while (i < index) {
+        if (cluster < 2 || cluster >= FAT16_END_OF_CHAIN) {
+            return 0;
+        }
+        unsigned int sector = g->fat_start + cluster / 256;
+        if (sector != fat_sector) {
+            if (sd_readblock(sector, (char *)fat_buf, 1) != 0) {
+                return CLUSTER_READ_ERROR;
+            }
+            fat_sector = sector;
+            atomic_inc(&stats.fat_sectors);
+        }
+        atomic_inc(&stats.chain_steps);
+        cluster = fat_buf[cluster % 256];
+        i++;
+    }
+    if (cluster < 2 || cluster >= FAT16_END_OF_CHAIN) {
+        return 0;
+    }
+    file->chain_hint = (index << 16) | cluster;
+    return cluster;
+}
+
+/*
+ * fatReadAt - Reads part of a file
+ *
+ * offset: Byte position in the file to start at
+ * buffer: Receives up to size bytes
+ *
+ * Whole sectors are read straight into buffer; only a partial first or
+ * last sector goes through a bounce buffer. Initramfs files are copied
+ * from memory.
+ *
+ * Returns: Bytes read, which is less than size at the end of the file,
+ * or -1 on a disk error before anything was read
+ */
+int fatReadAt(struct file *file, unsigned int offset, char *buffer, unsigned int size) {
+    if (file == NULL) return -1;
+    if (offset >= file->rde.file_size) return 0;
+    if (size > file->rde.file_size - offset) {
+        size = file->rde.file_size - offset;
+    }
+    if (file->data != NULL) {
+        memcpy(buffer, file->data + offset, size);
+        return size;
+    }
+
+    struct fat_geometry g;
+    get_geometry(&g);
+    unsigned int cluster_size = g.sectors_per_cluster * 512;
+    char sector_buf[512];
+    unsigned int done = 0;
+
+    while (done < size) {
+        unsigned int pos = offset + done;
+        unsigned int cluster = file_cluster(file, &g, pos / cluster_size);
+        if (cluster < 2) {
+            break;      // Chain shorter than the directory entry claims, or a disk error
+        }
+        unsigned int in_cluster = pos % cluster_size;
+        unsigned int sector = g.data_start + (cluster - 2) * g.sectors_per_cluster + in_cluster / 512;
+        unsigned int left = size - done;
+
+        if (pos % 512 == 0 && left >= 512) {
+            unsigned int count = left / 512;
+            if (count > g.sectors_per_cluster - in_cluster / 512) {
+                count = g.sectors_per_cluster - in_cluster / 512;
+            }
+            if (sd_readblock(sector, buffer + done, count) != 0) {
+                break;
+            }
+            done += count * 512;
+        } else {
+            unsigned int n = 512 - pos % 512;
+            if (n > left) n = left;
+            if (sd_readblock(sector, sector_buf, 1) != 0) {
+                break;
+            }
+            memcpy(buffer + done, sector_buf + pos % 512, n);
+            done += n;
+        }
+    }
+
+    if (done == 0 && size > 0) {
+        return -1;
+    }
+    return done;
+}
+
 int fatRead(struct file *file, char *buffer, unsigned int size) {
     if (file == NULL) return -1;
     
-    esp_printf(putc, "Reading file (max %d bytes)...\r\n", size);
-    
-    // Calculate data region start
-    unsigned int root_dir_sectors = (bs->num_root_dir_entries * 32 + 511) / 512;
-    unsigned int data_start = root_sector + root_dir_sectors;
-    
-    // Calculate cluster sector
-    unsigned int cluster = file->start_cluster;
-    unsigned int sector = data_start + (cluster - 2) * bs->num_sectors_per_cluster;
-    
-    esp_printf(putc, "Reading cluster %d at sector %d\r\n", cluster, sector);
-    
-    // Read one cluster
-    unsigned int cluster_size = bs->num_sectors_per_cluster * 512;
-    char cluster_buf[cluster_size];
-    
-    sd_readblock(sector, cluster_buf, bs->num_sectors_per_cluster);
-    
-    // Copy to output
-    unsigned int bytes_to_copy = (size < file->rde.file_size) ? size : file->rde.file_size;
-    if (bytes_to_copy > cluster_size) bytes_to_copy = cluster_size;
-    
-    for (unsigned int i = 0; i < bytes_to_copy; i++) {
-        buffer[i] = cluster_buf[i];
+    int bytes = fatReadAt(file, 0, buffer, size);
+    klog(LOG_DEBUG, LOG_FAT, "Read %d of at most %d bytes", bytes, size);
+    return bytes;
+}
+
+/*
+ * fatOpenDir - Starts reading a directory with fatReadDir
+ *
+ * path: "/" for the root directory, or e.g. "/TREE/D1"
+ * dir: Iteration state, including a sector buffer
+ *
+ * Returns: 0 on success, -1 if path is not a directory on the volume
+ */
+int fatOpenDir(const char *path, struct fat_dir *dir) {
+    struct fat_geometry g;
+    struct root_directory_entry rde;
+
+    get_geometry(&g);
+    if (g.root_sector == 0) {
+        return -1;
     }
-    
-    esp_printf(putc, "Read %d bytes\r\n", bytes_to_copy);
-    return bytes_to_copy;
+    while (*path == '/') path++;
+    if (*path == '\0') {
+        dir_start(dir, 0);
+        return 0;
+    }
+    if (path_lookup(&g, path, &rde) != 0 || !(rde.attribute & FILE_ATTRIBUTE_SUBDIRECTORY)) {
+        return -1;
+    }
+    dir_start(dir, rde.cluster);
+    return 0;
+}
+
+/*
+ * fatReadDir - Iterates over a directory opened with fatOpenDir
+ *
+ * fname: Receives the 8.3 name (at least 13 bytes)
+ * size: Receives the file size in bytes, 0 for a subdirectory
+ *
+ * "." and ".." are left out.
+ *
+ * Returns: 0 for a file, 1 for a subdirectory, -1 at the end of the
+ * directory, -2 if a directory or FAT sector couldn't be read
+ */
+int fatReadDir(struct fat_dir *dir, char *fname, unsigned int *size) {
+    struct fat_geometry g;
+    struct root_directory_entry *e;
+
+    get_geometry(&g);
+    while ((e = dir_next(dir, &g)) != NULL) {
+        if (e->file_name[0] == '.') {
+            continue;
+        }
+        extract_filename(e, fname);
+        *size = e->file_size;
+        return (e->attribute & FILE_ATTRIBUTE_SUBDIRECTORY) ? 1 : 0;
+    }
+    return dir->error ? -2 : -1;
 }
 
 void extract_filename(struct root_directory_entry *rde, char *fname) {
@@ -149,24 +518,6 @@ void extract_filename(struct root_directory_entry *rde, char *fname) {
     fname[k] = '\0';
 }
 
-int strcmp(const char *s1, const char *s2) {
-    while (*s1 && (*s1 == *s2)) {
-        s1++;
-        s2++;
-    }
-    return *(unsigned char*)s1 - *(unsigned char*)s2;
-}
-
-int strncmp(const char *s1, const char *s2, int n) {
-    while (n > 0 && *s1 && (*s1 == *s2)) {
-        s1++;
-        s2++;
-        n--;
-    }
-    if (n == 0) return 0;
-    return *(unsigned char*)s1 - *(unsigned char*)s2;
-}
-
 void toupper_str(char *dest, const char *src) {
     while (*src) {
         if (*src >= 'a' && *src <= 'z') {
@@ -179,3 +530,20 @@ void toupper_str(char *dest, const char *src) {
     }
     *dest = '\0';
 }
+
+void fat_get_stats(struct fat_stats *s) {
+    s->opens = atomic_read(&stats.opens);
+    s->dir_sectors = atomic_read(&stats.dir_sectors);
+    s->cluster_lookups = atomic_read(&stats.cluster_lookups);
+    s->hint_hits = atomic_read(&stats.hint_hits);
+    s->chain_steps = atomic_read(&stats.chain_steps);
+    s->fat_sectors = atomic_read(&stats.fat_sectors);
+}
+
+void fat_stats_dump(void) {
+    struct fat_stats s;
+    fat_get_stats(&s);
+    esp_printf(putc, "fat: %d opens, %d directory sectors, %d cluster lookups, %d from the hint, "
+               "%d chain steps, %d FAT sectors\r\n",
+               s.opens, s.dir_sectors, s.cluster_lookups, s.hint_hits, s.chain_steps, s.fat_sectors);
+}
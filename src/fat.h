@@ -9,6 +9,8 @@
 
 #define FILE_ATTRIBUTE_SUBDIRECTORY 0x10
 
+#define FAT16_END_OF_CHAIN 0xFFF8   // FAT entries from here on end a chain
+
 /*
  * Data structure definitions.
  *
@@ -77,6 +79,28 @@ struct file {
     struct file *prev;
     struct root_directory_entry rde;
     uint32_t start_cluster;
+    volatile uint32_t chain_hint;   // Last cluster looked up: index << 16 | cluster
+    const char *data;               // Contents of an initramfs file, NULL on disk
+};
+
+// Position in a directory, from fatOpenDir
+struct fat_dir {
+    struct file chain;          // Follows a subdirectory's clusters
+    unsigned int cluster;       // First cluster, 0 for the root directory
+    unsigned int index;         // Next entry to look at
+    unsigned int sector;        // Sector held in buf, 0 if none
+    int error;                  // A read failed, so the listing stopped early
+    char buf[512];
+};
+
+// Directory and FAT reads since boot, from fat_get_stats
+struct fat_stats {
+    uint32_t opens;
+    uint32_t dir_sectors;
+    uint32_t cluster_lookups;
+    uint32_t hint_hits;
+    uint32_t chain_steps;
+    uint32_t fat_sectors;
 };
 
 /*
@@ -84,6 +108,12 @@ struct file {
  */
 int fatInit(void);
 struct file* fatOpen(const char *path);
+void fatClose(struct file *file);
 int fatRead(struct file *file, char *buffer, unsigned int size);
+int fatReadAt(struct file *file, unsigned int offset, char *buffer, unsigned int size);
+int fatOpenDir(const char *path, struct fat_dir *dir);
+int fatReadDir(struct fat_dir *dir, char *fname, unsigned int *size);
+void fat_get_stats(struct fat_stats *s);
+void fat_stats_dump(void);
 
 #endif
@@ -0,0 +1,182 @@
+#include "fpu.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "atomic.h"
+#include "rprintf.h"
+#include <stddef.h>
+
+extern int putc(int c);
+
+/*
+ * Lazy FPU/SSE state. The kernel is built general-register only, so the
+ * only code that touches the FPU is what runs between kernel_fpu_begin and
+ * kernel_fpu_end. CR0.TS is kept set unless the running thread's registers
+ * are loaded; its first SSE instruction then raises #NM and the handler
+ * loads them. A thread whose registers are loaded saves them when it is
+ * switched out, so it can resume on any CPU. Threads that never use SSE
+ * never pay for an fxsave.
+ */
+
+int fpu_enabled = 0;
+
+// fninit state with the default MXCSR, loaded on a thread's first use
+static uint8_t fpu_initial_state[FPU_STATE_SIZE] __attribute__((aligned(16)));
+
+static volatile uint32_t fpu_restores = 0;
+static volatile uint32_t fpu_saves = 0;
+
+static inline uint32_t read_cr0(void) {
+    uint32_t cr0;
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    return cr0;
+}
+
+static inline void write_cr0(uint32_t cr0) {
+    asm volatile("mov %0, %%cr0" : : "r"(cr0) : "memory");
+}
+
+static inline void clts(void) {
+    asm volatile("clts" : : : "memory");
+}
+
+static inline void stts(void) {
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+static inline void fxsave(uint8_t *state) {
+    asm volatile("fxsave (%0)" : : "r"(state) : "memory");
+}
+
+static inline void fxrstor(const uint8_t *state) {
+    asm volatile("fxrstor (%0)" : : "r"(state) : "memory");
+}
+
+// A 386 has no CPUID; the instruction exists if EFLAGS.ID can be toggled
+static int cpuid_supported(void) {
+    uint32_t before, after;
+    asm volatile(
+        "pushfl\n"
+        "pushfl\n"
+        "popl %0\n"
+        "movl %0, %1\n"
+        "xorl $0x200000, %1\n"
+        "pushl %1\n"
+        "popfl\n"
+        "pushfl\n"
+        "popl %1\n"
+        "popfl\n"
+        : "=&r"(before), "=&r"(after));
+    return ((before ^ after) & 0x200000) != 0;
+}
+
+static uint32_t cpuid_features(void) {
+    uint32_t eax = 1, ebx, ecx, edx;
+    asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    return edx;
+}
+
+// #NM: the running thread wants the FPU while TS is set
+static void fpu_trap(struct interrupt_frame *frame) {
+    struct thread *t = thread_current();
+
+    clts();
+    if (t->fpu_flags & FPU_USED) {
+        fxrstor(t->fpu_state);
+    } else {
+        fxrstor(fpu_initial_state);
+        t->fpu_flags |= FPU_USED;
+    }
+    t->fpu_flags |= FPU_LIVE;
+    xadd(&fpu_restores, 1);
+}
+
+/*
+ * fpu_init_cpu - Set up CR0 and CR4 for SSE on the calling CPU
+ *
+ * Leaves TS set so the first use traps. Does nothing if the boot CPU
+ * found no SSE2.
+ */
+void fpu_init_cpu(void) {
+    if (!fpu_enabled) {
+        return;
+    }
+    uint32_t cr4;
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+    asm volatile("mov %0, %%cr4" : : "r"(cr4));
+
+    write_cr0((read_cr0() & ~CR0_EM) | CR0_MP | CR0_NE | CR0_TS);
+}
+
+/*
+ * fpu_init - Detect SSE2 and enable lazy FPU switching
+ *
+ * Must run after interrupts_init. Without fxsave and SSE2 the kernel keeps
+ * using the i386 code paths: kernel_fpu_begin always fails.
+ */
+void fpu_init(void) {
+    uint32_t needed = CPUID_FXSR | CPUID_SSE | CPUID_SSE2;
+
+    if (!cpuid_supported() || (cpuid_features() & needed) != needed) {
+        esp_printf(putc, "FPU: no SSE2, using i386 string routines\r\n");
+        return;
+    }
+    fpu_enabled = 1;
+    fpu_init_cpu();
+
+    // Capture a clean register image for threads to start from
+    uint32_t mxcsr = MXCSR_DEFAULT;
+    clts();
+    asm volatile("fninit");
+    asm volatile("ldmxcsr %0" : : "m"(mxcsr));
+    fxsave(fpu_initial_state);
+    stts();
+
+    register_interrupt_handler(7, fpu_trap);
+    esp_printf(putc, "FPU: SSE2 enabled, state switched lazily\r\n");
+}
+
+/*
+ * kernel_fpu_begin - Start a region that may use SSE registers
+ *
+ * Fails in interrupt handlers, which would clobber the registers of the
+ * thread they interrupted, and inside another region: an exception taken
+ * in the middle of an SSE copy must not reuse the registers under it.
+ *
+ * Returns: 1 if SSE may be used until kernel_fpu_end, 0 to use the
+ * integer fallback
+ */
+int kernel_fpu_begin(void) {
+    if (!fpu_enabled || in_interrupt()) {
+        return 0;
+    }
+    struct thread *t = thread_current();
+    if (t == NULL || (t->fpu_flags & FPU_ACTIVE)) {
+        return 0;
+    }
+    t->fpu_flags |= FPU_ACTIVE;
+    return 1;
+}
+
+// End a region started by a successful kernel_fpu_begin. The registers
+// stay loaded until the thread is switched out.
+void kernel_fpu_end(void) {
+    thread_current()->fpu_flags &= ~FPU_ACTIVE;
+}
+
+// Called by schedule() with interrupts off, before switching away from prev
+void fpu_switch_out(struct thread *prev) {
+    if (prev->fpu_flags & FPU_LIVE) {
+        fxsave(prev->fpu_state);
+        prev->fpu_flags &= ~FPU_LIVE;
+        stts();
+        xadd(&fpu_saves, 1);
+    }
+}
+
+void fpu_stats_dump(void) {
+    if (!fpu_enabled) {
+        return;
+    }
+    esp_printf(putc, "FPU: %d lazy restores, %d saves on switch\r\n", fpu_restores, fpu_saves);
+}
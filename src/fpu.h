@@ -0,0 +1,46 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include <stdint.h>
+
+// Control register bits
+#define CR0_MP  (1 << 1)            // wait/fwait honours TS
+#define CR0_EM  (1 << 2)            // No FPU: trap every FPU instruction
+#define CR0_TS  (1 << 3)            // Task switched: next FPU/SSE use raises #NM
+#define CR0_NE  (1 << 5)            // Report x87 errors as #MF, not IRQ 13
+#define CR4_OSFXSR     (1 << 9)     // OS saves SSE state with fxsave
+#define CR4_OSXMMEXCPT (1 << 10)    // OS handles #XM
+
+// CPUID leaf 1 EDX feature bits
+#define CPUID_FXSR (1 << 24)
+#define CPUID_SSE  (1 << 25)
+#define CPUID_SSE2 (1 << 26)
+
+#define FPU_STATE_SIZE 512          // fxsave image, must be 16 byte aligned
+#define MXCSR_DEFAULT  0x1F80       // All SIMD exceptions masked
+
+// thread->fpu_flags
+#define FPU_USED   0x1              // fpu_state holds this thread's registers
+#define FPU_LIVE   0x2              // Registers loaded on its CPU, TS clear
+#define FPU_ACTIVE 0x4              // Inside kernel_fpu_begin/end
+
+// Below this many bytes a #NM trap and fxsave cost more than SSE saves
+#define SSE_COPY_MIN 1024
+
+struct thread;
+
+extern int fpu_enabled;
+
+void fpu_init(void);
+void fpu_init_cpu(void);
+int kernel_fpu_begin(void);
+void kernel_fpu_end(void);
+void fpu_switch_out(struct thread *prev);
+void fpu_stats_dump(void);
+
+// SSE2 variants in string_sse.c. n is a multiple of 64 and dst 16 byte
+// aligned; only call them between kernel_fpu_begin and kernel_fpu_end.
+void memcpy_sse2(void *dst, const void *src, uint32_t n);
+void memset_sse2(void *dst, uint32_t pattern, uint32_t n);
+
+#endif
@@ -0,0 +1,68 @@
+#include "gdt.h"
+#include "acpi.h"
+
+// GRUB leaves us with a GDT we aren't allowed to rely on, so we load our own
+// flat one: null, kernel code, kernel data, user code, user data, then a
+// TSS for each CPU
+#define GDT_ENTRIES (GDT_TSS_FIRST + MAX_CPUS)
+
+struct gdt_entry gdt[GDT_ENTRIES];
+struct gdt_ptr gdtp;
+static struct tss tss[MAX_CPUS];
+
+static void gdt_set_entry(int i, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
+    gdt[i].limit_low = limit & 0xFFFF;
+    gdt[i].base_low = base & 0xFFFF;
+    gdt[i].base_mid = (base >> 16) & 0xFF;
+    gdt[i].access = access;
+    gdt[i].granularity = ((limit >> 16) & 0x0F) | (gran & 0xF0);
+    gdt[i].base_high = (base >> 24) & 0xFF;
+}
+
+void gdt_init(void) {
+    gdt_set_entry(0, 0, 0, 0, 0);
+    gdt_set_entry(1, 0, 0xFFFFFFFF, 0x9A, 0xCF);  // Kernel code, ring 0
+    gdt_set_entry(2, 0, 0xFFFFFFFF, 0x92, 0xCF);  // Kernel data, ring 0
+    gdt_set_entry(3, 0, 0xFFFFFFFF, 0xFA, 0xCF);  // User code, ring 3
+    gdt_set_entry(4, 0, 0xFFFFFFFF, 0xF2, 0xCF);  // User data, ring 3
+    for (int i = 0; i < MAX_CPUS; i++) {
+        tss[i].ss0 = KERNEL_DS;
+        tss[i].iomap_base = sizeof(struct tss);     // No I/O bitmap: ring 3 gets no ports
+        gdt_set_entry(GDT_TSS_FIRST + i, (uint32_t)&tss[i], sizeof(struct tss) - 1, 0x89, 0x00);
+    }
+
+    gdtp.limit = sizeof(gdt) - 1;
+    gdtp.base = (uint32_t)&gdt;
+
+    gdt_load();
+}
+
+// Load the shared GDT on this CPU (application processors call this directly)
+void gdt_load(void) {
+    // Load the GDT, then reload CS with a far jump and the data segments
+    asm volatile(
+        "lgdt %0\n"
+        "ljmp %1, $1f\n"
+        "1:\n"
+        "mov %2, %%ax\n"
+        "mov %%ax, %%ds\n"
+        "mov %%ax, %%es\n"
+        "mov %%ax, %%fs\n"
+        "mov %%ax, %%gs\n"
+        "mov %%ax, %%ss\n"
+        :
+        : "m"(gdtp), "i"(KERNEL_CS), "i"(KERNEL_DS)
+        : "eax", "memory"
+    );
+}
+
+// Load this CPU's task register. Each CPU needs its own TSS, since the
+// CPU marks the one it loads busy.
+void tss_load(int cpu) {
+    asm volatile("ltr %w0" : : "r"(TSS_SELECTOR(cpu)));
+}
+
+// Set the stack a CPU switches to when ring 3 code enters the kernel
+void tss_set_esp0(int cpu, uint32_t esp0) {
+    tss[cpu].esp0 = esp0;
+}
@@ -0,0 +1,52 @@
+#ifndef GDT_H
+#define GDT_H
+
+#include <stdint.h>
+
+// Segment selectors. sysenter and sysexit require the kernel and user
+// segments in this order.
+#define KERNEL_CS 0x08
+#define KERNEL_DS 0x10
+#define USER_CS   0x1B      // GDT entry 3, RPL 3
+#define USER_DS   0x23      // GDT entry 4, RPL 3
+
+#define GDT_TSS_FIRST 5                     // One TSS per CPU from here
+#define TSS_SELECTOR(cpu) ((GDT_TSS_FIRST + (cpu)) * 8)
+
+// GDT entry structure for i386
+struct gdt_entry {
+    uint16_t limit_low;
+    uint16_t base_low;
+    uint8_t  base_mid;
+    uint8_t  access;       // Present, privilege level, type
+    uint8_t  granularity;  // Limit bits 16-19 and flags
+    uint8_t  base_high;
+} __attribute__((packed));
+
+/*
+ * Task state segment. We don't use hardware task switching; the CPU only
+ * reads ss0:esp0 from it, the stack to switch to on entry from ring 3.
+ */
+struct tss {
+    uint32_t prev_task;
+    uint32_t esp0;
+    uint32_t ss0;
+    uint32_t esp1, ss1, esp2, ss2;
+    uint32_t cr3, eip, eflags;
+    uint32_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    uint32_t es, cs, ss, ds, fs, gs, ldt;
+    uint16_t trap;
+    uint16_t iomap_base;
+} __attribute__((packed));
+
+struct gdt_ptr {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed));
+
+void gdt_init(void);
+void gdt_load(void);
+void tss_load(int cpu);
+void tss_set_esp0(int cpu, uint32_t esp0);
+
+#endif
@@ -1,7 +1,12 @@
-
 #ifndef __IDE_H__
 #define __IDE_H__
 
 int ata_lba_read(unsigned int lba, unsigned char *buffer, unsigned int numsectors);
+int ata_lba_write(unsigned int lba, const unsigned char *buffer, unsigned int numsectors);
+
+void ide_init(void);
+int ide_read(unsigned int lba, unsigned char *buffer, unsigned int numsectors);
+int ide_write(unsigned int lba, const unsigned char *buffer, unsigned int numsectors);
+void ata_wait_irq(void);
 
 #endif
@@ -51,6 +51,12 @@ ata_lba_read:
     movb $0x20, %al
     outb %al, %dx
 
+.next_sector:
+    # Sleep until the drive raises IRQ14 for this sector. This returns at
+    # once if the scheduler isn't running yet, and we fall back to polling.
+    # Clobbers EAX, ECX and EDX, which are reloaded below.
+    call ata_wait_irq
+
 .wait_ready:
     # Wait for drive to be ready
     movl $0x1F7, %edx
@@ -74,7 +80,7 @@ ata_lba_read:
 
     # Check if more sectors to read
     decl %esi
-    jnz .wait_ready
+    jnz .next_sector
 
     # Return 0 for success
     xorl %eax, %eax
@@ -86,3 +92,97 @@ ata_lba_read:
     popl %ebx
     popl %ebp
     ret
+
+# ATA write sectors (LBA mode)
+# C Prototype: ata_lba_write(unsigned int lba, const unsigned char *buffer, unsigned int numsectors)
+
+    .global ata_lba_write
+ata_lba_write:
+    pushl %ebp
+    movl %esp, %ebp
+    pushl %ebx
+    pushl %ecx
+    pushl %edx
+    pushl %edi
+    pushl %esi
+
+    # Get parameters from stack. outsw reads from ESI, so the count goes in EDI
+    movl 8(%ebp), %ebx      # Get LBA and save in EBX
+    movl 12(%ebp), %esi     # Get buffer pointer
+    movl 16(%ebp), %edi     # Get sector count and save in EDI
+
+    # Send drive and bits 24-27 of LBA
+    movl $0x01F6, %edx
+    movl %ebx, %eax
+    shrl $24, %eax
+    orb $0xE0, %al
+    outb %al, %dx
+
+    # Send number of sectors
+    movl $0x01F2, %edx
+    movl %edi, %eax
+    outb %al, %dx
+
+    # Send bits 0-7 of LBA
+    movl $0x1F3, %edx
+    movl %ebx, %eax
+    outb %al, %dx
+
+    # Send bits 8-15 of LBA
+    movl $0x1F4, %edx
+    movl %ebx, %eax
+    shrl $8, %eax
+    outb %al, %dx
+
+    # Send bits 16-23 of LBA
+    movl $0x1F5, %edx
+    movl %ebx, %eax
+    shrl $16, %eax
+    outb %al, %dx
+
+    # Send write command
+    movl $0x1F7, %edx
+    movb $0x30, %al
+    outb %al, %dx
+
+.write_next_sector:
+    # The drive asks for each sector with DRQ; no interrupt precedes the first
+    movl $0x1F7, %edx
+    inb %dx, %al
+    testb $0x80, %al        # BSY bit
+    jnz .write_next_sector
+    testb $0x08, %al        # DRQ bit
+    jz .write_next_sector
+
+    # Write 256 words (512 bytes) to data port
+    movl $0x1F0, %edx
+    movl $256, %ecx
+    rep outsw
+
+    # The drive interrupts once it has taken the sector
+    call ata_wait_irq
+
+    decl %edi
+    jnz .write_next_sector
+
+    # Flush the drive's write cache
+    movl $0x1F7, %edx
+    movb $0xE7, %al
+    outb %al, %dx
+.write_flush:
+    inb %dx, %al
+    testb $0x80, %al        # BSY bit
+    jnz .write_flush
+
+    # Return 0 for success
+    xorl %eax, %eax
+
+    popl %esi
+    popl %edi
+    popl %edx
+    popl %ecx
+    popl %ebx
+    popl %ebp
+    ret
+
+.section .note.GNU-stack,"",@progbits
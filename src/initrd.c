@@ -0,0 +1,125 @@
+#include "initrd.h"
+#include "multiboot.h"
+#include "timer.h"
+#include "rprintf.h"
+#include <stddef.h>
+
+extern int putc(int c);
+extern uint32_t memory_top;
+
+/*
+ * The initramfs is a ustar archive GRUB loads into memory as a multiboot2
+ * module. It is indexed once at boot into a hash table; after that files
+ * are found without scanning the archive and read straight out of it.
+ * Names are matched without regard to case, like FAT's.
+ */
+
+static struct initrd_file files[INITRD_MAX_FILES];
+static struct initrd_file *buckets[INITRD_HASH_SIZE];
+static int num_files = 0;
+
+static int to_upper(int c) {
+    return (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+}
+
+// FNV-1a over the upper-cased name
+static uint32_t name_hash(const char *name) {
+    uint32_t hash = 2166136261u;
+    while (*name != '\0') {
+        hash = (hash ^ to_upper(*name++)) * 16777619u;
+    }
+    return hash;
+}
+
+static int name_equal(const char *a, const char *b) {
+    while (*a != '\0' && to_upper(*a) == to_upper(*b)) {
+        a++;
+        b++;
+    }
+    return *a == '\0' && *b == '\0';
+}
+
+// Numeric header fields are NUL or space terminated octal
+static uint32_t octal(const char *field, int len) {
+    uint32_t value = 0;
+    for (int i = 0; i < len && field[i] >= '0' && field[i] <= '7'; i++) {
+        value = value * 8 + (field[i] - '0');
+    }
+    return value;
+}
+
+static const char *skip_prefix(const char *path) {
+    while (*path == '/' || (path[0] == '.' && path[1] == '/')) {
+        path += (*path == '/') ? 1 : 2;
+    }
+    return path;
+}
+
+/*
+ * initrd_init - Index the archive GRUB loaded as the "initrd" module
+ *
+ * Regular files are added to the hash table; directories, links and names
+ * too long for the basic header are skipped. The module's frames must
+ * already be reserved from the page frame allocator.
+ *
+ * Returns: 0 on success, -1 if there is no usable initramfs module
+ */
+int initrd_init(void) {
+    struct multiboot_tag_module *mod = multiboot_find_module(INITRD_MODULE);
+    if (mod == NULL) {
+        return -1;
+    }
+    // Only RAM below memory_top is identity mapped
+    if (mod->mod_end > memory_top || mod->mod_end < mod->mod_start) {
+        esp_printf(putc, "initramfs: module at 0x%x is not mapped\r\n", mod->mod_start);
+        return -1;
+    }
+
+    uint64_t start = rdtsc();
+    const char *p = (const char *)mod->mod_start;
+    const char *end = (const char *)mod->mod_end;
+
+    while (p + TAR_BLOCK_SIZE <= end && p[TAR_NAME] != '\0') {
+        if (p[TAR_MAGIC] != 'u' || p[TAR_MAGIC + 1] != 's' || p[TAR_MAGIC + 2] != 't' ||
+            p[TAR_MAGIC + 3] != 'a' || p[TAR_MAGIC + 4] != 'r') {
+            esp_printf(putc, "initramfs: bad header at offset %d\r\n", p - (const char *)mod->mod_start);
+            break;
+        }
+        uint32_t size = octal(p + TAR_SIZE, 12);
+        const char *data = p + TAR_BLOCK_SIZE;
+        if (data + size > end) {
+            break;
+        }
+
+        int regular = (p[TAR_TYPE] == '0' || p[TAR_TYPE] == '\0');
+        if (regular && p[TAR_PREFIX] == '\0' && p[TAR_NAME + 99] == '\0' &&
+            num_files < INITRD_MAX_FILES) {
+            struct initrd_file *f = &files[num_files++];
+            f->name = skip_prefix(p + TAR_NAME);
+            f->data = data;
+            f->size = size;
+            uint32_t b = name_hash(f->name) & (INITRD_HASH_SIZE - 1);
+            f->next = buckets[b];
+            buckets[b] = f;
+        }
+
+        // Contents are padded to whole blocks
+        p = data + ((size + TAR_BLOCK_SIZE - 1) & ~(TAR_BLOCK_SIZE - 1));
+    }
+
+    esp_printf(putc, "initramfs: %d files in %d KB at 0x%x, indexed in %d Kcycles\r\n",
+               num_files, (mod->mod_end - mod->mod_start) / 1024, mod->mod_start,
+               kcycles(rdtsc() - start));
+    return 0;
+}
+
+// Find a file by path, e.g. "/HELLO.ELF". Returns NULL if it isn't there.
+struct initrd_file *initrd_lookup(const char *path) {
+    path = skip_prefix(path);
+    for (struct initrd_file *f = buckets[name_hash(path) & (INITRD_HASH_SIZE - 1)]; f != NULL; f = f->next) {
+        if (name_equal(f->name, path)) {
+            return f;
+        }
+    }
+    return NULL;
+}
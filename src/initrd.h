@@ -0,0 +1,30 @@
+#ifndef INITRD_H
+#define INITRD_H
+
+#include <stdint.h>
+
+#define INITRD_MODULE "initrd"      // module2 argument naming the archive in grub.cfg
+
+#define INITRD_MAX_FILES 128
+#define INITRD_HASH_SIZE 64         // Buckets, a power of two
+
+// ustar header fields
+#define TAR_BLOCK_SIZE 512
+#define TAR_NAME       0
+#define TAR_SIZE       124
+#define TAR_TYPE       156
+#define TAR_MAGIC      257
+#define TAR_PREFIX     345
+
+// An indexed file. name and data point into the archive itself.
+struct initrd_file {
+    const char *name;           // Without a leading "./"
+    const char *data;
+    uint32_t size;
+    struct initrd_file *next;   // Hash chain
+};
+
+int initrd_init(void);
+struct initrd_file *initrd_lookup(const char *path);
+
+#endif
@@ -0,0 +1,211 @@
+#include "interrupt.h"
+#include "gdt.h"
+#include "io.h"
+#include "thread.h"
+#include "apic.h"
+#include "smp.h"
+#include "user.h"
+#include "rprintf.h"
+
+// 8259 PIC ports
+#define PIC1_COMMAND 0x20
+#define PIC1_DATA    0x21
+#define PIC2_COMMAND 0xA0
+#define PIC2_DATA    0xA1
+#define PIC_EOI      0x20
+
+// Present, ring 0, 32-bit interrupt gate
+#define IDT_INTERRUPT_GATE 0x8E
+#define IDT_DPL_USER       0x60     // Gate may be used by int from ring 3
+
+extern int putc(int c);
+
+// Interrupt stubs from isr.s, 16 bytes apart
+extern char isr_stubs[];
+
+struct idt_entry idt[IDT_ENTRIES];
+struct idt_ptr idtp;
+
+static interrupt_handler_t handlers[IDT_ENTRIES];
+
+static const char *exception_names[32] = {
+    "Divide error", "Debug", "NMI", "Breakpoint", "Overflow",
+    "Bound range exceeded", "Invalid opcode", "Device not available",
+    "Double fault", "Coprocessor segment overrun", "Invalid TSS",
+    "Segment not present", "Stack-segment fault", "General protection fault",
+    "Page fault", "Reserved", "x87 floating point", "Alignment check",
+    "Machine check", "SIMD floating point", "Virtualization",
+    "Reserved", "Reserved", "Reserved", "Reserved", "Reserved", "Reserved",
+    "Reserved", "Reserved", "Reserved", "Security exception", "Reserved",
+};
+
+static void idt_set_gate(int vector, uint32_t handler, uint16_t selector, uint8_t type_attr) {
+    idt[vector].offset_low = handler & 0xFFFF;
+    idt[vector].selector = selector;
+    idt[vector].zero = 0;
+    idt[vector].type_attr = type_attr;
+    idt[vector].offset_high = (handler >> 16) & 0xFFFF;
+}
+
+/*
+ * pic_remap - Moves the PIC's IRQs to vectors 32-47
+ *
+ * The BIOS leaves IRQ 0-7 on vectors 8-15, which collide with CPU
+ * exceptions. All lines start out masked.
+ */
+static void pic_remap(void) {
+    outb(PIC1_COMMAND, 0x11);   // Start initialization, expect ICW4
+    io_wait();
+    outb(PIC2_COMMAND, 0x11);
+    io_wait();
+    outb(PIC1_DATA, IRQ_BASE);      // Master vector offset
+    io_wait();
+    outb(PIC2_DATA, IRQ_BASE + 8);  // Slave vector offset
+    io_wait();
+    outb(PIC1_DATA, 4);         // Slave is on IRQ2
+    io_wait();
+    outb(PIC2_DATA, 2);         // Slave cascade identity
+    io_wait();
+    outb(PIC1_DATA, 0x01);      // 8086 mode
+    io_wait();
+    outb(PIC2_DATA, 0x01);
+    io_wait();
+
+    outb(PIC1_DATA, 0xFB);      // Mask everything except the cascade
+    outb(PIC2_DATA, 0xFF);
+}
+
+void irq_unmask(uint8_t irq) {
+    if (apic_active()) {
+        ioapic_unmask(irq);
+        return;
+    }
+    uint16_t port = (irq < 8) ? PIC1_DATA : PIC2_DATA;
+    uint8_t mask = inb(port) & ~(1 << (irq & 7));
+    outb(port, mask);
+}
+
+void irq_mask(uint8_t irq) {
+    if (apic_active()) {
+        ioapic_mask(irq);
+        return;
+    }
+    uint16_t port = (irq < 8) ? PIC1_DATA : PIC2_DATA;
+    uint8_t mask = inb(port) | (1 << (irq & 7));
+    outb(port, mask);
+}
+
+// Mask every PIC line once the IO-APIC takes over. Returns the old masks.
+uint16_t pic_disable(void) {
+    uint16_t mask = inb(PIC1_DATA) | (inb(PIC2_DATA) << 8);
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+    return mask;
+}
+
+static void pic_eoi(uint8_t irq) {
+    if (irq >= 8) {
+        outb(PIC2_COMMAND, PIC_EOI);
+    }
+    outb(PIC1_COMMAND, PIC_EOI);
+}
+
+void interrupts_init(void) {
+    for (int i = 0; i < IDT_ENTRIES; i++) {
+        idt_set_gate(i, (uint32_t)isr_stubs + i * 16, KERNEL_CS, IDT_INTERRUPT_GATE);
+        handlers[i] = NULL;
+    }
+
+    idtp.limit = sizeof(idt) - 1;
+    idtp.base = (uint32_t)&idt;
+    idt_load();
+
+    pic_remap();
+}
+
+// Let ring 3 code raise vector with int, e.g. for system calls
+void idt_allow_user(uint8_t vector) {
+    idt[vector].type_attr |= IDT_DPL_USER;
+}
+
+// Load the shared IDT on this CPU (application processors call this directly)
+void idt_load(void) {
+    asm volatile("lidt %0" : : "m"(idtp));
+}
+
+void register_interrupt_handler(uint8_t vector, interrupt_handler_t handler) {
+    handlers[vector] = handler;
+}
+
+int in_interrupt(void) {
+    return this_cpu()->interrupt_depth > 0;
+}
+
+// Unhandled CPU exceptions are fatal, to the program if it raised them
+static void unhandled_exception(struct interrupt_frame *frame) {
+    esp_printf(putc, "\r\n*** %s (vector %d, error 0x%x) at eip 0x%x ***\r\n",
+               exception_names[frame->vector], frame->vector, frame->err_code, frame->eip);
+    if ((frame->cs & 3) == 3) {
+        esp_printf(putc, "Program killed.\r\n");
+        user_exit(-1);
+    }
+    esp_printf(putc, "System halted.\r\n");
+    while (1) {
+        asm volatile("cli; hlt");
+    }
+}
+
+/*
+ * interrupt_dispatch - Common C entry point for every interrupt
+ *
+ * Called from isr_common with interrupts disabled. Hardware IRQs are
+ * acknowledged before we return so that a reschedule from here doesn't
+ * leave the interrupt controller waiting on a thread that may not run
+ * again for a while.
+ *
+ * CPU exceptions and system calls are raised synchronously by the running
+ * thread, which may sleep while one is handled (e.g. a page fault reading
+ * from disk), so they don't count as interrupt context.
+ */
+void interrupt_dispatch(struct interrupt_frame *frame) {
+    uint32_t vector = frame->vector;
+    struct cpu *cpu = this_cpu();
+    int exception = vector < IRQ_BASE || vector == SYSCALL_VECTOR;
+
+    if (!exception) {
+        cpu->interrupt_depth++;
+    }
+
+    if (vector >= IRQ_BASE && vector < IRQ_BASE + 16) {
+        uint8_t irq = vector - IRQ_BASE;
+        if (handlers[vector] != NULL) {
+            handlers[vector](frame);
+        }
+        if (apic_active()) {
+            lapic_eoi();
+        } else {
+            pic_eoi(irq);
+        }
+    } else if (vector >= LAPIC_TIMER_VECTOR && vector < LAPIC_SPURIOUS_VECTOR) {
+        if (handlers[vector] != NULL) {
+            handlers[vector](frame);
+        }
+        lapic_eoi();
+    } else if (handlers[vector] != NULL) {
+        handlers[vector](frame);
+    } else if (vector < 32) {
+        unhandled_exception(frame);
+    }
+
+    if (!exception) {
+        cpu->interrupt_depth--;
+    } else {
+        cpu = this_cpu();       // The handler may have slept and woken up elsewhere
+    }
+
+    // Preempt the interrupted thread if the handler made something more
+    // important runnable or its time slice ran out
+    if (cpu->interrupt_depth == 0) {
+        thread_preempt_check();
+    }
+}
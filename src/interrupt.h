@@ -0,0 +1,80 @@
+#ifndef INTERRUPT_H
+#define INTERRUPT_H
+
+#include <stdint.h>
+
+// Hardware IRQs are remapped above the CPU exceptions
+#define IRQ_BASE 32
+#define IRQ_TIMER 0
+#define IRQ_KEYBOARD 1
+#define IRQ_PRIMARY_ATA 14
+
+#define IDT_ENTRIES 256
+
+#define SYSCALL_VECTOR 0x80 // int 0x80, callable from ring 3
+
+#define EFLAGS_IF 0x200     // Interrupt enable flag
+
+// IDT gate descriptor for i386
+struct idt_entry {
+    uint16_t offset_low;
+    uint16_t selector;
+    uint8_t  zero;
+    uint8_t  type_attr;    // Present, DPL, gate type
+    uint16_t offset_high;
+} __attribute__((packed));
+
+struct idt_ptr {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed));
+
+/*
+ * Register state pushed by the stubs in isr.s. The layout must match the
+ * push order in isr_common.
+ */
+struct interrupt_frame {
+    uint32_t gs, fs, es, ds;
+    uint32_t edi, esi, ebp, esp_dummy, ebx, edx, ecx, eax;  // pushal
+    uint32_t vector, err_code;
+    uint32_t eip, cs, eflags;                               // pushed by the CPU
+    uint32_t useresp, ss;                                   // only on a privilege change
+};
+
+typedef void (*interrupt_handler_t)(struct interrupt_frame *frame);
+
+void interrupts_init(void);
+void idt_load(void);
+uint16_t pic_disable(void);
+void register_interrupt_handler(uint8_t vector, interrupt_handler_t handler);
+void idt_allow_user(uint8_t vector);
+void irq_unmask(uint8_t irq);
+void irq_mask(uint8_t irq);
+int in_interrupt(void);
+
+// Disable interrupts and return the previous EFLAGS so they can be restored
+static inline uint32_t irq_save(void) {
+    uint32_t flags;
+    asm volatile("pushf\n\tpop %0\n\tcli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint32_t flags) {
+    asm volatile("push %0\n\tpopf" : : "r"(flags) : "memory", "cc");
+}
+
+static inline int interrupts_enabled(void) {
+    uint32_t flags;
+    asm volatile("pushf\n\tpop %0" : "=r"(flags));
+    return (flags & EFLAGS_IF) != 0;
+}
+
+static inline void interrupts_enable(void) {
+    asm volatile("sti" : : : "memory");
+}
+
+static inline void interrupts_disable(void) {
+    asm volatile("cli" : : : "memory");
+}
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef IO_H
+#define IO_H
+
+#include <stdint.h>
+
+// Port I/O helpers shared by the drivers
+
+static inline uint8_t inb(uint16_t port) {
+    uint8_t rv;
+    __asm__ __volatile__ ("inb %1, %0" : "=a" (rv) : "dN" (port));
+    return rv;
+}
+
+static inline void outb(uint16_t port, uint8_t val) {
+    __asm__ __volatile__ ("outb %0, %1" : : "a" (val), "dN" (port));
+}
+
+static inline uint16_t inw(uint16_t port) {
+    uint16_t rv;
+    __asm__ __volatile__ ("inw %1, %0" : "=a" (rv) : "dN" (port));
+    return rv;
+}
+
+static inline void outw(uint16_t port, uint16_t val) {
+    __asm__ __volatile__ ("outw %0, %1" : : "a" (val), "dN" (port));
+}
+
+static inline uint32_t inl(uint16_t port) {
+    uint32_t rv;
+    __asm__ __volatile__ ("inl %1, %0" : "=a" (rv) : "dN" (port));
+    return rv;
+}
+
+static inline void outl(uint16_t port, uint32_t val) {
+    __asm__ __volatile__ ("outl %0, %1" : : "a" (val), "dN" (port));
+}
+
+// Write to an unused port to give slow devices (the PIC) time to settle
+static inline void io_wait(void) {
+    outb(0x80, 0);
+}
+
+#endif
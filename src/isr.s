@@ -0,0 +1,52 @@
+# Interrupt entry stubs
+# Every vector gets a 16 byte stub that pushes a dummy error code (unless
+# the CPU already pushed one) and its vector number, then jumps to
+# isr_common. The C side finds stub N at isr_stubs + 16*N.
+
+    .code32
+    .section .text
+    .global isr_stubs
+    .align 16
+isr_stubs:
+    .set vec, 0
+    .rept 256
+    .align 16
+    .if (vec == 8) || (vec == 10) || (vec == 11) || (vec == 12) || (vec == 13) || (vec == 14) || (vec == 17)
+    pushl $vec              # CPU pushed the error code already
+    .else
+    pushl $0                # Dummy error code
+    pushl $vec
+    .endif
+    jmp isr_common
+    .set vec, vec + 1
+    .endr
+
+# Save the rest of the machine state as a struct interrupt_frame and call
+# interrupt_dispatch(frame)
+isr_common:
+    pushal
+    pushl %ds
+    pushl %es
+    pushl %fs
+    pushl %gs
+
+    movw $0x10, %ax         # Kernel data segment
+    movw %ax, %ds
+    movw %ax, %es
+    movw %ax, %fs
+    movw %ax, %gs
+    cld                     # The C code expects forward string operations
+
+    pushl %esp              # Pointer to the interrupt frame
+    call interrupt_dispatch
+    addl $4, %esp
+
+    popl %gs
+    popl %fs
+    popl %es
+    popl %ds
+    popal
+    addl $8, %esp           # Drop vector number and error code
+    iret
+
+.section .note.GNU-stack,"",@progbits
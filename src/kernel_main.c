@@ -1,10 +1,33 @@
 
 #include <stdint.h>
 #include "rprintf.h"
+#include "string.h"
 #include "page.h"
 #include "mmu.h"
 #include "fat.h"
 #include "ide.h"
+#include "io.h"
+#include "multiboot.h"
+#include "gdt.h"
+#include "interrupt.h"
+#include "timer.h"
+#include "thread.h"
+#include "smp.h"
+#include "workload.h"
+#include "spinlock.h"
+#include "blk.h"
+#include "sd.h"
+#include "pci.h"
+#include "virtio_blk.h"
+#include "ahci.h"
+#include "vm.h"
+#include "fpu.h"
+#include "elf.h"
+#include "user.h"
+#include "initrd.h"
+#include "printk.h"
+#include "keyboard.h"
+#include "shell.h"
 
 #define MULTIBOOT2_HEADER_MAGIC         0xe85250d6
 
@@ -12,86 +35,45 @@ const unsigned int multiboot_header[]  __attribute__((section(".multiboot"))) =
 
 extern char _end_kernel;
 
-// Global page structures
-extern struct page_directory_entry pd[1024];
-extern struct page pt[1024];
+// Global page directory
+extern struct page_directory_entry pd[PD_ENTRIES];
 
-uint8_t inb (uint16_t _port) {
-    uint8_t rv;
-    __asm__ __volatile__ ("inb %1, %0" : "=a" (rv) : "dN" (_port));
-    return rv;
-}
-
-
-
-unsigned char keyboard_map[128] =
-{
-   0,  27, '1', '2', '3', '4', '5', '6', '7', '8',     /* 9 */
- '9', '0', '-', '=', '\b',     /* Backspace */
- '\t',                 /* Tab */
- 'q', 'w', 'e', 'r',   /* 19 */
- 't', 'y', 'u', 'i', 'o', 'p', '[', ']', '\n', /* Enter key */
-   0,                  /* 29   - Control */
- 'a', 's', 'd', 'f', 'g', 'h', 'j', 'k', 'l', ';',     /* 39 */
-'\'', '`',   0,                /* Left shift */
-'\\', 'z', 'x', 'c', 'v', 'b', 'n',                    /* 49 */
- 'm', ',', '.', '/',   0,                              /* Right shift */
- '*',
-   0,  /* Alt */
- ' ',  /* Space bar */
-   0,  /* Caps lock */
-   0,  /* 59 - F1 key ... > */
-   0,   0,   0,   0,   0,   0,   0,   0,  
-   0,  /* < ... F10 */
-   0,  /* 69 - Num lock*/
-   0,  /* Scroll Lock */
-   0,  /* Home key */
-   0,  /* Up Arrow */
-   0,  /* Page Up */
- '-',
-   0,  /* Left Arrow */
-   0,  
-   0,  /* Right Arrow */
- '+',
-   0,  /* 79 - End key*/
-   0,  /* Down Arrow */
-   0,  /* Page Down */
-   0,  /* Insert Key */
-   0,  /* Delete Key */
-   0,   0,   0,  
-   0,  /* F11 Key */
-   0,  /* F12 Key */
-   0,  /* All other keys are undefined */
-};
+// First address past the end of RAM, from the bootloader
+uint32_t memory_top;
 
 int x = 0;
+
+// Serializes access to the cursor and video memory between CPUs
+static struct spinlock console_lock = SPINLOCK_INIT("console");
  
 void scroll_screen(){
-  char *v = (char*)0xB8000;
-  int row; 
+  uint16_t *v = (uint16_t*)0xB8000;
   int col;
   
-  // Move each line up by one (copy line 1 to line 0, etc.)
-  for (row = 0; row < 24; row++){
-    for(col = 0; col < 80; col++){
-      v[(row * 80 + col) * 2] = v[((row + 1) * 80 + col) * 2]; // Character
-      v[(row * 80 + col) * 2 + 1] = v[(( row + 1) * 80 + col) * 2 + 1]; // Color
-    }
-  }
+  // Move lines 1-24 up by one in a single copy
+  memmove(v, v + 80, 24 * 80 * 2);
   
-  // Clear the last line (line 24)
+  // Clear the last line (line 24): space, color 10
   for(col = 0; col < 80; col++){
-    v[(24 * 80 + col) * 2] = ' '; // Space
-    v[(24 * 80 + col) * 2 + 1] = 10; // Color
+    v[24 * 80 + col] = (10 << 8) | ' ';
   }
 
 }
 
-int putc(int c){
+static void vga_putc(int c){
   // Move to beginning of current line
   if (c == '\r') {
     x = (x / 80) * 80;
-    return 0;
+    return;
+  }
+  // Rub out the previous character, as the shell does for backspace
+  if (c == '\b') {
+    if (x > 0) {
+      x--;
+      char *v = (char*)0xB8000;
+      v[x*2] = ' ';
+    }
+    return;
   }
   // Move to beginning of next line
   if (c == '\n') {
@@ -102,7 +84,7 @@ int putc(int c){
       scroll_screen();
       x = 24 * 80;
     }
-    return 0;
+    return;
   }
   // Check if we need to scroll before writing (if we're past the screen)
   if ( x >= 25 * 80) {
@@ -120,67 +102,82 @@ int putc(int c){
    scroll_screen();
    x = 24 * 80;
   }
+}
+
+int putc(int c){
+  uint32_t flags = spin_lock_irqsave(&console_lock);
+  vga_putc(c);
+  spin_unlock_irqrestore(&console_lock, flags);
   return 0;
 } 
 
 void setup_paging(void){
-    esp_printf(putc, "Setting up paging...\r\n");
+    klog(LOG_DEBUG, LOG_MM, "Setting up paging");
     
-    // Initialize page directory and page table
+    // Initialize page directory
     init_page_structures();
     
-    // Get the stack pointer
-    uint32_t esp;
-    asm("mov %%esp, %0" : "=r" (esp));
+    // Identity map all of RAM, which covers the kernel, the boot stack, the
+    // video buffer at 0xB8000 and every frame the allocator hands out.
+    // Page 0 stays unmapped so NULL pointer dereferences fault.
+    klog(LOG_INFO, LOG_MM, "Identity mapping memory from 0x1000 to 0x%x", memory_top);
     
-    // Identity map the kernel (0x100000 to &_end_kernel)
-    esp_printf(putc, "Identity mapping kernel from 0x100000 to 0x%x\r\n", (uint32_t)&_end_kernel);
-    
-    uint32_t kernel_start = 0x100000;
-    uint32_t kernel_end = (uint32_t)&_end_kernel;
-    
-    // Round up to nearest page boundary
-    kernel_end = (kernel_end + 0xFFF) & ~0xFFF;
-    
-    for (uint32_t addr = kernel_start; addr < kernel_end; addr += 0x1000) {
+    // With PAE, whole 2 MB pages are mapped by their directory entry
+    uint32_t large = 0;
+    for (uint32_t addr = 0x1000; addr < memory_top; ) {
+        if (addr % LARGE_PAGE_SIZE == 0 && memory_top - addr >= LARGE_PAGE_SIZE &&
+            map_large_page((void *)addr, addr) == 0) {
+            addr += LARGE_PAGE_SIZE;
+            large++;
+            continue;
+        }
         struct ppage tmp;
         tmp.next = NULL;
         tmp.physical_addr = (void *)addr;
         map_pages((void *)addr, &tmp, pd);
+        addr += 0x1000;
     }
-    
-    // Identity map the stack
-    esp_printf(putc, "Identity mapping stack at 0x%x\r\n", esp);
-    
-    // Map a few pages around the stack pointer
-    uint32_t stack_page = esp & ~0xFFF; // Round down to page boundary
-    for (int i = 0; i < 4; i++) { // Map 4 pages for the stack
-        struct ppage tmp;
-        tmp.next = NULL;
-        tmp.physical_addr = (void *)(stack_page - (i * 0x1000));
-        map_pages((void *)(stack_page - (i * 0x1000)), &tmp, pd);
-    }
-    
-    // Identity map the video buffer at 0xB8000
-    esp_printf(putc, "Identity mapping video buffer at 0xB8000\r\n");
-    struct ppage tmp;
-    tmp.next = NULL;
-    tmp.physical_addr = (void *)0xB8000;
-    map_pages((void *)0xB8000, &tmp, pd);
+#ifdef CONFIG_PAE
+    klog(LOG_INFO, LOG_MM, "PAE paging, %d large pages, NX %s", large, nx_enabled ? "on" : "unsupported");
+#endif
     
     // Load the page directory into CR3
-    esp_printf(putc, "Loading page directory...\r\n");
     loadPageDirectory(pd);
     
     // Enable paging
-    esp_printf(putc, "Enabling paging...\r\n");
     enable_paging();
     
-    esp_printf(putc, "Paging enabled successfully!\r\n");
+    klog(LOG_DEBUG, LOG_MM, "Paging enabled");
+
+}
+
+// Hand RAM past the identity map (above 4 GB too, with PAE) to the frame allocator
+void setup_highmem(void){
+    uint64_t start, end;
+    uint32_t end_pfn = 0;
+
+    for (unsigned int i = 0; multiboot_ram_range(i, &start, &end) == 0; i++) {
+        uint32_t pfn = (end >> 12 > MAX_PFN) ? MAX_PFN : (uint32_t)(end >> 12);
+        if (pfn > end_pfn) {
+            end_pfn = pfn;
+        }
+    }
+    if (pfa_init_highmem(end_pfn) != 0) {
+        return;
+    }
 
+    // Partial frames at either end of a range aren't usable
+    for (unsigned int i = 0; multiboot_ram_range(i, &start, &end) == 0; i++) {
+        uint64_t first = (start + PAGE_SIZE - 1) >> 12;
+        uint64_t last = end >> 12;
+        if (first < MAX_PFN) {
+            pfa_add_highmem(first, (last > MAX_PFN) ? MAX_PFN : last);
+        }
+    }
+    klog(LOG_INFO, LOG_MM, "%d free frames including highmem", pfa_free_count());
 }
 
-void main() {
+void main(uint32_t magic, uint32_t mbi_addr) {
     putc('h');
     putc('e');
     putc('l');
@@ -192,19 +189,111 @@ void main() {
 
    esp_printf(putc, "Kernel started!\r\n");
 
+   if (multiboot_init(magic, mbi_addr) != 0) {
+     esp_printf(putc, "Not booted by a multiboot2 loader, assuming default memory size\r\n");
+   }
+   // Log filters from grub.cfg, e.g. "multiboot2 /kernel loglevel=3"
+   printk_init(multiboot_cmdline());
+   memory_top = multiboot_memory_top();
+   if (memory_top > MAX_PHYSICAL_MEMORY) {
+     memory_top = MAX_PHYSICAL_MEMORY;
+   }
+
    // Initialize the page frame allocator
    esp_printf(putc, "Initializing page frame allocator...\r\n");
-   init_pfa_list();
+   init_pfa_list(memory_top);
+   pfa_reserve_range(multiboot_info_start(), multiboot_info_end());
+   // GRUB loads modules (the initramfs) into free RAM; keep them out of the allocator
+   for (struct multiboot_tag_module *mod = (void *)multiboot_next_tag(NULL, MULTIBOOT_TAG_TYPE_MODULE);
+        mod != NULL; mod = (void *)multiboot_next_tag((void *)mod, MULTIBOOT_TAG_TYPE_MODULE)) {
+     pfa_reserve_range(mod->mod_start, mod->mod_end);
+   }
+   esp_printf(putc, "%d free frames\r\n", pfa_free_count());
+ 
+   // Look for other processors while firmware tables are still reachable
+   smp_early_init();
  
    // Setup paging
    setup_paging();
+   setup_highmem();
+
+   // Descriptor tables, interrupts and the scheduler
+   esp_printf(putc, "Setting up interrupts and threads...\r\n");
+   gdt_init();
+   tss_load(0);
+   interrupts_init();
+   vm_init();
+   timer_init();
+   thread_init();
+   fpu_init();
+   syscall_init();
+   ide_init();
+   blk_init();
+   keyboard_init();
+   interrupts_enable();
+   smp_init();
 
+   // Prefer a virtio or AHCI disk over emulated IDE when QEMU provides one
+   pci_init();
+   if (virtio_blk_init() != 0) {
+     ahci_init();
+   }
    
+   // Reserve 16 MB and touch one page per megabyte: only those get frames
+   esp_printf(putc, "\r\n=== Testing Demand Paging ===\r\n");
+   struct vm_region *demo = vm_area_alloc(0x1000000, VM_WRITE, "demo");
+   if (demo != NULL) {
+     unsigned int free_before = pfa_free_count();
+     int nonzero = 0;
+     for (uint32_t addr = demo->start; addr < demo->end; addr += 0x100000) {
+       volatile uint32_t *p = (uint32_t *)addr;
+       nonzero |= *p;
+       *p = addr;
+     }
+     esp_printf(putc, "16 MB area at 0x%x: %d pages populated, %d frames used, %s\r\n",
+                demo->start, demo->pages, free_before - pfa_free_count(),
+                nonzero ? "NOT zero-filled" : "zero-filled");
+
+     // Share it copy-on-write: no data is copied until one side writes
+     struct vm_region *clone = vm_area_alloc(0x1000000, VM_WRITE, "clone");
+     if (clone != NULL) {
+       free_before = pfa_free_count();
+       int shared = vm_region_clone(clone, demo);
+       int used_sharing = free_before - pfa_free_count();
+       volatile uint32_t *orig = (uint32_t *)demo->start;
+       volatile uint32_t *copy = (uint32_t *)clone->start;
+       int same = (*copy == *orig);
+       *copy = 0xC0FFEE;
+       esp_printf(putc, "COW clone: %d pages shared with %d new frames, %s, "
+                  "write copied %d frame, original %s\r\n",
+                  shared, used_sharing, same ? "contents match" : "CONTENTS DIFFER",
+                  free_before - pfa_free_count() - used_sharing,
+                  (*orig == demo->start) ? "untouched" : "CHANGED");
+       vm_area_free(clone);
+     }
+     vm_area_free(demo);
+   }
+
+   // Time the string library against the byte loops it replaced
+   string_workload();
+
+   // Boot assets come from the initramfs: run a program in ring 3 before
+   // anything has read the disk
+   esp_printf(putc, "\r\n=== Running HELLO.ELF ===\r\n");
+   if (initrd_init() != 0) {
+     esp_printf(putc, "No initramfs module, loading from disk\r\n");
+   }
+   int exit_code;
+   if (user_run("/HELLO.ELF", &exit_code) == 0) {
+     esp_printf(putc, "HELLO.ELF exited with %d\r\n", exit_code);
+   }
+   esp_printf(putc, "Disk requests so far: %d\r\n", blk_request_count());
+
    // Test disk reading
    esp_printf(putc, "\r\n=== Testing Disk Read ===\r\n");
    char test_buffer[512];
-   int result = ata_lba_read(2048, (unsigned char*)test_buffer, 1);
-   esp_printf(putc, "ata_lba_read returned: %d\r\n", result);
+   int result = sd_readblock(2048, test_buffer, 1);
+   esp_printf(putc, "sd_readblock returned: %d\r\n", result);
    esp_printf(putc, "Boot signature bytes: 0x%x 0x%x\r\n", 
               (unsigned char)test_buffer[510], (unsigned char)test_buffer[511]);
    
@@ -221,9 +310,19 @@ void main() {
          file_buffer[bytes] = '\0'; // Null terminate
          esp_printf(putc, "\r\nFile contents: \r\n%s\r\n", file_buffer);
        }
+       fatClose(f);
      } else {
         esp_printf(putc, "Could not open test file \r\n");
      }
+
+     // Checksum every file, spread over all CPUs
+     checksum_workload();
+
+     // Small scattered reads through the request queue
+     block_workload();
+
+     // Lookups and reads over a volume from make corpus, if this is one
+     fat_workload();
    } else {
       esp_printf(putc, "FAT initialization failed\r\n");
    }
@@ -250,10 +349,23 @@ void main() {
     esp_printf(putc, "Scrolling test completed successfully!\r\n");
     esp_printf(putc, "All assignment requirements have been met! \r\n");
 
-   // Infinite loop at the end:
-   esp_printf(putc, "Kernel finished. System halted.\r\n");
-   while(1){
-     // Infinite loop to keep the kernel running
-     __asm__ __volatile__("hlt");
-   }
+   // Put anything still in the log ahead of the statistics
+   klog_flush(LOG_RECORDS);
+
+   // Which locks were busy during boot
+   esp_printf(putc, "\r\n");
+   lock_stats_dump();
+   pfa_stats_dump();
+   blk_stats_dump();
+   fat_stats_dump();
+   vm_stats_dump();
+   fpu_stats_dump();
+   klog_stats_dump();
+
+   // The idle thread halts the CPU whenever no other thread is runnable
+   esp_printf(putc, "Kernel finished. %d context switches.\r\n", thread_context_switches());
+
+   // Keys typed during boot are already waiting in the keyboard ring
+   shell_start();
+   thread_exit();
 }
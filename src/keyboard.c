@@ -0,0 +1,235 @@
+#include "keyboard.h"
+#include "interrupt.h"
+#include "thread.h"
+#include "timer.h"
+#include "atomic.h"
+#include "io.h"
+#include "rprintf.h"
+
+extern int putc(int c);
+
+// US layout, scancode set 1
+static const unsigned char keyboard_map[128] =
+{
+   0,  27, '1', '2', '3', '4', '5', '6', '7', '8',     /* 9 */
+ '9', '0', '-', '=', '\b',     /* Backspace */
+ '\t',                 /* Tab */
+ 'q', 'w', 'e', 'r',   /* 19 */
+ 't', 'y', 'u', 'i', 'o', 'p', '[', ']', '\n', /* Enter key */
+   0,                  /* 29   - Control */
+ 'a', 's', 'd', 'f', 'g', 'h', 'j', 'k', 'l', ';',     /* 39 */
+'\'', '`',   0,                /* Left shift */
+'\\', 'z', 'x', 'c', 'v', 'b', 'n',                    /* 49 */
+ 'm', ',', '.', '/',   0,                              /* Right shift */
+ '*',
+   0,  /* Alt */
+ ' ',  /* Space bar */
+   0,  /* Caps lock */
+   0,  /* 59 - F1 key ... > */
+   0,   0,   0,   0,   0,   0,   0,   0,  
+   0,  /* < ... F10 */
+   0,  /* 69 - Num lock*/
+   0,  /* Scroll Lock */
+   0,  /* Home key */
+   0,  /* Up Arrow */
+   0,  /* Page Up */
+ '-',
+   0,  /* Left Arrow */
+   0,  
+   0,  /* Right Arrow */
+ '+',
+   0,  /* 79 - End key*/
+   0,  /* Down Arrow */
+   0,  /* Page Down */
+   0,  /* Insert Key */
+   0,  /* Delete Key */
+   0,   0,   0,  
+   0,  /* F11 Key */
+   0,  /* F12 Key */
+   0,  /* All other keys are undefined */
+};
+
+// The same keys with shift held. Only the main block changes.
+static const unsigned char keyboard_map_shift[128] =
+{
+   0,  27, '!', '@', '#', '$', '%', '^', '&', '*',     /* 9 */
+ '(', ')', '_', '+', '\b',     /* Backspace */
+ '\t',                 /* Tab */
+ 'Q', 'W', 'E', 'R',   /* 19 */
+ 'T', 'Y', 'U', 'I', 'O', 'P', '{', '}', '\n', /* Enter key */
+   0,                  /* 29   - Control */
+ 'A', 'S', 'D', 'F', 'G', 'H', 'J', 'K', 'L', ':',     /* 39 */
+ '"', '~',   0,                /* Left shift */
+ '|', 'Z', 'X', 'C', 'V', 'B', 'N',                    /* 49 */
+ 'M', '<', '>', '?',   0,                              /* Right shift */
+ '*',
+   0,  /* Alt */
+ ' ',  /* Space bar */
+   0,  /* Caps lock */
+   0,  /* 59 - F1 key ... > */
+   0,   0,   0,   0,   0,   0,   0,   0,
+   0,  /* < ... F10 */
+   0,  /* 69 - Num lock*/
+   0,  /* Scroll Lock */
+   0,  /* Home key */
+   0,  /* Up Arrow */
+   0,  /* Page Up */
+ '-',
+   0,  /* Left Arrow */
+   0,
+   0,  /* Right Arrow */
+ '+',
+   0,  /* 79 - End key*/
+   0,  /* Down Arrow */
+   0,  /* Page Down */
+   0,  /* Insert Key */
+   0,  /* Delete Key */
+   0,   0,   0,
+   0,  /* F11 Key */
+   0,  /* F12 Key */
+   0,  /* All other keys are undefined */
+};
+
+/*
+ * Scancodes waiting for the reader. The interrupt handler is the only
+ * writer of ring_head and keyboard_getc the only writer of ring_tail, so
+ * the ring needs no lock: the IO-APIC sends IRQ 1 to the boot CPU alone,
+ * and there is one shell reading. x86 doesn't reorder stores with other
+ * stores, so barrier() is enough to publish an event before the index.
+ */
+static struct kbd_event ring[KBD_RING_SIZE];
+static volatile uint32_t ring_head = 0;
+static volatile uint32_t ring_tail = 0;
+
+// The reader sleeps here while the ring is empty
+static struct wait_queue kbd_wq;
+
+// Modifier state, only used by the reader
+static int shift = 0;
+static int ctrl = 0;
+static int caps_lock = 0;
+static int extended = 0;
+
+static struct {
+    uint32_t scancodes;
+    uint32_t overflows;     // Scancodes lost to a full ring
+    uint32_t peak;          // Most scancodes waiting at once
+    uint32_t chars;         // Characters returned by keyboard_getc
+    uint64_t latency;       // Cycles from interrupt to keyboard_getc, summed
+    uint32_t latency_max;
+} stats;
+
+static void keyboard_irq_handler(struct interrupt_frame *frame) {
+    uint8_t code = inb(KBD_DATA_PORT);
+    uint32_t head = ring_head;
+    uint32_t used = head - ring_tail;
+
+    if (used == KBD_RING_SIZE) {
+        stats.overflows++;
+        return;
+    }
+    ring[head & (KBD_RING_SIZE - 1)].code = code;
+    ring[head & (KBD_RING_SIZE - 1)].stamp = (uint32_t)rdtsc();
+    barrier();
+    ring_head = head + 1;
+
+    stats.scancodes++;
+    if (used + 1 > stats.peak) {
+        stats.peak = used + 1;
+    }
+    wake_up(&kbd_wq);
+}
+
+void keyboard_init(void) {
+    wait_queue_init(&kbd_wq, "keyboard");
+
+    // A key pressed during boot leaves a byte that would hold off the next interrupt
+    while (inb(KBD_STATUS_PORT) & KBD_STATUS_FULL) {
+        inb(KBD_DATA_PORT);
+    }
+    register_interrupt_handler(IRQ_BASE + IRQ_KEYBOARD, keyboard_irq_handler);
+    irq_unmask(IRQ_KEYBOARD);
+}
+
+// Update the modifiers for one scancode and return the character it types, or 0
+static int translate(uint8_t code) {
+    if (code == KEY_EXTENDED) {
+        extended = 1;
+        return 0;
+    }
+    int released = code & KEY_RELEASE;
+    int key = code & ~KEY_RELEASE;
+    int was_extended = extended;
+    extended = 0;
+
+    switch (key) {
+    case KEY_CTRL:
+        ctrl = !released;       // Left ctrl, or right ctrl after the prefix
+        return 0;
+    case KEY_LSHIFT:
+    case KEY_RSHIFT:
+        if (!was_extended) {    // Fake shifts around extended keys
+            shift = !released;
+        }
+        return 0;
+    case KEY_CAPS_LOCK:
+        if (!released) {
+            caps_lock = !caps_lock;
+        }
+        return 0;
+    }
+    // Arrows and the rest of the second bank type nothing
+    if (released || was_extended) {
+        return 0;
+    }
+
+    int c = shift ? keyboard_map_shift[key] : keyboard_map[key];
+    if (caps_lock && c >= 'a' && c <= 'z') {
+        c -= 'a' - 'A';
+    } else if (caps_lock && c >= 'A' && c <= 'Z') {
+        c += 'a' - 'A';
+    }
+    if (ctrl && keyboard_map[key] >= 'a' && keyboard_map[key] <= 'z') {
+        c = keyboard_map[key] & 0x1F;
+    }
+    return c;
+}
+
+/*
+ * keyboard_getc - Wait for the next character typed
+ *
+ * Translation happens here rather than in the interrupt handler, so the
+ * handler only has to read the port and store a byte. Control combinations
+ * come back as ASCII control codes (ctrl-C is 3).
+ *
+ * Returns: The character
+ */
+int keyboard_getc(void) {
+    for (;;) {
+        wait_event(&kbd_wq, ring_head != ring_tail);
+
+        uint32_t tail = ring_tail;
+        struct kbd_event ev = ring[tail & (KBD_RING_SIZE - 1)];
+        barrier();
+        ring_tail = tail + 1;
+
+        int c = translate(ev.code);
+        if (c != 0) {
+            uint32_t cycles = (uint32_t)rdtsc() - ev.stamp;
+            stats.chars++;
+            stats.latency += cycles;
+            if (cycles > stats.latency_max) {
+                stats.latency_max = cycles;
+            }
+            return c;
+        }
+    }
+}
+
+void keyboard_stats_dump(void) {
+    uint32_t avg = stats.chars ? kcycles(stats.latency) / stats.chars : 0;
+    esp_printf(putc, "keyboard: %d scancodes, %d chars, %d overflows, ring peak %d/%d, "
+               "latency avg %d max %d Kcycles\r\n",
+               stats.scancodes, stats.chars, stats.overflows, stats.peak, KBD_RING_SIZE,
+               avg, kcycles(stats.latency_max));
+}
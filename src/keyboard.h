@@ -0,0 +1,31 @@
+#ifndef KEYBOARD_H
+#define KEYBOARD_H
+
+#include <stdint.h>
+
+// 8042 PS/2 controller
+#define KBD_DATA_PORT   0x60
+#define KBD_STATUS_PORT 0x64
+#define KBD_STATUS_FULL 0x01    // A byte is waiting in the data port
+
+// Scancode set 1
+#define KEY_RELEASE     0x80    // Set on break codes
+#define KEY_EXTENDED    0xE0    // Prefix of the second bank (arrows, right ctrl, ...)
+#define KEY_CTRL        0x1D
+#define KEY_LSHIFT      0x2A
+#define KEY_RSHIFT      0x36
+#define KEY_CAPS_LOCK   0x3A
+
+#define KBD_RING_SIZE   256     // Scancodes buffered for the reader, a power of two
+
+// A scancode and the low half of the time stamp counter when it arrived
+struct kbd_event {
+    uint32_t stamp;
+    uint8_t code;
+};
+
+void keyboard_init(void);
+int keyboard_getc(void);
+void keyboard_stats_dump(void);
+
+#endif
@@ -1,32 +1,70 @@
 #include "mmu.h"
+#include "smp.h"
 #include <stddef.h>
 
-// Global page directory and page table
-struct page_directory_entry pd[1024] __attribute__((aligned(4096)));
-struct page pt[1024] __attribute__((aligned(4096)));
+// Global page directory. Page tables are allocated from the frame allocator
+// as map_pages needs them. With PAE these are the four page directories,
+// one per PDPT entry.
+struct page_directory_entry pd[PD_ENTRIES] __attribute__((aligned(4096)));
 
-// Create the page directory and page table to all zeros
+#ifdef CONFIG_PAE
+// Points at the four pages of pd. Only the present bit and the frame may
+// be set at this level.
+static uint64_t pdpt[4] __attribute__((aligned(32)));
+#endif
+
+// End of the identity mapped RAM (lowmem), from kernel_main
+extern uint32_t memory_top;
+
+// Set when PAE is on and the CPU can mark pages non-executable
+int nx_enabled = 0;
+
+#ifdef CONFIG_PAE
+static int cpu_has_nx(void) {
+    uint32_t eax = 0x80000000, ebx, ecx, edx;
+    asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    if (eax < 0x80000001) {
+        return 0;
+    }
+    eax = 0x80000001;
+    asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    return (edx & CPUID_NX) != 0;
+}
+#endif
+
+// Create the page directory with all entries not present
 void init_page_structures(void) {
-    for (int i = 0; i < 1024; i++) {
+    for (int i = 0; i < PD_ENTRIES; i++) {
         pd[i].present = 0;
         pd[i].rw = 1;
         pd[i].user = 0;
         pd[i].writethru = 0;
         pd[i].cachedisabled = 0;
         pd[i].accessed = 0;
+        pd[i].dirty = 0;
         pd[i].pagesize = 0;
         pd[i].ignored = 0;
         pd[i].os_specific = 0;
         pd[i].frame = 0;
-        
-        pt[i].present = 0;
-        pt[i].rw = 1;
-        pt[i].user = 0;
-        pt[i].accessed = 0;
-        pt[i].dirty = 0;
-        pt[i].unused = 0;
-        pt[i].frame = 0;
     }
+#ifdef CONFIG_PAE
+    for (int i = 0; i < 4; i++) {
+        pdpt[i] = (uint32_t)&pd[i * PT_ENTRIES] | 1;
+    }
+    nx_enabled = cpu_has_nx();
+#endif
+
+    // The kmap windows' page table, made now so no two CPUs race to add it
+    get_pte((void *)KMAP_BASE, 1);
+}
+
+// Allocate a cleared frame to hold a new page table
+static struct page *alloc_page_table(void) {
+    struct ppage *frame = allocate_page(PFA_ZERO);
+    if (frame == NULL) {
+        return NULL;
+    }
+    return (struct page *)frame->physical_addr;
 }
 
 /*
@@ -36,7 +74,11 @@ void init_page_structures(void) {
  * pglist: Linked list of physical pages to map
  * pd: Page directory pointer
  * 
- * Returns: The virtual address that was mapped
+ * Page tables are allocated on demand, so paging must not be enabled yet
+ * unless the allocator's frames are already identity mapped.
+ *
+ * Returns: The virtual address that was mapped, or NULL if a page table
+ * could not be allocated
  */
 
 void *map_pages(void *vaddr, struct ppage *pglist, struct page_directory_entry *pd) {
@@ -44,20 +86,25 @@ void *map_pages(void *vaddr, struct ppage *pglist, struct page_directory_entry *
     struct ppage *current = pglist;
     
     while (current != NULL) {
-        // Calculate page directory index (bits 22-31 of virtual address)
-        uint32_t pd_index = ((uint32_t)vaddr >> 22) & 0x3FF;
+        // Calculate page directory index (bits 22-31 of virtual address,
+        // or 21-31 across the four PAE directories)
+        uint32_t pd_index = PD_INDEX(vaddr);
         
-        // Calculate page table index (bits 12-21 of virtual address)
-        uint32_t pt_index = ((uint32_t)vaddr >> 12) & 0x3FF;
+        // Calculate page table index (the next 10 or 9 bits)
+        uint32_t pt_index = PT_INDEX(vaddr);
         
         // If this page directory entry is not present, set it up
         if (!pd[pd_index].present) {
-            // Point to our global page table
-            pd[pd_index].frame = ((uint32_t)&pt[0]) >> 12;
+            struct page *new_table = alloc_page_table();
+            if (new_table == NULL) {
+                return NULL;
+            }
+            pd[pd_index].frame = ((uint32_t)new_table) >> 12;
             pd[pd_index].present = 1;
             pd[pd_index].rw = 1;       // Read/Write
             pd[pd_index].user = 0;     // Supervisor only
         }
+        struct page *pt = (struct page *)(uint32_t)ENTRY_ADDR(pd[pd_index]);
         
         // Set up the page table entry
         pt[pt_index].frame = ((uint32_t)current->physical_addr) >> 12;
@@ -73,12 +120,273 @@ void *map_pages(void *vaddr, struct ppage *pglist, struct page_directory_entry *
     return start_vaddr;
 }
 
-// Loads the page directory into CR3
+/*
+ * get_pte - Finds the page table entry for a virtual address
+ *
+ * vaddr: Virtual address to look up
+ * create: If set, allocate the page table when it doesn't exist yet
+ *
+ * Returns: The entry, or NULL if there is no page table (or one could not
+ * be allocated, or vaddr is inside a large page)
+ */
+struct page *get_pte(void *vaddr, int create) {
+    uint32_t pd_index = PD_INDEX(vaddr);
+    uint32_t pt_index = PT_INDEX(vaddr);
+
+    if (pd[pd_index].present && pd[pd_index].pagesize) {
+        return NULL;
+    }
+
+    if (!pd[pd_index].present) {
+        if (!create) {
+            return NULL;
+        }
+        struct page *new_table = alloc_page_table();
+        if (new_table == NULL) {
+            return NULL;
+        }
+        pd[pd_index].frame = ((uint32_t)new_table) >> 12;
+        pd[pd_index].present = 1;
+        pd[pd_index].rw = 1;
+        pd[pd_index].user = 0;
+    }
+    struct page *pt = (struct page *)(uint32_t)ENTRY_ADDR(pd[pd_index]);
+    return &pt[pt_index];
+}
+
+/*
+ * map_page - Maps one physical frame at a virtual address
+ *
+ * vaddr: Page aligned virtual address
+ * paddr: Physical address of the frame, which may be above 4 GB with PAE
+ * flags: PAGE_WRITE, PAGE_USER, PAGE_NOCACHE and/or PAGE_EXEC
+ *
+ * The old translation, if any, is flushed from this CPU's TLB.
+ *
+ * Returns: 0 on success, -1 if a page table could not be allocated
+ */
+int map_page(void *vaddr, phys_addr_t paddr, uint32_t flags) {
+    struct page *pte = get_pte(vaddr, 1);
+    if (pte == NULL) {
+        return -1;
+    }
+
+    if (flags & PAGE_USER) {
+        pd[PD_INDEX(vaddr)].user = 1;
+    }
+    struct page entry = {0};
+    entry.frame = paddr >> 12;
+    entry.rw = (flags & PAGE_WRITE) ? 1 : 0;
+    entry.user = (flags & PAGE_USER) ? 1 : 0;
+    entry.cachedisabled = (flags & PAGE_NOCACHE) ? 1 : 0;
+    entry.writethru = (flags & PAGE_NOCACHE) ? 1 : 0;
+#ifdef CONFIG_PAE
+    entry.nx = (nx_enabled && !(flags & PAGE_EXEC)) ? 1 : 0;
+#endif
+    entry.present = 1;
+    set_pte(pte, entry);
+    invlpg(vaddr);
+    return 0;
+}
+
+/*
+ * map_large_page - Maps a 2 MB page with a single directory entry
+ *
+ * For building the kernel's identity map before paging is enabled; the
+ * page is writable and executable by the kernel. Both addresses must be
+ * LARGE_PAGE_SIZE aligned.
+ *
+ * Returns: 0 on success, -1 if the entry is in use or large pages aren't
+ * available (classic paging maps everything with 4 KB pages)
+ */
+int map_large_page(void *vaddr, phys_addr_t paddr) {
+#ifdef CONFIG_PAE
+    struct page_directory_entry *pde = &pd[PD_INDEX(vaddr)];
+    if (pde->present) {
+        return -1;
+    }
+    pde->frame = paddr >> 12;
+    pde->rw = 1;
+    pde->user = 0;
+    pde->pagesize = 1;
+    pde->present = 1;
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+/*
+ * unmap_page - Removes the mapping at a virtual address
+ *
+ * Returns: The physical address that was mapped there, or 0 if nothing was
+ */
+phys_addr_t unmap_page(void *vaddr) {
+    struct page *pte = get_pte(vaddr, 0);
+    if (pte == NULL || !pte->present) {
+        return 0;
+    }
+
+    phys_addr_t paddr = ENTRY_ADDR(*pte);
+    clear_pte(pte);
+    invlpg(vaddr);
+    return paddr;
+}
+
+/*
+ * dma_addr - Physical address of a kernel buffer byte, for a device
+ *
+ * vaddr may be in the identity map or in a vm area such as a vmalloc
+ * buffer, whose pages are not physically contiguous, so callers translate
+ * each page they hand to a device. Frames past lowmem are refused: with
+ * PAE they may be above 4 GB, and the drivers give devices 32-bit
+ * addresses.
+ *
+ * Returns: The physical address, or 0 if vaddr is unmapped or outside lowmem
+ */
+uint32_t dma_addr(const void *vaddr) {
+    struct page_directory_entry *pde = &pd[PD_INDEX(vaddr)];
+    phys_addr_t paddr;
+
+    if (pde->present && pde->pagesize) {
+        paddr = ENTRY_ADDR(*pde) + ((uint32_t)vaddr & (LARGE_PAGE_SIZE - 1));
+    } else {
+        struct page *pte = get_pte((void *)vaddr, 0);
+        if (pte == NULL || !pte->present) {
+            return 0;
+        }
+        paddr = ENTRY_ADDR(*pte) + ((uint32_t)vaddr & (PAGE_SIZE - 1));
+    }
+    if (paddr >= memory_top) {
+        return 0;
+    }
+    return (uint32_t)paddr;
+}
+
+/*
+ * dma_segment - Physically contiguous start of a kernel buffer
+ *
+ * vaddr, len: The buffer
+ * paddr: Receives the physical address of vaddr
+ *
+ * Follows the buffer page by page while the frames are adjacent, which
+ * in the identity map they always are.
+ *
+ * Returns: Bytes from vaddr that are contiguous at *paddr (at most len),
+ * or 0 if vaddr can't be given to a device
+ */
+uint32_t dma_segment(const void *vaddr, uint32_t len, uint32_t *paddr) {
+    *paddr = dma_addr(vaddr);
+    if (*paddr == 0) {
+        return 0;
+    }
+    uint32_t run = PAGE_SIZE - ((uint32_t)vaddr & (PAGE_SIZE - 1));
+    while (run < len && dma_addr((const char *)vaddr + run) == *paddr + run) {
+        run += PAGE_SIZE;
+    }
+    return (run < len) ? run : len;
+}
+
+// The map_page flags that would recreate a present entry
+uint32_t pte_flags(struct page *pte) {
+    uint32_t flags = PAGE_EXEC;
+    if (pte->rw) flags |= PAGE_WRITE;
+    if (pte->user) flags |= PAGE_USER;
+    if (pte->cachedisabled) flags |= PAGE_NOCACHE;
+#ifdef CONFIG_PAE
+    if (pte->nx) flags &= ~PAGE_EXEC;
+#endif
+    return flags;
+}
+
+/*
+ * map_mmio - Identity maps a range of device memory, uncached
+ *
+ * paddr: Physical address of the device registers
+ * size: Size of the register window in bytes
+ *
+ * Safe to call after paging is enabled: stale TLB entries are flushed.
+ *
+ * Returns: paddr as a pointer, or NULL if a page table could not be allocated
+ */
+void *map_mmio(uint32_t paddr, uint32_t size) {
+    uint32_t start = paddr & ~0xFFF;
+    uint32_t end = (paddr + size + 0xFFF) & ~0xFFF;
+
+    for (uint32_t addr = start; addr < end; addr += 0x1000) {
+        if (map_page((void *)addr, addr, PAGE_WRITE | PAGE_NOCACHE) != 0) {
+            return NULL;
+        }
+    }
+    return (void *)paddr;
+}
+
+/*
+ * kmap_atomic - Makes a frame addressable by the kernel
+ *
+ * slot: KMAP_SRC or KMAP_DST, so a copy can have both frames mapped
+ *
+ * Lowmem frames are already identity mapped. Highmem frames are mapped
+ * into this CPU's window for the slot, so interrupts must stay disabled
+ * until kunmap_atomic.
+ *
+ * Returns: Where the frame's contents can be read and written
+ */
+void *kmap_atomic(struct ppage *page, int slot) {
+    if (!(page->flags & PPAGE_HIGHMEM)) {
+        return page->physical_addr;
+    }
+    void *vaddr = (void *)(KMAP_BASE + (this_cpu()->id * KMAP_SLOTS + slot) * PAGE_SIZE);
+    map_page(vaddr, ppage_phys(page), PAGE_WRITE);
+    return vaddr;
+}
+
+void kunmap_atomic(void *vaddr) {
+    if ((uint32_t)vaddr >= KMAP_BASE && (uint32_t)vaddr < KMAP_BASE + MAX_CPUS * KMAP_SLOTS * PAGE_SIZE) {
+        unmap_page(vaddr);
+    }
+}
+
+// What CR3 must hold for the kernel's page tables, e.g. on a newly started CPU
+uint32_t mmu_cr3(void) {
+#ifdef CONFIG_PAE
+    return (uint32_t)pdpt;
+#else
+    return (uint32_t)pd;
+#endif
+}
+
+// CR4 bits the paging mode needs before CR3 is loaded
+uint32_t mmu_cr4(void) {
+#ifdef CONFIG_PAE
+    return CR4_PAE;
+#else
+    return 0;
+#endif
+}
+
+// Loads the page directory into CR3. With PAE this switches CR4 to PAE
+// mode and loads the PDPT that points at pd, turning on NX if available.
 void loadPageDirectory(struct page_directory_entry *pd) {
+#ifdef CONFIG_PAE
+    uint32_t cr4;
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+    asm volatile("mov %0, %%cr4" : : "r"(cr4 | CR4_PAE));
+    if (nx_enabled) {
+        uint32_t lo, hi;
+        asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(MSR_EFER));
+        asm volatile("wrmsr" : : "a"(lo | EFER_NXE), "d"(hi), "c"(MSR_EFER));
+    }
+    asm volatile("mov %0, %%cr3"
+        :
+        : "r"(pdpt)
+        : "memory");
+#else
     asm volatile("mov %0, %%cr3"
         :
         : "r"(pd)
         :);
+#endif
 }
 
 // Enable paging by setting CR0 bits
@@ -4,6 +4,58 @@
 #include <stdint.h>
 #include "page.h"
 
+#ifdef CONFIG_PAE
+
+/*
+ * PAE paging: 64-bit entries, 512 to a table. A four-entry page directory
+ * pointer table (PDPT) selects one of four page directories, each covering
+ * 1 GB; a directory entry maps either a page table or a 2 MB page. Frames
+ * can be anywhere below 2^52, and bit 63 makes a page non-executable.
+ */
+#define PDE_SHIFT  21
+#define PD_ENTRIES 2048         // The four page directories, back to back
+#define PT_ENTRIES 512
+
+// Page directory entry structure for PAE
+struct page_directory_entry {
+   uint64_t present       : 1;   // Page present in memory
+   uint64_t rw            : 1;   // Read-only if clear, R/W if set
+   uint64_t user          : 1;   // Supervisor only if clear
+   uint64_t writethru     : 1;   // Cache this directory as write-thru only
+   uint64_t cachedisabled : 1;   // Disable cache on this page table?
+   uint64_t accessed      : 1;   // Has the directory been accessed?
+   uint64_t dirty         : 1;   // Written to (2 MB pages only)
+   uint64_t pagesize      : 1;   // 0 = page table, 1 = 2 MB page
+   uint64_t ignored       : 1;   // Ignored bit
+   uint64_t os_specific   : 3;   // OS-specific bits
+   uint64_t frame         : 40;  // Frame address (shifted right 12 bits)
+   uint64_t reserved      : 11;  // Must be zero
+   uint64_t nx            : 1;   // No instruction fetches (needs EFER.NXE)
+};
+
+// Page table entry structure for PAE
+struct page {
+   uint64_t present       : 1;   // Page present in memory
+   uint64_t rw            : 1;   // Read-only if clear, readwrite if set
+   uint64_t user          : 1;   // Supervisor level only if clear
+   uint64_t writethru     : 1;   // Write-through caching
+   uint64_t cachedisabled : 1;   // Don't cache this page (device memory)
+   uint64_t accessed      : 1;   // Has the page been accessed since last refresh?
+   uint64_t dirty         : 1;   // Has the page been written to since last refresh?
+   uint64_t pat           : 1;   // Page attribute table index
+   uint64_t global        : 1;   // Keep TLB entry across CR3 loads
+   uint64_t available     : 3;   // Free for OS use
+   uint64_t frame         : 40;  // Frame address (shifted right 12 bits)
+   uint64_t reserved      : 11;  // Must be zero
+   uint64_t nx            : 1;   // No instruction fetches (needs EFER.NXE)
+};
+
+#else
+
+#define PDE_SHIFT  22
+#define PD_ENTRIES 1024
+#define PT_ENTRIES 1024
+
 // Page directory entry structure for i386
 struct page_directory_entry {
    uint32_t present       : 1;   // Page present in memory
@@ -12,26 +64,117 @@ struct page_directory_entry {
    uint32_t writethru     : 1;   // Cache this directory as write-thru only
    uint32_t cachedisabled : 1;   // Disable cache on this page table?
    uint32_t accessed      : 1;   // Has the directory been accessed?
+   uint32_t dirty         : 1;   // Written to (4 MB pages only)
    uint32_t pagesize      : 1;   // 0 = 4KB page, 1 = 4MB page
-   uint32_t ignored       : 2;   // Ignored bits
+   uint32_t ignored       : 1;   // Ignored bit
    uint32_t os_specific   : 3;   // OS-specific bits
    uint32_t frame         : 20;  // Frame address (shifted right 12 bits)
 };
 
 // Page table entry structure for i386
 struct page {
-   uint32_t present    : 1;   // Page present in memory
-   uint32_t rw         : 1;   // Read-only if clear, readwrite if set
-   uint32_t user       : 1;   // Supervisor level only if clear
-   uint32_t accessed   : 1;   // Has the page been accessed since last refresh?
-   uint32_t dirty      : 1;   // Has the page been written to since last refresh?
-   uint32_t unused     : 7;   // Combination of unused and reserved bits
-   uint32_t frame      : 20;  // Frame address (shifted right 12 bits)
+   uint32_t present       : 1;   // Page present in memory
+   uint32_t rw            : 1;   // Read-only if clear, readwrite if set
+   uint32_t user          : 1;   // Supervisor level only if clear
+   uint32_t writethru     : 1;   // Write-through caching
+   uint32_t cachedisabled : 1;   // Don't cache this page (device memory)
+   uint32_t accessed      : 1;   // Has the page been accessed since last refresh?
+   uint32_t dirty         : 1;   // Has the page been written to since last refresh?
+   uint32_t pat           : 1;   // Page attribute table index
+   uint32_t global        : 1;   // Keep TLB entry across CR3 loads
+   uint32_t available     : 3;   // Free for OS use
+   uint32_t frame         : 20;  // Frame address (shifted right 12 bits)
 };
 
+#endif
+
+#define LARGE_PAGE_SIZE (1 << PDE_SHIFT)
+#define PD_INDEX(va)    ((uint32_t)(va) >> PDE_SHIFT)
+#define PT_INDEX(va)    (((uint32_t)(va) >> 12) & (PT_ENTRIES - 1))
+
+// Physical address an entry points at
+#define ENTRY_ADDR(e)   ((phys_addr_t)(e).frame << 12)
+
+// Software bit kept in a PTE's available field: the page is shared
+// read-only and gets copied on the first write
+#define PTE_COW 0x1
+
+// Flags for map_page
+#define PAGE_WRITE   0x1
+#define PAGE_USER    0x2
+#define PAGE_NOCACHE 0x4
+#define PAGE_EXEC    0x8    // Without it pages are non-executable where NX is on
+
+#define CR4_PAE   (1 << 5)
+#define MSR_EFER  0xC0000080
+#define EFER_NXE  (1 << 11)
+#define CPUID_NX  (1 << 20)     // CPUID.80000001h:EDX, execute disable
+
+/*
+ * Per-CPU windows for touching frames outside the identity map, just
+ * below the kernel vm area. Slots are used with interrupts disabled.
+ */
+#define KMAP_BASE  0x3FF00000
+#define KMAP_SRC   0
+#define KMAP_DST   1
+#define KMAP_SLOTS 2
+
+extern int nx_enabled;
+
 void init_page_structures(void);
 void *map_pages(void *vaddr, struct ppage *pglist, struct page_directory_entry *pd);
+struct page *get_pte(void *vaddr, int create);
+int map_page(void *vaddr, phys_addr_t paddr, uint32_t flags);
+int map_large_page(void *vaddr, phys_addr_t paddr);
+phys_addr_t unmap_page(void *vaddr);
+uint32_t pte_flags(struct page *pte);
+uint32_t dma_addr(const void *vaddr);
+uint32_t dma_segment(const void *vaddr, uint32_t len, uint32_t *paddr);
+void *map_mmio(uint32_t paddr, uint32_t size);
+void *kmap_atomic(struct ppage *page, int slot);
+void kunmap_atomic(void *vaddr);
+uint32_t mmu_cr3(void);
+uint32_t mmu_cr4(void);
 void loadPageDirectory(struct page_directory_entry *pd);
 void enable_paging(void);
 
+/*
+ * Replace a page table entry. A PAE entry takes two stores, so the half
+ * holding the present bit goes last when mapping and first when
+ * unmapping: the MMU never sees a present entry with a stale frame.
+ */
+static inline void set_pte(struct page *pte, struct page val) {
+#ifdef CONFIG_PAE
+    ((volatile uint32_t *)pte)[1] = ((uint32_t *)&val)[1];
+    ((volatile uint32_t *)pte)[0] = ((uint32_t *)&val)[0];
+#else
+    *(volatile uint32_t *)pte = *(uint32_t *)&val;
+#endif
+}
+
+static inline void clear_pte(struct page *pte) {
+    ((volatile uint32_t *)pte)[0] = 0;
+#ifdef CONFIG_PAE
+    ((volatile uint32_t *)pte)[1] = 0;
+#endif
+}
+
+// Drop one page's translation from this CPU's TLB
+static inline void invlpg(void *vaddr) {
+    asm volatile("invlpg (%0)" : : "r"(vaddr) : "memory");
+}
+
+// Drop every non-global translation from this CPU's TLB
+static inline void flush_tlb(void) {
+    uint32_t cr3;
+    asm volatile("mov %%cr3, %0\n\tmov %0, %%cr3" : "=r"(cr3) : : "memory");
+}
+
+// The faulting address after a page fault
+static inline uint32_t read_cr2(void) {
+    uint32_t addr;
+    asm volatile("mov %%cr2, %0" : "=r"(addr));
+    return addr;
+}
+
 #endif
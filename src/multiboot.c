@@ -0,0 +1,122 @@
+#include "multiboot.h"
+#include "string.h"
+#include <stddef.h>
+
+// Memory size to assume if the bootloader didn't tell us
+#define DEFAULT_MEMORY_TOP 0x2000000  // 32 MB
+
+// Physical address of the multiboot2 info structure (0 if not booted by GRUB)
+static uint32_t mbi;
+
+int multiboot_init(uint32_t magic, uint32_t mbi_addr) {
+    if (magic != MULTIBOOT2_BOOTLOADER_MAGIC) {
+        mbi = 0;
+        return -1;
+    }
+    mbi = mbi_addr;
+    return 0;
+}
+
+/*
+ * multiboot_next_tag - Finds the next tag of a given type
+ *
+ * prev: Tag to continue after, or NULL to start from the beginning
+ *
+ * Tags start 8 bytes into the info structure and are padded to 8 bytes.
+ *
+ * Returns: Pointer to the tag, or NULL if there are no more
+ */
+struct multiboot_tag *multiboot_next_tag(struct multiboot_tag *prev, uint32_t type) {
+    if (mbi == 0) {
+        return NULL;
+    }
+
+    struct multiboot_tag *tag = (struct multiboot_tag *)(mbi + 8);
+    if (prev != NULL) {
+        tag = (struct multiboot_tag *)((uint32_t)prev + ((prev->size + 7) & ~7));
+    }
+    while (tag->type != MULTIBOOT_TAG_TYPE_END) {
+        if (tag->type == type) {
+            return tag;
+        }
+        tag = (struct multiboot_tag *)((uint32_t)tag + ((tag->size + 7) & ~7));
+    }
+    return NULL;
+}
+
+struct multiboot_tag *multiboot_find_tag(uint32_t type) {
+    return multiboot_next_tag(NULL, type);
+}
+
+// Finds the module whose module2 line (after the file name) is cmdline
+struct multiboot_tag_module *multiboot_find_module(const char *cmdline) {
+    struct multiboot_tag *tag = NULL;
+    while ((tag = multiboot_next_tag(tag, MULTIBOOT_TAG_TYPE_MODULE)) != NULL) {
+        struct multiboot_tag_module *mod = (struct multiboot_tag_module *)tag;
+        if (strcmp(mod->cmdline, cmdline) == 0) {
+            return mod;
+        }
+    }
+    return NULL;
+}
+
+// The kernel command line, or "" if there is none
+const char *multiboot_cmdline(void) {
+    struct multiboot_tag_string *tag =
+        (struct multiboot_tag_string *)multiboot_find_tag(MULTIBOOT_TAG_TYPE_CMDLINE);
+    return (tag != NULL) ? tag->string : "";
+}
+
+// Returns the first address past the end of contiguous RAM above 1 MB
+uint32_t multiboot_memory_top(void) {
+    struct multiboot_tag_basic_meminfo *meminfo =
+        (struct multiboot_tag_basic_meminfo *)multiboot_find_tag(MULTIBOOT_TAG_TYPE_BASIC_MEMINFO);
+
+    if (meminfo == NULL) {
+        return DEFAULT_MEMORY_TOP;
+    }
+    return 0x100000 + meminfo->mem_upper * 1024;
+}
+
+/*
+ * multiboot_ram_range - Finds the index'th range of usable RAM
+ *
+ * Unlike multiboot_memory_top this covers the whole memory map, including
+ * RAM above the PCI hole and above 4 GB.
+ *
+ * Returns: 0 with [*start, *end) filled in, or -1 if there are no more
+ */
+int multiboot_ram_range(unsigned int index, uint64_t *start, uint64_t *end) {
+    struct multiboot_tag_mmap *mmap =
+        (struct multiboot_tag_mmap *)multiboot_find_tag(MULTIBOOT_TAG_TYPE_MMAP);
+    if (mmap == NULL || mmap->entry_size == 0) {
+        return -1;
+    }
+
+    uint32_t pos = (uint32_t)mmap + sizeof(*mmap);
+    uint32_t limit = (uint32_t)mmap + mmap->size;
+    for (; pos + sizeof(struct multiboot_mmap_entry) <= limit; pos += mmap->entry_size) {
+        struct multiboot_mmap_entry *e = (struct multiboot_mmap_entry *)pos;
+        if (e->type != MULTIBOOT_MEMORY_AVAILABLE || e->len == 0) {
+            continue;
+        }
+        if (index-- == 0) {
+            *start = e->addr;
+            *end = e->addr + e->len;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+uint32_t multiboot_info_start(void) {
+    return mbi;
+}
+
+uint32_t multiboot_info_end(void) {
+    if (mbi == 0) {
+        return 0;
+    }
+    // The first word of the info structure is its total size
+    return mbi + *(uint32_t *)mbi;
+}
@@ -0,0 +1,73 @@
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+#include <stdint.h>
+
+#define MULTIBOOT2_BOOTLOADER_MAGIC     0x36d76289
+
+// Tag types in the multiboot2 information structure
+#define MULTIBOOT_TAG_TYPE_END          0
+#define MULTIBOOT_TAG_TYPE_CMDLINE      1
+#define MULTIBOOT_TAG_TYPE_MODULE       3
+#define MULTIBOOT_TAG_TYPE_BASIC_MEMINFO 4
+#define MULTIBOOT_TAG_TYPE_MMAP         6
+
+struct multiboot_tag {
+    uint32_t type;
+    uint32_t size;
+};
+
+// The rest of the multiboot2 line in grub.cfg
+struct multiboot_tag_string {
+    uint32_t type;
+    uint32_t size;
+    char string[];
+};
+
+// A file GRUB loaded for us (module2 in grub.cfg)
+struct multiboot_tag_module {
+    uint32_t type;
+    uint32_t size;
+    uint32_t mod_start;     // Physical address of the first byte
+    uint32_t mod_end;       // Physical address just past the last byte
+    char cmdline[];         // The rest of the module2 line
+};
+
+// The BIOS memory map (tag type 6): entry_size bytes per entry
+struct multiboot_tag_mmap {
+    uint32_t type;
+    uint32_t size;
+    uint32_t entry_size;
+    uint32_t entry_version;
+};
+
+struct multiboot_mmap_entry {
+    uint64_t addr;
+    uint64_t len;
+    uint32_t type;          // MULTIBOOT_MEMORY_AVAILABLE for usable RAM
+    uint32_t reserved;
+};
+
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+
+struct multiboot_tag_basic_meminfo {
+    uint32_t type;
+    uint32_t size;
+    uint32_t mem_lower;     // KB of memory below 1 MB
+    uint32_t mem_upper;     // KB of memory above 1 MB
+};
+
+/*
+ * Function declarations
+ */
+int multiboot_init(uint32_t magic, uint32_t mbi_addr);
+struct multiboot_tag *multiboot_find_tag(uint32_t type);
+struct multiboot_tag *multiboot_next_tag(struct multiboot_tag *prev, uint32_t type);
+struct multiboot_tag_module *multiboot_find_module(const char *cmdline);
+const char *multiboot_cmdline(void);
+uint32_t multiboot_memory_top(void);
+int multiboot_ram_range(unsigned int index, uint64_t *start, uint64_t *end);
+uint32_t multiboot_info_start(void);
+uint32_t multiboot_info_end(void);
+
+#endif
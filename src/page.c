@@ -1,11 +1,87 @@
 #include "page.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "smp.h"
+#include "rprintf.h"
+#include "atomic.h"
+#include "string.h"
 #include <stddef.h>  // for NULL
 
-// Array of 128 pages (128 *2MB) = 256MB of memory)
-struct ppage physical_page_array[128];
+extern int putc(int c);
+
+// Reserved by the linker script: everything up to here belongs to the kernel
+extern char _end_kernel;
+
+// One entry per 4 KB frame of physical memory (up to MAX_PHYSICAL_MEMORY)
+struct ppage physical_page_array[MAX_PHYSICAL_PAGES];
+unsigned int num_physical_pages = 0;
 
 // Head of the free list
 struct ppage *free_list = NULL;
+unsigned int free_count = 0;
+
+// Protects free_list, free_count and the PPAGE_FREE flags. Taken with
+// interrupts disabled since frames may be freed from interrupt context.
+static struct spinlock pfa_lock = SPINLOCK_INIT("pfa");
+
+/*
+ * Per-CPU hot lists of free frames in front of the global free list.
+ * Single frame allocations and frees only touch the local list, with
+ * interrupts disabled and no lock. The lists are refilled from and drained
+ * to the global pool PCP_BATCH frames at a time under pfa_lock.
+ * Frames sitting in a cache are not marked PPAGE_FREE.
+ */
+#define PCP_BATCH 16
+#define PCP_HIGH  64    // Drain once a cache holds more than this
+
+struct frame_cache {
+  struct ppage *list;
+  unsigned int count;
+  uint32_t alloc_hits;      // Allocations served without the global lock
+  uint32_t alloc_misses;    // Allocations that had to refill first
+  uint32_t free_hits;       // Frees that only touched the local list
+  uint32_t refills;
+  uint32_t drains;
+};
+
+static struct frame_cache frame_caches[MAX_CPUS];
+
+/*
+ * Frames cleared ahead of time by idle CPUs, for PFA_ZERO allocations.
+ * Like cached frames they are off the free list and not PPAGE_FREE.
+ * Protected by pfa_lock.
+ */
+static struct ppage *zero_pool = NULL;
+static unsigned int zero_pool_count = 0;
+static uint32_t zero_hits = 0;          // PFA_ZERO served from the pool
+static volatile uint32_t zero_misses = 0;   // PFA_ZERO that cleared a frame itself, atomic
+static uint32_t zeroed_in_idle = 0;
+
+/*
+ * Highmem: RAM past the identity map, including anything above 4 GB with
+ * PAE. Its descriptors cover pfns highmem_start to highmem_end (holes
+ * included) and are carved out of lowmem at boot. Only mappings reach
+ * these frames, so they go to callers that ask with PFA_HIGHMEM. They
+ * have their own free list, protected by pfa_lock.
+ */
+static struct ppage *highmem_pages = NULL;
+static uint32_t highmem_start = 0;
+static uint32_t highmem_end = 0;
+static struct ppage *highmem_list = NULL;
+static unsigned int highmem_free = 0;
+static unsigned int highmem_total = 0;
+
+static void clear_frame(struct ppage *page){
+  if (!(page->flags & PPAGE_HIGHMEM)){
+    memset(page->physical_addr, 0, PAGE_SIZE);    // Lowmem is identity mapped
+    return;
+  }
+  uint32_t flags = irq_save();
+  void *vaddr = kmap_atomic(page, KMAP_DST);
+  memset(vaddr, 0, PAGE_SIZE);
+  kunmap_atomic(vaddr);
+  irq_restore(flags);
+}
 
 // Remove a node from whatever list it's in
 void list_remove(struct ppage *node){
@@ -53,37 +129,347 @@ void list_append(struct ppage **head, struct ppage *list_to_add){
   }
 }
 
+// Take a specific frame off the free list
+static void free_list_take(struct ppage *page){
+  if (free_list == page){
+    free_list = page->next;
+  }
+  list_remove(page);
+  page->flags &= ~PPAGE_FREE;
+  free_count--;
+}
+
+/*
+ * init_pfa_list - Builds the free list from physical memory
+ *
+ * mem_top: First address past the end of usable RAM
+ *
+ * Frames below 1 MB (BIOS data, VGA memory) and frames holding the kernel
+ * image are never put on the free list.
+ */
+void init_pfa_list(uint32_t mem_top){
+  uint32_t kernel_end = ((uint32_t)&_end_kernel + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
 
-void init_pfa_list(void){
   // Start with an empty free list
   free_list = NULL;
+  free_count = 0;
+
+  num_physical_pages = mem_top / PAGE_SIZE;
+  if (num_physical_pages > MAX_PHYSICAL_PAGES){
+    num_physical_pages = MAX_PHYSICAL_PAGES;
+  }
+
+  // Initialize each page in the array. Clearing it in one go leaves
+  // every frame unlinked, unflagged and unreferenced.
+  memset(physical_page_array, 0, num_physical_pages * sizeof(struct ppage));
+  for (unsigned int i = 0; i < num_physical_pages; i++){
+    uint32_t addr = i * PAGE_SIZE;
+    physical_page_array[i].physical_addr = (void *)addr;
 
-  // Initialize each page in the array
-  for (int i = 0; i < 128; i++){
-    //  Calculate the physical address for this page
-    // Each page is 2 MB or 0x200000 bytes
-    physical_page_array[i].physical_addr = (void *)(i * 0x200000);
+    if (addr < kernel_end){
+      continue;
+    }
 
     // Add this page to the free list
+    physical_page_array[i].flags = PPAGE_FREE;
     list_add_front(&free_list, &physical_page_array[i]);
+    free_count++;
+  }
+}
+
+/*
+ * pfa_init_highmem - Make room to track RAM beyond the identity map
+ *
+ * end_pfn: First frame number past the highest RAM, from the memory map
+ *
+ * The descriptors come from contiguous lowmem, so the range is trimmed
+ * to what a quarter of the free lowmem can describe. Frames only become
+ * usable once pfa_add_highmem reports them as RAM.
+ *
+ * Returns: 0 if there is highmem to add, -1 otherwise
+ */
+int pfa_init_highmem(uint32_t end_pfn){
+  if (end_pfn > MAX_PFN){
+    end_pfn = MAX_PFN;
+  }
+  if (end_pfn <= num_physical_pages){
+    return -1;
+  }
+
+  unsigned int limit = (free_count / 4) * (PAGE_SIZE / sizeof(struct ppage));
+  if (end_pfn - num_physical_pages > limit){
+    end_pfn = num_physical_pages + limit;
+  }
+  unsigned int frames = ((end_pfn - num_physical_pages) * sizeof(struct ppage) + PAGE_SIZE - 1) / PAGE_SIZE;
+  struct ppage *array = allocate_contiguous_pages(frames);
+  if (array == NULL){
+    return -1;
+  }
+
+  highmem_pages = array->physical_addr;
+  highmem_start = num_physical_pages;
+  memset(highmem_pages, 0, (end_pfn - highmem_start) * sizeof(struct ppage));
+  highmem_end = end_pfn;
+  return 0;
+}
+
+// Put the highmem frames in [start_pfn, end_pfn) on the free list
+void pfa_add_highmem(uint32_t start_pfn, uint32_t end_pfn){
+  if (start_pfn < highmem_start){
+    start_pfn = highmem_start;
+  }
+  if (end_pfn > highmem_end){
+    end_pfn = highmem_end;
+  }
+
+  uint32_t flags = spin_lock_irqsave(&pfa_lock);
+  for (uint32_t pfn = start_pfn; pfn < end_pfn; pfn++){
+    struct ppage *page = &highmem_pages[pfn - highmem_start];
+    if (page->flags & PPAGE_HIGHMEM){
+      continue;     // Overlapping memory map entries
+    }
+    page->flags = PPAGE_HIGHMEM | PPAGE_FREE;
+    list_add_front(&highmem_list, page);
+    highmem_free++;
+    highmem_total++;
+  }
+  spin_unlock_irqrestore(&pfa_lock, flags);
+}
+
+static struct ppage *highmem_take(void){
+  uint32_t flags = spin_lock_irqsave(&pfa_lock);
+  struct ppage *page = highmem_list;
+  if (page != NULL){
+    highmem_list = page->next;
+    list_remove(page);
+    page->flags &= ~PPAGE_FREE;
+    page->refcount = 1;
+    highmem_free--;
+  }
+  spin_unlock_irqrestore(&pfa_lock, flags);
+  return page;
+}
+
+static void highmem_give(struct ppage *page){
+  uint32_t flags = spin_lock_irqsave(&pfa_lock);
+  page->refcount = 0;
+  page->flags |= PPAGE_FREE;
+  list_add_front(&highmem_list, page);
+  highmem_free++;
+  spin_unlock_irqrestore(&pfa_lock, flags);
+}
+
+// Mark a physical range (e.g. the multiboot info) as in use
+void pfa_reserve_range(uint32_t start, uint32_t end){
+  uint32_t flags = spin_lock_irqsave(&pfa_lock);
+  for (uint32_t addr = start & ~(PAGE_SIZE - 1); addr < end; addr += PAGE_SIZE){
+    struct ppage *page = phys_to_ppage((void *)addr);
+    if (page != NULL && (page->flags & PPAGE_FREE)){
+      free_list_take(page);
+    }
+  }
+  spin_unlock_irqrestore(&pfa_lock, flags);
+}
+
+// Move up to PCP_BATCH frames from the global free list into a cache
+static void frame_cache_refill(struct frame_cache *cache){
+  spin_lock(&pfa_lock);
+  for (int i = 0; i < PCP_BATCH && free_list != NULL; i++){
+    struct ppage *page = free_list;
+    free_list_take(page);
+    page->next = cache->list;
+    cache->list = page;
+    cache->count++;
+  }
+  spin_unlock(&pfa_lock);
+  cache->refills++;
+}
+
+// Return up to count frames from a cache to the global free list
+static void frame_cache_drain(struct frame_cache *cache, unsigned int count){
+  spin_lock(&pfa_lock);
+  for (unsigned int i = 0; i < count && cache->list != NULL; i++){
+    struct ppage *page = cache->list;
+    cache->list = page->next;
+    cache->count--;
+    page->flags |= PPAGE_FREE;
+    list_add_front(&free_list, page);
+    free_count++;
+  }
+  spin_unlock(&pfa_lock);
+  cache->drains++;
+}
+
+// Single frame allocation: served from this CPU's cache
+static struct ppage *allocate_cached_page(void){
+  uint32_t flags = irq_save();
+  struct frame_cache *cache = &frame_caches[this_cpu()->id];
+
+  if (cache->list == NULL){
+    cache->alloc_misses++;
+    frame_cache_refill(cache);
+    if (cache->list == NULL){
+      irq_restore(flags);
+      return NULL;
+    }
+  } else {
+    cache->alloc_hits++;
+  }
+
+  struct ppage *page = cache->list;
+  cache->list = page->next;
+  cache->count--;
+  irq_restore(flags);
+
+  page->next = NULL;
+  page->prev = NULL;
+  page->refcount = 1;
+  return page;
+}
+
+static void free_cached_page(struct ppage *page){
+  uint32_t flags = irq_save();
+  struct frame_cache *cache = &frame_caches[this_cpu()->id];
+
+  page->flags &= ~PPAGE_FREE;
+  page->refcount = 0;
+  page->prev = NULL;
+  page->next = cache->list;
+  cache->list = page;
+  cache->count++;
+  cache->free_hits++;
+
+  if (cache->count > PCP_HIGH){
+    frame_cache_drain(cache, PCP_BATCH);
+  }
+  irq_restore(flags);
+}
+
+static struct ppage *zero_pool_take(void){
+  uint32_t flags = spin_lock_irqsave(&pfa_lock);
+  struct ppage *page = zero_pool;
+  if (page != NULL){
+    zero_pool = page->next;
+    zero_pool_count--;
+    zero_hits++;
+  }
+  spin_unlock_irqrestore(&pfa_lock, flags);
+
+  if (page != NULL){
+    page->next = NULL;
+    page->prev = NULL;
+    page->refcount = 1;
+  }
+  return page;
+}
+
+/*
+ * allocate_page - Allocate a single frame
+ *
+ * alloc_flags: PFA_ZERO to get a frame full of zeroes. Those come from
+ * the pool the idle loop fills, and are only cleared here when it's empty.
+ * Other allocations fall back on the pool when memory is otherwise gone.
+ * PFA_HIGHMEM lets the frame come from highmem, which is used first to
+ * keep lowmem for page tables, stacks and DMA buffers. A PFA_ZERO
+ * allocation still prefers the pool, so the clearing stays off its path.
+ *
+ * Returns: The frame, or NULL if out of memory
+ */
+struct ppage *allocate_page(uint32_t alloc_flags){
+  struct ppage *page;
+
+  if (alloc_flags & PFA_ZERO){
+    page = zero_pool_take();
+    if (page != NULL){
+      return page;
+    }
+  }
+
+  if ((alloc_flags & PFA_HIGHMEM) && highmem_free > 0){
+    page = highmem_take();
+    if (page != NULL){
+      if (alloc_flags & PFA_ZERO){
+        xadd(&zero_misses, 1);
+        clear_frame(page);
+      }
+      return page;
+    }
+  }
+
+  if (alloc_flags & PFA_ZERO){
+    page = allocate_cached_page();
+    if (page != NULL){
+      xadd(&zero_misses, 1);
+      clear_frame(page);
+    }
+    return page;
+  }
+
+  page = allocate_cached_page();
+  if (page == NULL){
+    page = zero_pool_take();
+  }
+  return page;
+}
+
+/*
+ * pfa_zero_idle - Clear a few free frames into the zero pool
+ *
+ * Called from the idle loop. Frames are cleared with interrupts on and
+ * no lock held, so a thread becoming runnable preempts us right away.
+ *
+ * Returns: The number of frames cleared, 0 once the pool is full
+ */
+int pfa_zero_idle(void){
+  int done = 0;
+
+  while (done < 8){
+    uint32_t flags = spin_lock_irqsave(&pfa_lock);
+    if (zero_pool_count >= ZERO_POOL_TARGET || free_list == NULL){
+      spin_unlock_irqrestore(&pfa_lock, flags);
+      break;
+    }
+    struct ppage *page = free_list;
+    free_list_take(page);
+    zero_pool_count++;          // Reserve our slot in the pool
+    spin_unlock_irqrestore(&pfa_lock, flags);
+
+    clear_frame(page);
+
+    flags = spin_lock_irqsave(&pfa_lock);
+    page->next = zero_pool;
+    zero_pool = page;
+    zeroed_in_idle++;
+    spin_unlock_irqrestore(&pfa_lock, flags);
+    done++;
+  }
+  return done;
+}
+
+// Give this CPU's cached frames back, e.g. before a contiguous allocation
+void pfa_drain_local_cache(void){
+  uint32_t flags = irq_save();
+  struct frame_cache *cache = &frame_caches[this_cpu()->id];
+  if (cache->count > 0){
+    frame_cache_drain(cache, cache->count);
   }
+  irq_restore(flags);
 }
 
 struct ppage *allocate_physical_pages(unsigned int npages){
   if (npages == 0){
     return NULL;
   }
-
-  // Check if we have enough free pages
-  struct ppage *current = free_list;
-  unsigned int count = 0;
-  while (current != NULL && count < npages){
-    count++;
-    current = current->next;
+  if (npages == 1){
+    return allocate_cached_page();
   }
 
-  if (count < npages){
+  uint32_t flags = spin_lock_irqsave(&pfa_lock);
+
+  // Check if we have enough free pages
+  if (free_count < npages){
     // Not enough free pages available
+    spin_unlock_irqrestore(&pfa_lock, flags);
     return NULL;
   }
 
@@ -97,6 +483,8 @@ struct ppage *allocate_physical_pages(unsigned int npages){
     if (free_list != NULL){
       free_list->prev = NULL;
     }
+    page->flags &= ~PPAGE_FREE;
+    page->refcount = 1;
 
     // Add it to the allocated list
     page->next = allocated_list;
@@ -106,19 +494,89 @@ struct ppage *allocate_physical_pages(unsigned int npages){
     }
     allocated_list = page;
   }
+  free_count -= npages;
+  spin_unlock_irqrestore(&pfa_lock, flags);
 
   return allocated_list;
 }
 
+/*
+ * allocate_contiguous_pages - Allocates physically contiguous frames
+ *
+ * Used for things that must not cross a frame boundary, like kernel stacks.
+ * This scans the frame array, so keep it off hot paths.
+ *
+ * Returns: List of npages frames in ascending address order, or NULL
+ */
+static struct ppage *find_contiguous_pages(unsigned int npages){
+  uint32_t flags = spin_lock_irqsave(&pfa_lock);
+  unsigned int run = 0;
+  for (unsigned int i = 0; i < num_physical_pages; i++){
+    if (!(physical_page_array[i].flags & PPAGE_FREE)){
+      run = 0;
+      continue;
+    }
+    if (++run < npages){
+      continue;
+    }
+
+    // Found a run ending at i: take it off the free list and chain it in order
+    unsigned int first = i + 1 - npages;
+    for (unsigned int j = first; j <= i; j++){
+      free_list_take(&physical_page_array[j]);
+    }
+    for (unsigned int j = first; j <= i; j++){
+      physical_page_array[j].refcount = 1;
+      physical_page_array[j].prev = (j == first) ? NULL : &physical_page_array[j - 1];
+      physical_page_array[j].next = (j == i) ? NULL : &physical_page_array[j + 1];
+    }
+    spin_unlock_irqrestore(&pfa_lock, flags);
+    return &physical_page_array[first];
+  }
+
+  spin_unlock_irqrestore(&pfa_lock, flags);
+  return NULL;
+}
+
+struct ppage *allocate_contiguous_pages(unsigned int npages){
+  if (npages == 0){
+    return NULL;
+  }
+
+  struct ppage *pages = find_contiguous_pages(npages);
+  if (pages == NULL){
+    // Frames parked in our cache may be what breaks up the run
+    pfa_drain_local_cache();
+    pages = find_contiguous_pages(npages);
+  }
+  return pages;
+}
+
 void free_physical_pages(struct ppage *ppage_list){
   if (ppage_list == NULL){
     return;
   }
+  if (ppage_list->flags & PPAGE_HIGHMEM){
+    highmem_give(ppage_list);     // Always allocated one at a time
+    return;
+  }
+  if (ppage_list->next == NULL){
+    free_cached_page(ppage_list);
+    return;
+  }
+
+  uint32_t flags = spin_lock_irqsave(&pfa_lock);
 
    // Find the end of the list being free
   struct ppage *tail = ppage_list;
+  tail->flags |= PPAGE_FREE;
+  tail->refcount = 0;
+  free_count++;
   while (tail->next != NULL){
     tail = tail->next;
+    tail->flags |= PPAGE_FREE;
+    tail->refcount = 0;
+    free_count++;
   }
 
   // Append the free list to the end of the list being returned
@@ -129,4 +587,86 @@ void free_physical_pages(struct ppage *ppage_list){
 
   // The freed list becomes the new free list
   free_list = ppage_list;
+  spin_unlock_irqrestore(&pfa_lock, flags);
+}
+
+// Look up the frame descriptor for an identity mapped (lowmem) address
+struct ppage *phys_to_ppage(void *physical_addr){
+  uint32_t index = (uint32_t)physical_addr / PAGE_SIZE;
+  if (index >= num_physical_pages){
+    return NULL;
+  }
+  return &physical_page_array[index];
+}
+
+// Look up the frame descriptor for any frame number, lowmem or highmem
+struct ppage *pfn_to_ppage(uint32_t pfn){
+  if (pfn < num_physical_pages){
+    return &physical_page_array[pfn];
+  }
+  if (pfn >= highmem_start && pfn < highmem_end){
+    return &highmem_pages[pfn - highmem_start];
+  }
+  return NULL;
+}
+
+uint32_t ppage_pfn(struct ppage *page){
+  if (page->flags & PPAGE_HIGHMEM){
+    return highmem_start + (page - highmem_pages);
+  }
+  return page - physical_page_array;
+}
+
+phys_addr_t ppage_phys(struct ppage *page){
+  return (phys_addr_t)ppage_pfn(page) << 12;
+}
+
+// Take another reference to an allocated frame, e.g. for a shared mapping
+void get_page(struct ppage *page){
+  xadd(&page->refcount, 1);
+}
+
+/*
+ * put_page - Drop a reference to a frame, freeing it with the last one
+ *
+ * Unlike free_physical_pages this handles a single frame even if it was
+ * allocated as part of a list: its links are cleared first.
+ */
+void put_page(struct ppage *page){
+  if (xadd(&page->refcount, -1) == 1){
+    page->next = NULL;
+    page->prev = NULL;
+    free_physical_pages(page);
+  }
+}
+
+// Free frames, including those parked in per-CPU caches and highmem
+unsigned int pfa_free_count(void){
+  unsigned int count = free_count + zero_pool_count + highmem_free;
+  for (int i = 0; i < MAX_CPUS; i++){
+    count += frame_caches[i].count;
+  }
+  return count;
+}
+
+void pfa_stats_dump(void){
+  esp_printf(putc, "%-4s %6s %8s %8s %8s %7s %7s\r\n",
+             "cpu", "cached", "hits", "misses", "freehits", "refills", "drains");
+  for (int i = 0; i < num_cpus; i++){
+    struct frame_cache *c = &frame_caches[i];
+    uint32_t allocs = c->alloc_hits + c->alloc_misses;
+    esp_printf(putc, "%-4d %6d %8d %8d %8d %7d %7d", i, c->count, c->alloc_hits,
+               c->alloc_misses, c->free_hits, c->refills, c->drains);
+    if (allocs > 0){
+      esp_printf(putc, "  (%d%% fast path)", c->alloc_hits * 100 / allocs);
+    }
+    esp_printf(putc, "\r\n");
+  }
+  esp_printf(putc, "%d frames free in the global pool\r\n", free_count);
+  if (highmem_total > 0){
+    esp_printf(putc, "Highmem: %d of %d frames free (%d MB)\r\n",
+               highmem_free, highmem_total, highmem_total / 256);
+  }
+  esp_printf(putc, "Zero pool: %d frames ready, %d zeroed while idle, %d hits, %d misses\r\n",
+             zero_pool_count, zeroed_in_idle, zero_hits, zero_misses);
 }
@@ -1,14 +1,59 @@
 #ifndef PAGE_H
 #define PAGE_H
 
+#include <stdint.h>
+
+#define PAGE_SIZE 0x1000
+
+// Largest amount of physical memory that is identity mapped ("lowmem").
+// RAM above it is managed as highmem, reached only through mappings.
+#define MAX_PHYSICAL_MEMORY 0x10000000  // 256 MB
+#define MAX_PHYSICAL_PAGES (MAX_PHYSICAL_MEMORY / PAGE_SIZE)
+
+// Physical addresses outgrow pointers with PAE, which reaches 64 GB
+#ifdef CONFIG_PAE
+typedef uint64_t phys_addr_t;
+#define MAX_PFN 0x1000000
+#else
+typedef uint32_t phys_addr_t;
+#define MAX_PFN 0x100000
+#endif
+
+// ppage flags
+#define PPAGE_FREE      0x1   // Frame is on the free list
+#define PPAGE_HIGHMEM   0x2   // Not identity mapped: physical_addr is NULL
+
+// Flags for allocate_page
+#define PFA_ZERO        0x1   // Frame must be filled with zeroes
+#define PFA_HIGHMEM     0x2   // Frame may be highmem; use kmap_atomic to touch it
+
+#define ZERO_POOL_TARGET 128  // Frames the idle loop keeps zeroed in advance
+
 struct ppage{
   struct ppage *next;
   struct ppage *prev;
-  void *physical_addr;
+  void *physical_addr;          // Identity mapped address, for lowmem frames
+  uint32_t flags;
+  volatile uint32_t refcount;   // Mappings/users of the frame; 1 when allocated
 };
 
-void init_pfa_list(void);
+void init_pfa_list(uint32_t mem_top);
+int pfa_init_highmem(uint32_t end_pfn);
+void pfa_add_highmem(uint32_t start_pfn, uint32_t end_pfn);
+void pfa_reserve_range(uint32_t start, uint32_t end);
 struct ppage *allocate_physical_pages(unsigned int npages);
+struct ppage *allocate_contiguous_pages(unsigned int npages);
+struct ppage *allocate_page(uint32_t alloc_flags);
+int pfa_zero_idle(void);
 void free_physical_pages(struct ppage *ppage_list);
+struct ppage *phys_to_ppage(void *physical_addr);
+struct ppage *pfn_to_ppage(uint32_t pfn);
+uint32_t ppage_pfn(struct ppage *page);
+phys_addr_t ppage_phys(struct ppage *page);
+void get_page(struct ppage *page);
+void put_page(struct ppage *page);
+unsigned int pfa_free_count(void);
+void pfa_drain_local_cache(void);
+void pfa_stats_dump(void);
 
 #endif
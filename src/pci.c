@@ -0,0 +1,123 @@
+#include "pci.h"
+#include "io.h"
+#include "rprintf.h"
+#include <stddef.h>
+
+extern int putc(int c);
+
+// Functions found by pci_init
+static struct pci_device pci_devices[MAX_PCI_DEVICES];
+static int num_pci_devices = 0;
+
+// Configuration mechanism #1: select bus/slot/function/register, then
+// access the dword through the data port
+static uint32_t config_address(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset) {
+    return 0x80000000 | ((uint32_t)bus << 16) | ((uint32_t)slot << 11) |
+           ((uint32_t)func << 8) | (offset & 0xFC);
+}
+
+static uint32_t config_read(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset) {
+    outl(PCI_CONFIG_ADDRESS, config_address(bus, slot, func, offset));
+    return inl(PCI_CONFIG_DATA);
+}
+
+uint32_t pci_config_read32(struct pci_device *dev, uint8_t offset) {
+    return config_read(dev->bus, dev->slot, dev->func, offset);
+}
+
+uint16_t pci_config_read16(struct pci_device *dev, uint8_t offset) {
+    return pci_config_read32(dev, offset) >> ((offset & 2) * 8);
+}
+
+void pci_config_write32(struct pci_device *dev, uint8_t offset, uint32_t val) {
+    outl(PCI_CONFIG_ADDRESS, config_address(dev->bus, dev->slot, dev->func, offset));
+    outl(PCI_CONFIG_DATA, val);
+}
+
+void pci_config_write16(struct pci_device *dev, uint8_t offset, uint16_t val) {
+    uint32_t shift = (offset & 2) * 8;
+    uint32_t dword = pci_config_read32(dev, offset);
+    dword = (dword & ~(0xFFFF << shift)) | ((uint32_t)val << shift);
+    pci_config_write32(dev, offset, dword);
+}
+
+// Turn on I/O decoding, memory decoding and/or bus mastering
+void pci_enable(struct pci_device *dev, uint16_t command_bits) {
+    uint16_t command = pci_config_read16(dev, PCI_COMMAND);
+    pci_config_write16(dev, PCI_COMMAND, command | command_bits);
+}
+
+static void add_device(uint8_t bus, uint8_t slot, uint8_t func, uint32_t id) {
+    if (num_pci_devices == MAX_PCI_DEVICES) {
+        return;
+    }
+
+    struct pci_device *dev = &pci_devices[num_pci_devices++];
+    dev->bus = bus;
+    dev->slot = slot;
+    dev->func = func;
+    dev->vendor_id = id & 0xFFFF;
+    dev->device_id = id >> 16;
+
+    uint32_t class = pci_config_read32(dev, PCI_CLASS_REVISION);
+    dev->class_code = class >> 24;
+    dev->subclass = (class >> 16) & 0xFF;
+    dev->prog_if = (class >> 8) & 0xFF;
+    dev->irq_line = pci_config_read32(dev, PCI_INTERRUPT_LINE) & 0xFF;
+    for (int i = 0; i < 6; i++) {
+        dev->bar[i] = pci_config_read32(dev, PCI_BAR0 + 4 * i);
+    }
+
+    esp_printf(putc, "PCI %d:%d.%d %x:%x class %x:%x irq %d\r\n", bus, slot, func,
+               dev->vendor_id, dev->device_id, dev->class_code, dev->subclass, dev->irq_line);
+}
+
+/*
+ * pci_init - Enumerate every function on every bus
+ *
+ * A brute force scan: a vendor ID of 0xFFFF means nothing answered. Only
+ * function 0 is probed on single function devices.
+ */
+void pci_init(void) {
+    num_pci_devices = 0;
+    for (int bus = 0; bus < 256; bus++) {
+        for (int slot = 0; slot < 32; slot++) {
+            uint32_t id = config_read(bus, slot, 0, PCI_VENDOR_ID);
+            if ((id & 0xFFFF) == 0xFFFF) {
+                continue;
+            }
+            add_device(bus, slot, 0, id);
+
+            uint8_t header = config_read(bus, slot, 0, PCI_HEADER_TYPE & 0xFC) >> 16;
+            if (!(header & 0x80)) {
+                continue;       // Not multifunction
+            }
+            for (int func = 1; func < 8; func++) {
+                id = config_read(bus, slot, func, PCI_VENDOR_ID);
+                if ((id & 0xFFFF) != 0xFFFF) {
+                    add_device(bus, slot, func, id);
+                }
+            }
+        }
+    }
+    esp_printf(putc, "PCI: %d functions\r\n", num_pci_devices);
+}
+
+struct pci_device *pci_find_device(uint16_t vendor_id, uint16_t device_id) {
+    for (int i = 0; i < num_pci_devices; i++) {
+        if (pci_devices[i].vendor_id == vendor_id && pci_devices[i].device_id == device_id) {
+            return &pci_devices[i];
+        }
+    }
+    return NULL;
+}
+
+struct pci_device *pci_find_class(uint8_t class_code, uint8_t subclass, uint8_t prog_if) {
+    for (int i = 0; i < num_pci_devices; i++) {
+        struct pci_device *dev = &pci_devices[i];
+        if (dev->class_code == class_code && dev->subclass == subclass && dev->prog_if == prog_if) {
+            return dev;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,51 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include <stdint.h>
+
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA    0xCFC
+
+// Configuration space registers
+#define PCI_VENDOR_ID      0x00
+#define PCI_DEVICE_ID      0x02
+#define PCI_COMMAND        0x04
+#define PCI_CLASS_REVISION 0x08
+#define PCI_HEADER_TYPE    0x0E
+#define PCI_BAR0           0x10
+#define PCI_INTERRUPT_LINE 0x3C
+
+#define PCI_COMMAND_IO          0x1
+#define PCI_COMMAND_MEMORY      0x2
+#define PCI_COMMAND_BUS_MASTER  0x4
+
+#define PCI_BAR_IO         0x1      // Bit 0 of a BAR: I/O space rather than memory
+
+#define MAX_PCI_DEVICES 32
+
+struct pci_device {
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t func;
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint8_t class_code;
+    uint8_t subclass;
+    uint8_t prog_if;
+    uint8_t irq_line;
+    uint32_t bar[6];
+};
+
+/*
+ * Function declarations
+ */
+void pci_init(void);
+uint32_t pci_config_read32(struct pci_device *dev, uint8_t offset);
+uint16_t pci_config_read16(struct pci_device *dev, uint8_t offset);
+void pci_config_write32(struct pci_device *dev, uint8_t offset, uint32_t val);
+void pci_config_write16(struct pci_device *dev, uint8_t offset, uint16_t val);
+struct pci_device *pci_find_device(uint16_t vendor_id, uint16_t device_id);
+struct pci_device *pci_find_class(uint8_t class_code, uint8_t subclass, uint8_t prog_if);
+void pci_enable(struct pci_device *dev, uint16_t command_bits);
+
+#endif
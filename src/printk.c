@@ -0,0 +1,204 @@
+#include "printk.h"
+#include "atomic.h"
+#include "timer.h"
+#include "smp.h"
+#include "string.h"
+#include <stdarg.h>
+
+extern int putc(int c);
+
+/*
+ * The kernel log. Producers on any CPU, in any context, claim a sequence
+ * number with one atomic add and format straight into that slot of the
+ * ring, so logging costs a formatted copy into memory and never waits for
+ * the console. A single flusher at a time (the idle loop, or a caller
+ * that needs the output now) renders complete records in order. When
+ * producers lap the flusher the oldest records are overwritten and
+ * counted as dropped.
+ */
+static struct log_record ring[LOG_RECORDS];
+static volatile uint32_t log_head = 0;      // Next sequence number to hand out
+static uint32_t log_tail = 0;               // Next to render, owned by the flusher
+static volatile uint32_t flushing = 0;
+
+// Filters, changeable at any time
+static volatile int log_level = LOG_INFO;
+static volatile uint32_t log_mask = LOG_ALL;
+
+static volatile uint32_t filtered = 0;
+static uint32_t rendered = 0;
+static uint32_t dropped = 0;
+
+static const char *level_names[] = { "error: ", "warning: ", "", "" };
+
+static const char *subsys_name(int subsys) {
+    switch (subsys) {
+    case LOG_MM:    return "mm";
+    case LOG_FAT:   return "fat";
+    case LOG_BLK:   return "blk";
+    case LOG_SCHED: return "sched";
+    case LOG_USER:  return "user";
+    default:        return "kernel";
+    }
+}
+
+// Whether a record would be kept, to skip expensive argument set-up
+int klog_enabled(int level, int subsys) {
+    return level <= log_level && (subsys & log_mask) != 0;
+}
+
+void klog_set_level(int level) {
+    log_level = level;
+}
+
+void klog_set_mask(uint32_t mask) {
+    log_mask = mask;
+}
+
+static void vklog(int level, int subsys, charptr fmt, va_list args) {
+    if (!klog_enabled(level, subsys)) {
+        xadd(&filtered, 1);
+        return;
+    }
+
+    uint32_t seq = xadd(&log_head, 1);
+    struct log_record *r = &ring[seq & (LOG_RECORDS - 1)];
+    r->seq = 0;
+    barrier();
+    r->ticks = timer_ticks();
+    r->level = level;
+    r->subsys = subsys;
+    r->cpu = this_cpu()->id;
+    r->len = esp_vsnprintf(r->text, LOG_TEXT_MAX, fmt, args);
+    barrier();
+    r->seq = seq + 1;
+}
+
+/*
+ * klog - Add a message to the kernel log
+ *
+ * level: LOG_ERR to LOG_DEBUG
+ * subsys: One of the LOG_CORE... bits
+ * fmt: esp_printf format, without a trailing newline
+ *
+ * Safe from interrupt handlers and with locks held: nothing here blocks
+ * or touches the console.
+ */
+void klog(int level, int subsys, charptr fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vklog(level, subsys, fmt, args);
+    va_end(args);
+}
+
+// Informational message from the core kernel
+void printk(charptr ctrl, ...) {
+    va_list args;
+    va_start(args, ctrl);
+    vklog(LOG_INFO, LOG_CORE, ctrl, args);
+    va_end(args);
+}
+
+static void render(struct log_record *r) {
+    uint32_t ticks = r->ticks;
+    esp_printf(putc, "[%4d.%02d] %s: %s%s\r\n", ticks / HZ, ticks % HZ,
+               subsys_name(r->subsys), level_names[r->level & 3], r->text);
+}
+
+/*
+ * klog_flush - Render pending records to the console
+ *
+ * max: Most records to render, so the idle loop can do a little at a time
+ *
+ * Returns without doing anything if another CPU is already flushing.
+ * Stops early at a record that is still being written.
+ *
+ * Returns: The number of records rendered
+ */
+int klog_flush(int max) {
+    if (xchg(&flushing, 1) != 0) {
+        return 0;
+    }
+
+    int done = 0;
+    struct log_record copy;
+    while (done < max && log_tail != log_head) {
+        uint32_t head = log_head;
+        if (head - log_tail > LOG_RECORDS) {
+            dropped += head - LOG_RECORDS - log_tail;
+            log_tail = head - LOG_RECORDS;
+        }
+
+        struct log_record *r = &ring[log_tail & (LOG_RECORDS - 1)];
+        uint32_t seq = r->seq;
+        if (seq == 0 || seq < log_tail + 1) {
+            break;              // Claimed but not written yet
+        }
+        if (seq == log_tail + 1) {
+            copy = *r;
+            barrier();
+            if (r->seq == seq) {
+                render(&copy);
+                rendered++;
+                done++;
+                log_tail++;
+                continue;
+            }
+        }
+        dropped++;              // Overwritten by a newer record
+        log_tail++;
+    }
+
+    barrier();
+    flushing = 0;
+    return done;
+}
+
+// Read a decimal or 0x-prefixed number from the command line
+static uint32_t parse_number(const char *s) {
+    uint32_t value = 0;
+    if (s[0] == '0' && s[1] == 'x') {
+        for (s += 2; ; s++) {
+            if (*s >= '0' && *s <= '9') value = value * 16 + (*s - '0');
+            else if (*s >= 'a' && *s <= 'f') value = value * 16 + (*s - 'a' + 10);
+            else break;
+        }
+        return value;
+    }
+    for (; *s >= '0' && *s <= '9'; s++) {
+        value = value * 10 + (*s - '0');
+    }
+    return value;
+}
+
+/*
+ * printk_init - Set the filters from the kernel command line
+ *
+ * Understands loglevel=N (0 errors only, 3 everything), quiet (warnings
+ * and errors), debug, and logmask=0xNN to pick subsystems, so the log can
+ * be tuned from grub.cfg without rebuilding.
+ */
+void printk_init(const char *cmdline) {
+    while (cmdline != NULL && *cmdline != '\0') {
+        while (*cmdline == ' ') {
+            cmdline++;
+        }
+        if (strncmp(cmdline, "loglevel=", 9) == 0) {
+            log_level = parse_number(cmdline + 9);
+        } else if (strncmp(cmdline, "logmask=", 8) == 0) {
+            log_mask = parse_number(cmdline + 8);
+        } else if (strncmp(cmdline, "quiet", 5) == 0) {
+            log_level = LOG_WARN;
+        } else if (strncmp(cmdline, "debug", 5) == 0) {
+            log_level = LOG_DEBUG;
+        }
+        while (*cmdline != ' ' && *cmdline != '\0') {
+            cmdline++;
+        }
+    }
+}
+
+void klog_stats_dump(void) {
+    esp_printf(putc, "log: %d records, %d rendered, %d filtered, %d dropped, level %d, mask 0x%x\r\n",
+               log_head, rendered, filtered, dropped, log_level, log_mask);
+}
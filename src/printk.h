@@ -0,0 +1,50 @@
+#ifndef PRINTK_H
+#define PRINTK_H
+
+#include <stdint.h>
+#include "rprintf.h"
+
+// Severity levels. Records above the current level are dropped before
+// they are formatted.
+#define LOG_ERR   0
+#define LOG_WARN  1
+#define LOG_INFO  2
+#define LOG_DEBUG 3
+
+// Subsystems, as bits of the filter mask
+#define LOG_CORE  0x01
+#define LOG_MM    0x02
+#define LOG_FAT   0x04
+#define LOG_BLK   0x08
+#define LOG_SCHED 0x10
+#define LOG_USER  0x20
+#define LOG_ALL   0xFF
+
+#define LOG_RECORDS     256     // Ring size, a power of two
+#define LOG_TEXT_MAX    116     // Longer messages are truncated
+#define LOG_FLUSH_BATCH 8       // Records the idle loop renders per pass
+
+/*
+ * One message. seq is 0 while the record is being written and then the
+ * record's sequence number plus one, which is how the flusher knows it is
+ * complete and hasn't been overwritten.
+ */
+struct log_record {
+    volatile uint32_t seq;
+    uint32_t ticks;             // timer_ticks() when logged
+    uint8_t level;
+    uint8_t subsys;
+    uint8_t cpu;
+    uint8_t len;
+    char text[LOG_TEXT_MAX];    // No trailing newline
+};
+
+void printk_init(const char *cmdline);
+void klog(int level, int subsys, charptr fmt, ...);
+int klog_enabled(int level, int subsys);
+void klog_set_level(int level);
+void klog_set_mask(uint32_t mask);
+int klog_flush(int max);
+void klog_stats_dump(void);
+
+#endif
@@ -8,6 +8,7 @@
 /*---------------------------------------------------*/
 
 #include "rprintf.h"
+#include "string.h"
 /*---------------------------------------------------*/
 /* The purpose of this routine is to output data the */
 /* same as the standard printf function without the  */
@@ -16,21 +17,21 @@
 /* that is unacceptable in most embedded systems.    */
 /*---------------------------------------------------*/
 
-static func_ptr out_char;
-static int do_padding;
-static int left_flag;
-static int len;
-static int num1;
-static int num2;
-static char pad_character;
-
-size_t strlen(const char *str) {
-    unsigned int len = 0;
-    while(str[len] != '\0') {
-        len++;
-    }
-    return len;
-}
+/* Formatting state for one call. It used to be a  */
+/* set of statics, which made concurrent calls from  */
+/* different threads or CPUs corrupt each other.     */
+struct printf_state {
+   func_ptr out_char;     /* NULL when writing into buf */
+   char *buf;
+   size_t size;
+   size_t pos;
+   int do_padding;
+   int left_flag;
+   int len;
+   int num1;
+   int num2;
+   char pad_character;
+};
 
 int tolower(int c) {
     if(c < 'a') { // Check if c is uppercase
@@ -50,18 +51,32 @@ int isdig(int c) {
 
 
 
+/*---------------------------------------------------*/
+/*                                                   */
+/* Sends one character to the output function, or    */
+/* into the buffer while there is room for it and    */
+/* the terminating NUL.                              */
+/*                                                   */
+static void emit( struct printf_state *st, int c)
+{
+   if (st->out_char != NULL)
+      st->out_char( c);
+   else if (st->pos + 1 < st->size)
+      st->buf[st->pos++] = c;
+}
+
 /*---------------------------------------------------*/
 /*                                                   */
 /* This routine puts pad characters into the output  */
 /* buffer.                                           */
 /*                                                   */
-static void padding( const int l_flag)
+static void padding( struct printf_state *st, const int l_flag)
 {
    int i;
 
-   if (do_padding && l_flag && (len < num1))
-      for (i=len; i<num1; i++)
-          out_char( pad_character);
+   if (st->do_padding && l_flag && (st->len < st->num1))
+      for (i=st->len; i<st->num1; i++)
+          emit( st, st->pad_character);
    }
 
 /*---------------------------------------------------*/
@@ -69,21 +84,21 @@ static void padding( const int l_flag)
 /* This routine moves a string to the output buffer  */
 /* as directed by the padding and positioning flags. */
 /*                                                   */
-static void outs( charptr lp)
+static void outs( struct printf_state *st, charptr lp)
 {
    if(lp == NULL)
       lp = "(null)";
    /* pad on left if needed                          */
-   len = strlen( lp);
-   padding( !left_flag);
+   st->len = strlen( lp);
+   padding( st, !st->left_flag);
 
    /* Move string to the buffer                      */
-   while (*lp && num2--)
-      out_char( *lp++);
+   while (*lp && st->num2--)
+      emit( st, *lp++);
 
    /* Pad on right if needed                         */
-   len = strlen( lp);
-   padding( left_flag);
+   st->len = strlen( lp);
+   padding( st, st->left_flag);
    }
 
 /*---------------------------------------------------*/
@@ -91,7 +106,7 @@ static void outs( charptr lp)
 /* This routine moves a number to the output buffer  */
 /* as directed by the padding and positioning flags. */
 /*                                                   */
-static void outnum(unsigned int num, const int base)
+static void outnum( struct printf_state *st, unsigned int num, const int base)
 {
    charptr cp;
    int negative;
@@ -118,11 +133,11 @@ static void outnum(unsigned int num, const int base)
 
    /* Move the converted number to the buffer and    */
    /* add in the padding where needed.               */
-   len = strlen(outbuf);
-   padding( !left_flag);
+   st->len = strlen(outbuf);
+   padding( st, !st->left_flag);
    while (cp >= outbuf)
-      out_char( *cp--);
-   padding( left_flag);
+      emit( st, *cp--);
+   padding( st, st->left_flag);
 }
 
 /*---------------------------------------------------*/
@@ -165,7 +180,7 @@ void esp_printf( const func_ptr f_ptr, charptr ctrl, ...)
   
 }
 
-void esp_vprintf( const func_ptr f_ptr, charptr ctrl, va_list argp)
+static void format( struct printf_state *st, charptr ctrl, va_list argp)
 {
 
    int long_flag;
@@ -175,37 +190,38 @@ void esp_vprintf( const func_ptr f_ptr, charptr ctrl, va_list argp)
    //va_list argp;
 
    //va_start( argp, ctrl);
-   out_char = f_ptr;
+   st->len = 0;
+   st->num1 = 0;
 
    for ( ; *ctrl; ctrl++) {
 
       /* move format string chars to buffer until a  */
       /* format control is found.                    */
       if (*ctrl != '%') {
-         out_char(*ctrl);
+         emit( st, *ctrl);
          continue;
          }
 
       /* initialize all the flags for this format.   */
       dot_flag   =
       long_flag  =
-      left_flag  =
-      do_padding = 0;
-      pad_character = ' ';
-      num2=32767;
+      st->left_flag  =
+      st->do_padding = 0;
+      st->pad_character = ' ';
+      st->num2=32767;
 
 try_next:
       ch = *(++ctrl);
 
       if (isdig((int)ch)) {
          if (dot_flag)
-            num2 = getnum(&ctrl);
+            st->num2 = getnum(&ctrl);
          else {
             if (ch == '0')
-               pad_character = '0';
+               st->pad_character = '0';
 
-            num1 = getnum(&ctrl);
-            do_padding = 1;
+            st->num1 = getnum(&ctrl);
+            st->do_padding = 1;
          }
          ctrl--;
          goto try_next;
@@ -213,11 +229,11 @@ try_next:
 
       switch (tolower((int)ch)) {
          case '%':
-              out_char( '%');
+              emit( st, '%');
               continue;
 
          case '-':
-              left_flag = 1;
+              st->left_flag = 1;
               break;
 
          case '.':
@@ -231,42 +247,42 @@ try_next:
          case 'i':
          case 'd':
               if (long_flag || ch == 'D') {
-                 outnum( va_arg(argp, long), 10L);
+                 outnum( st, va_arg(argp, long), 10L);
                  continue;
                  }
               else {
-                 outnum( va_arg(argp, int), 10L);
+                 outnum( st, va_arg(argp, int), 10L);
                  continue;
                  }
          case 'x':
-              outnum( (long)va_arg(argp, int), 16L);
+              outnum( st, (long)va_arg(argp, int), 16L);
               continue;
 
          case 's':
-              outs( va_arg( argp, charptr));
+              outs( st, va_arg( argp, charptr));
               continue;
 
          case 'c':
-              out_char( va_arg( argp, int));
+              emit( st, va_arg( argp, int));
               continue;
 
          case '\\':
               switch (*ctrl) {
                  case 'a':
-                      out_char( 0x07);
+                      emit( st, 0x07);
                       break;
                  case 'h':
-                      out_char( 0x08);
+                      emit( st, 0x08);
                       break;
                  case 'r':
-                      out_char( 0x0D);
+                      emit( st, 0x0D);
                       break;
                  case 'n':
-                      out_char( 0x0D);
-                      out_char( 0x0A);
+                      emit( st, 0x0D);
+                      emit( st, 0x0A);
                       break;
                  default:
-                      out_char( *ctrl);
+                      emit( st, *ctrl);
                       break;
                  }
               ctrl++;
@@ -280,4 +296,31 @@ try_next:
    va_end( argp);
    }
 
+void esp_vprintf( const func_ptr f_ptr, charptr ctrl, va_list argp)
+{
+   struct printf_state state;
+
+   state.out_char = f_ptr;
+   format( &state, ctrl, argp);
+}
+
+/*---------------------------------------------------*/
+/*                                                   */
+/* Formats into buf, truncating to fit size bytes    */
+/* including the NUL. Returns the length written.    */
+/*                                                   */
+int esp_vsnprintf( char *buf, size_t size, charptr ctrl, va_list argp)
+{
+   struct printf_state state;
+
+   state.out_char = NULL;
+   state.buf = buf;
+   state.size = size;
+   state.pos = 0;
+   format( &state, ctrl, argp);
+   if (size > 0)
+      buf[state.pos] = '\0';
+   return state.pos;
+}
+
 /*---------------------------------------------------*/
@@ -20,6 +20,7 @@ typedef int (*func_ptr)(int c);
 /////////////////////////////////////////////////////////////////////////////////
 void esp_sprintf(char *buf, char *ctrl, ...);
 void esp_vprintf( const func_ptr f_ptr, charptr ctrl, va_list argp);
+int esp_vsnprintf( char *buf, size_t size, charptr ctrl, va_list argp);
 void esp_printf( const func_ptr f_ptr, charptr ctrl, ...);
 void printk(charptr ctrl, ...);
 #endif
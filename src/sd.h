@@ -3,13 +3,16 @@
 
 #define SECTOR_SIZE 512
 
-// Forward declaration of the ATA read function from ide.s
-int ata_lba_read(unsigned int lba, unsigned char *buffer, unsigned int numsectors);
+#include "blk.h"
 
 // Wrapper function that matches the sd_readblock interface expected by the homework
-// This just calls ata_lba_read with the same parameters
+// This queues the read with the block layer and sleeps until it completes
 static inline int sd_readblock(unsigned int sector, char *buffer, unsigned int numsectors) {
-    return ata_lba_read(sector, (unsigned char*)buffer, numsectors);
+    return blk_read_sync(sector, (unsigned char*)buffer, numsectors);
+}
+
+static inline int sd_writeblock(unsigned int sector, const char *buffer, unsigned int numsectors) {
+    return blk_write_sync(sector, (const unsigned char*)buffer, numsectors);
 }
 
 #endif // __SD_H__
@@ -0,0 +1,54 @@
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <stdint.h>
+#include "spinlock.h"
+
+/*
+ * Sequence lock for data that is read often and written rarely. Writers
+ * serialize on the spinlock and bump the sequence before and after the
+ * update, so it is odd while a write is in progress. Readers never block
+ * writers: they snapshot the data and retry if the sequence moved.
+ *
+ *     do {
+ *         seq = read_seqbegin(&sl);
+ *         copy = shared;
+ *     } while (read_seqretry(&sl, seq));
+ */
+struct seqlock {
+    struct spinlock lock;
+    volatile uint32_t sequence;
+};
+
+static inline void seqlock_init(struct seqlock *sl, const char *name) {
+    spin_lock_init(&sl->lock, name);
+    sl->sequence = 0;
+}
+
+static inline void write_seqlock(struct seqlock *sl) {
+    spin_lock(&sl->lock);
+    sl->sequence++;
+    barrier();
+}
+
+static inline void write_sequnlock(struct seqlock *sl) {
+    barrier();
+    sl->sequence++;
+    spin_unlock(&sl->lock);
+}
+
+static inline uint32_t read_seqbegin(const struct seqlock *sl) {
+    uint32_t seq;
+    while ((seq = sl->sequence) & 1) {
+        cpu_relax();
+    }
+    barrier();
+    return seq;
+}
+
+static inline int read_seqretry(const struct seqlock *sl, uint32_t start) {
+    barrier();
+    return sl->sequence != start;
+}
+
+#endif
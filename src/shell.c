@@ -0,0 +1,267 @@
+#include "shell.h"
+#include "keyboard.h"
+#include "thread.h"
+#include "fat.h"
+#include "user.h"
+#include "workload.h"
+#include "page.h"
+#include "blk.h"
+#include "vm.h"
+#include "fpu.h"
+#include "spinlock.h"
+#include "printk.h"
+#include "timer.h"
+#include "string.h"
+#include "rprintf.h"
+#include <stddef.h>
+
+extern int putc(int c);
+
+static void cmd_help(int argc, char **argv);
+
+// FAT names are upper case and rooted, so "cat t1/f000.dat" finds /T1/F000.DAT
+static void make_path(char *path, const char *name) {
+    int i = 0;
+    path[i++] = '/';
+    if (*name == '/') {
+        name++;
+    }
+    while (*name != '\0' && i <= SHELL_LINE_MAX) {
+        char c = *name++;
+        path[i++] = (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+    }
+    path[i] = '\0';
+}
+
+static void cmd_ls(int argc, char **argv) {
+    struct fat_dir dir;
+    unsigned int size;
+    char fname[13];
+    int files = 0;
+    int kind;
+
+    if (fatOpenDir("/", &dir) != 0) {
+        esp_printf(putc, "No FAT volume\r\n");
+        return;
+    }
+    while ((kind = fatReadDir(&dir, fname, &size)) >= 0) {
+        if (kind == 1) {
+            esp_printf(putc, "%s/\r\n", fname);
+        } else {
+            esp_printf(putc, "%s %d\r\n", fname, size);
+        }
+        files++;
+    }
+    if (kind == -2) {
+        esp_printf(putc, "Disk error, listing incomplete\r\n");
+    }
+    esp_printf(putc, "%d entries\r\n", files);
+}
+
+static void cmd_cat(int argc, char **argv) {
+    char path[SHELL_LINE_MAX + 2];
+    char buf[512];
+
+    make_path(path, argv[1]);
+    struct file *f = fatOpen(path);
+    if (f == NULL) {
+        esp_printf(putc, "%s: not found\r\n", path);
+        return;
+    }
+    // fatRead always starts at the beginning, so keep the position here
+    unsigned int offset = 0;
+    int bytes;
+    while ((bytes = fatReadAt(f, offset, buf, sizeof(buf))) > 0) {
+        for (int i = 0; i < bytes; i++) {
+            putc(buf[i]);
+        }
+        offset += bytes;
+    }
+    esp_printf(putc, "\r\n");
+    fatClose(f);
+}
+
+static void cmd_run(int argc, char **argv) {
+    char path[SHELL_LINE_MAX + 2];
+    int exit_code;
+
+    make_path(path, argv[1]);
+    if (user_run(path, &exit_code) != 0) {
+        esp_printf(putc, "%s: can't run\r\n", path);
+        return;
+    }
+    esp_printf(putc, "%s exited with %d\r\n", path, exit_code);
+}
+
+static void cmd_bench(int argc, char **argv) {
+    uint64_t start = rdtsc();
+
+    if (strcmp(argv[1], "string") == 0) {
+        string_workload();
+    } else if (strcmp(argv[1], "checksum") == 0) {
+        checksum_workload();
+    } else if (strcmp(argv[1], "block") == 0) {
+        block_workload();
+    } else if (strcmp(argv[1], "fat") == 0) {
+        fat_workload();
+    } else {
+        esp_printf(putc, "No benchmark %s: string, checksum, block or fat\r\n", argv[1]);
+        return;
+    }
+    esp_printf(putc, "%s: %d Mcycles\r\n", argv[1], mcycles(rdtsc() - start));
+}
+
+static void cmd_stats(int argc, char **argv) {
+    klog_flush(LOG_RECORDS);
+    lock_stats_dump();
+    pfa_stats_dump();
+    blk_stats_dump();
+    fat_stats_dump();
+    vm_stats_dump();
+    fpu_stats_dump();
+    klog_stats_dump();
+    keyboard_stats_dump();
+    esp_printf(putc, "%d context switches\r\n", thread_context_switches());
+}
+
+static void cmd_loglevel(int argc, char **argv) {
+    const char *s = argv[1];
+    if (*s < '0' || *s > '9' || s[1] != '\0' || *s - '0' > LOG_DEBUG) {
+        esp_printf(putc, "Levels are %d (errors) to %d (debug)\r\n", LOG_ERR, LOG_DEBUG);
+        return;
+    }
+    klog_set_level(*s - '0');
+}
+
+static const struct shell_command commands[] = {
+    { "help",     "help",                             cmd_help },
+    { "ls",       "ls",                               cmd_ls },
+    { "cat",      "cat FILE",                         cmd_cat },
+    { "run",      "run PROGRAM",                      cmd_run },
+    { "bench",    "bench string|checksum|block|fat",  cmd_bench },
+    { "stats",    "stats",                            cmd_stats },
+    { "loglevel", "loglevel 0-3",                     cmd_loglevel },
+};
+
+#define NUM_COMMANDS (sizeof(commands) / sizeof(commands[0]))
+
+static void cmd_help(int argc, char **argv) {
+    for (unsigned int i = 0; i < NUM_COMMANDS; i++) {
+        esp_printf(putc, "  %s\r\n", commands[i].usage);
+    }
+}
+
+// Argument count a command needs, from the words in its usage line
+static int usage_args(const char *usage) {
+    int words = 1;
+    for (; *usage != '\0'; usage++) {
+        if (*usage == ' ') {
+            words++;
+        }
+    }
+    return words;
+}
+
+// Split line in place at spaces. Returns the number of words.
+static int split(char *line, char **argv) {
+    int argc = 0;
+    while (*line != '\0') {
+        while (*line == ' ') {
+            *line++ = '\0';
+        }
+        if (*line == '\0' || argc == SHELL_MAX_ARGS) {
+            break;
+        }
+        argv[argc++] = line;
+        while (*line != ' ' && *line != '\0') {
+            line++;
+        }
+    }
+    return argc;
+}
+
+static void execute(char *line) {
+    char *argv[SHELL_MAX_ARGS];
+    int argc = split(line, argv);
+    if (argc == 0) {
+        return;
+    }
+
+    for (unsigned int i = 0; i < NUM_COMMANDS; i++) {
+        if (strcmp(argv[0], commands[i].name) == 0) {
+            if (argc != usage_args(commands[i].usage)) {
+                esp_printf(putc, "Usage: %s\r\n", commands[i].usage);
+                return;
+            }
+            commands[i].run(argc, argv);
+            return;
+        }
+    }
+    esp_printf(putc, "%s: unknown command, try help\r\n", argv[0]);
+}
+
+/*
+ * read_line - Read a line from the keyboard, echoing as it is typed
+ *
+ * Backspace rubs out the last character, ctrl-U the whole line, and
+ * ctrl-C abandons it. Each key is echoed as soon as keyboard_getc hands it
+ * over; anything typed while a command runs waits in the keyboard ring.
+ *
+ * Returns: The length of the line, which is NUL-terminated
+ */
+static int read_line(char *line) {
+    int len = 0;
+
+    for (;;) {
+        int c = keyboard_getc();
+
+        if (c == '\n') {
+            esp_printf(putc, "\r\n");
+            line[len] = '\0';
+            return len;
+        } else if (c == '\b') {
+            if (len > 0) {
+                len--;
+                putc('\b');
+            }
+        } else if (c == 'U' - '@') {
+            while (len > 0) {
+                len--;
+                putc('\b');
+            }
+        } else if (c == 'C' - '@') {
+            esp_printf(putc, "^C\r\n");
+            line[0] = '\0';
+            return 0;
+        } else if (c >= ' ' && c < 0x7F && len < SHELL_LINE_MAX) {
+            line[len++] = c;
+            putc(c);
+        }
+    }
+}
+
+static void shell_thread(void *arg) {
+    char line[SHELL_LINE_MAX + 1];
+
+    esp_printf(putc, "Shell ready, type help for commands\r\n");
+    for (;;) {
+        // Show anything logged by the last command before the prompt
+        klog_flush(LOG_RECORDS);
+        esp_printf(putc, SHELL_PROMPT);
+        read_line(line);
+        execute(line);
+    }
+}
+
+/*
+ * shell_start - Start the interactive shell on the console
+ *
+ * The shell runs at high priority, so a key wakes it ahead of any
+ * benchmark threads and is echoed within a scheduling pass of the
+ * interrupt. Call after the disk and the keyboard are initialized.
+ */
+void shell_start(void) {
+    if (thread_create(shell_thread, NULL, PRIORITY_HIGH, "shell") == NULL) {
+        esp_printf(putc, "Can't start the shell\r\n");
+    }
+}
@@ -0,0 +1,17 @@
+#ifndef SHELL_H
+#define SHELL_H
+
+#define SHELL_LINE_MAX 78       // Fits on one row after the prompt
+#define SHELL_MAX_ARGS 4
+#define SHELL_PROMPT   "> "
+
+// A built-in command. argv[0] is the command name.
+struct shell_command {
+    const char *name;
+    const char *usage;
+    void (*run)(int argc, char **argv);
+};
+
+void shell_start(void);
+
+#endif
@@ -0,0 +1,205 @@
+#include "smp.h"
+#include "apic.h"
+#include "gdt.h"
+#include "interrupt.h"
+#include "mmu.h"
+#include "atomic.h"
+#include "fpu.h"
+#include "user.h"
+#include "rprintf.h"
+#include "string.h"
+#include <stddef.h>
+
+extern int putc(int c);
+
+// The real mode startup code in trampoline.s
+extern char ap_trampoline_start[];
+extern char ap_trampoline_end[];
+extern char ap_trampoline_cr3[];
+extern char ap_trampoline_cr4[];
+extern char ap_trampoline_nx[];
+extern char ap_trampoline_stack[];
+
+struct cpu cpus[MAX_CPUS];
+int num_cpus = 1;
+
+static struct smp_info smp_info;
+static int smp_info_valid = 0;
+static struct cpu *cpu_by_apic_id[256];
+
+// Stack handed to the AP currently being started
+static struct ppage *ap_stack;
+
+// One TLB shootdown at a time; tlb_acks counts CPUs yet to flush
+static struct spinlock tlb_lock = SPINLOCK_INIT("tlb_shootdown");
+static volatile uint32_t tlb_acks;
+
+/*
+ * this_cpu - Returns the per-CPU data of the CPU we're running on
+ *
+ * Callers must keep interrupts disabled for as long as they use the
+ * result, or the thread could migrate to another CPU.
+ */
+struct cpu *this_cpu(void) {
+    if (!apic_active()) {
+        return &cpus[0];
+    }
+    return cpu_by_apic_id[lapic_id()];
+}
+
+// Initial APIC ID of the running CPU, readable before the local APIC is mapped
+static uint8_t cpuid_apic_id(void) {
+    uint32_t eax = 1, ebx, ecx, edx;
+    asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    return ebx >> 24;
+}
+
+static void reschedule_ipi_handler(struct interrupt_frame *frame) {
+    // interrupt_dispatch reschedules on the way out
+    this_cpu()->need_resched = 1;
+}
+
+static void tlb_shootdown_handler(struct interrupt_frame *frame) {
+    flush_tlb();
+    xadd(&tlb_acks, -1);
+}
+
+/*
+ * smp_tlb_shootdown - Flush the TLB on every CPU after mappings were removed
+ *
+ * Waits until each of the other CPUs has flushed. Must be called with
+ * interrupts enabled: another CPU may be waiting for us to do the same.
+ */
+void smp_tlb_shootdown(void) {
+    flush_tlb();
+    if (!apic_active() || num_cpus == 1) {
+        return;
+    }
+
+    spin_lock(&tlb_lock);
+    uint32_t flags = irq_save();
+    struct cpu *self = this_cpu();
+    uint32_t targets = 0;
+    for (int i = 0; i < num_cpus; i++) {
+        if (&cpus[i] != self && cpus[i].started) {
+            targets++;
+        }
+    }
+    tlb_acks = targets;
+    for (int i = 0; i < num_cpus; i++) {
+        if (&cpus[i] != self && cpus[i].started) {
+            lapic_send_ipi(cpus[i].apic_id, TLB_SHOOTDOWN_VECTOR);
+        }
+    }
+    irq_restore(flags);
+
+    while (tlb_acks != 0) {
+        cpu_relax();
+    }
+    spin_unlock(&tlb_lock);
+}
+
+// Find the firmware's processor tables. Runs before paging is enabled.
+void smp_early_init(void) {
+    cpus[0].id = 0;
+    smp_info_valid = (smp_discover(&smp_info) == 0);
+}
+
+// Entry point of application processors, called from trampoline.s
+void ap_main(void) {
+    gdt_load();
+    idt_load();
+    lapic_init();
+    tss_load(this_cpu()->id);
+    fpu_init_cpu();
+    syscall_init_cpu();
+
+    thread_init_ap(ap_stack);
+    lapic_timer_start();
+    this_cpu()->started = 1;
+
+    interrupts_enable();
+    thread_idle_loop();
+}
+
+static int start_ap(struct cpu *c) {
+    ap_stack = allocate_contiguous_pages(THREAD_STACK_PAGES);
+    if (ap_stack == NULL) {
+        return -1;
+    }
+
+    // Patch the trampoline copy with where to find paging and a stack
+    uint32_t stack_top = (uint32_t)ap_stack->physical_addr + THREAD_STACK_PAGES * PAGE_SIZE;
+    *(uint32_t *)(AP_TRAMPOLINE_ADDR + (ap_trampoline_cr3 - ap_trampoline_start)) = mmu_cr3();
+    *(uint32_t *)(AP_TRAMPOLINE_ADDR + (ap_trampoline_cr4 - ap_trampoline_start)) = mmu_cr4();
+    *(uint32_t *)(AP_TRAMPOLINE_ADDR + (ap_trampoline_nx - ap_trampoline_start)) = nx_enabled;
+    *(uint32_t *)(AP_TRAMPOLINE_ADDR + (ap_trampoline_stack - ap_trampoline_start)) = stack_top;
+
+    // INIT, then two STARTUP IPIs as the MP specification recommends
+    lapic_send_init(c->apic_id);
+    udelay(10000);
+    lapic_send_startup(c->apic_id, AP_TRAMPOLINE_ADDR);
+    udelay(200);
+    if (!c->started) {
+        lapic_send_startup(c->apic_id, AP_TRAMPOLINE_ADDR);
+    }
+
+    // Give it up to ~100 ms to check in
+    for (int i = 0; i < 1000 && !c->started; i++) {
+        udelay(100);
+    }
+    return c->started ? 0 : -1;
+}
+
+/*
+ * smp_init - Switch to the APICs and start the other processors
+ *
+ * Runs on the BSP after the scheduler is up and interrupts are enabled.
+ * Without an IO-APIC or more than one processor we stay on the 8259 PIC
+ * and the PIT with a single CPU.
+ */
+void smp_init(void) {
+    if (!smp_info_valid) {
+        esp_printf(putc, "No MADT or MP table found, running on one CPU\r\n");
+        return;
+    }
+
+    uint8_t bsp_id = cpuid_apic_id();
+    cpus[0].apic_id = bsp_id;
+    cpu_by_apic_id[bsp_id] = &cpus[0];
+
+    int n = 1;
+    for (int i = 0; i < smp_info.num_cpus && n < MAX_CPUS; i++) {
+        if (smp_info.apic_ids[i] == bsp_id) {
+            continue;
+        }
+        cpus[n].id = n;
+        cpus[n].apic_id = smp_info.apic_ids[i];
+        spin_lock_init(&cpus[n].rq.lock, "runqueue");
+        cpu_by_apic_id[cpus[n].apic_id] = &cpus[n];
+        n++;
+    }
+
+    register_interrupt_handler(RESCHEDULE_VECTOR, reschedule_ipi_handler);
+    register_interrupt_handler(TLB_SHOOTDOWN_VECTOR, tlb_shootdown_handler);
+    if (apic_init(&smp_info) != 0) {
+        esp_printf(putc, "No IO-APIC, running on one CPU\r\n");
+        return;
+    }
+    esp_printf(putc, "APIC mode enabled, %d CPUs in firmware tables\r\n", n);
+
+    // Copy the startup code below 1 MB where a real mode CPU can reach it
+    memcpy((void *)AP_TRAMPOLINE_ADDR, ap_trampoline_start, ap_trampoline_end - ap_trampoline_start);
+
+    for (int i = 1; i < n; i++) {
+        // cpus[] entries up to num_cpus must be valid before the AP runs
+        num_cpus = i + 1;
+        if (start_ap(&cpus[i]) == 0) {
+            esp_printf(putc, "CPU %d (APIC ID %d) started\r\n", i, cpus[i].apic_id);
+        } else {
+            esp_printf(putc, "CPU %d (APIC ID %d) did not respond\r\n", i, cpus[i].apic_id);
+            num_cpus = i;
+            break;
+        }
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdint.h>
+#include "acpi.h"
+#include "thread.h"
+
+// Where application processors start executing, in real mode
+#define AP_TRAMPOLINE_ADDR 0x8000
+
+/*
+ * Per-CPU data. Scheduler state that used to be global (the current thread,
+ * the run queue, the reschedule flag) lives here so that each CPU schedules
+ * independently.
+ */
+struct cpu {
+    int id;                         // Index into cpus[]
+    uint8_t apic_id;
+    volatile int started;
+    struct thread *current;
+    struct thread *idle;
+    struct thread *zombie;          // Exited thread whose slot is freed after the switch
+    struct thread *switched_from;   // Previous thread during a context switch
+    volatile int need_resched;
+    int interrupt_depth;
+    struct run_queue rq;
+    uint32_t context_switches;
+    uint32_t steals;                // Threads taken from other CPUs' queues
+};
+
+extern struct cpu cpus[MAX_CPUS];
+extern int num_cpus;
+
+/*
+ * Function declarations
+ */
+void smp_early_init(void);
+void smp_init(void);
+struct cpu *this_cpu(void);
+void ap_main(void);
+void smp_tlb_shootdown(void);
+
+#endif
@@ -0,0 +1,93 @@
+#include "spinlock.h"
+#include "rprintf.h"
+#include <stddef.h>
+
+extern int putc(int c);
+
+#ifdef CONFIG_LOCK_STATS
+// Every lock that has been taken at least once, newest first
+static struct spinlock *volatile lock_registry = NULL;
+#endif
+
+/*
+ * spin_lock_init - Reset a lock, which must not be held, and name it
+ *
+ * A lock already on the registry stays there: clearing its link would cut
+ * off every lock registered after it, and its next acquisition would push
+ * it a second time.
+ */
+void spin_lock_init(struct spinlock *lock, const char *name) {
+    lock->next = 0;
+    lock->owner = 0;
+#ifdef CONFIG_LOCK_STATS
+    lock->name = name;
+    if (!lock->registered) {
+        lock->stats_next = NULL;
+    }
+    lock->acquisitions = 0;
+    lock->contended = 0;
+    lock->spins = 0;
+    lock->hold_cycles = 0;
+#endif
+}
+
+#ifdef CONFIG_LOCK_STATS
+/*
+ * lock_stats_register - Add a lock to the registry on its first acquisition
+ *
+ * Lock-free: registered is claimed with cmpxchg so a lock goes on the list
+ * once, and the push retries until the head didn't move under us.
+ */
+void lock_stats_register(struct spinlock *lock) {
+    if (cmpxchg(&lock->registered, 0, 1) != 0) {
+        return;
+    }
+
+    struct spinlock *head;
+    do {
+        head = lock_registry;
+        lock->stats_next = head;
+    } while (cmpxchg((volatile uint32_t *)&lock_registry, (uint32_t)head, (uint32_t)lock) != (uint32_t)head);
+}
+#endif
+
+#define MAX_DUMPED_LOCKS 64
+
+// Print the counters of every lock that has been used, busiest first
+void lock_stats_dump(void) {
+#ifdef CONFIG_LOCK_STATS
+    struct spinlock *locks[MAX_DUMPED_LOCKS];
+    int n = 0;
+
+    // Insertion sort by acquisitions
+    for (struct spinlock *l = lock_registry; l != NULL && n < MAX_DUMPED_LOCKS; l = l->stats_next) {
+        int i = n++;
+        while (i > 0 && locks[i - 1]->acquisitions < l->acquisitions) {
+            locks[i] = locks[i - 1];
+            i--;
+        }
+        locks[i] = l;
+    }
+
+    esp_printf(putc, "%-12s %10s %10s %10s %10s\r\n",
+               "lock", "acquired", "contended", "spins", "Kcyc held");
+    for (int i = 0; i < n; i++) {
+        esp_printf(putc, "%-12s %10d %10d %10d %10d\r\n",
+                   locks[i]->name ? locks[i]->name : "(unnamed)", locks[i]->acquisitions,
+                   locks[i]->contended, locks[i]->spins, kcycles(locks[i]->hold_cycles));
+    }
+#else
+    esp_printf(putc, "Lock statistics not built in (CONFIG_LOCK_STATS)\r\n");
+#endif
+}
+
+void lock_stats_reset(void) {
+#ifdef CONFIG_LOCK_STATS
+    for (struct spinlock *l = lock_registry; l != NULL; l = l->stats_next) {
+        l->acquisitions = 0;
+        l->contended = 0;
+        l->spins = 0;
+        l->hold_cycles = 0;
+    }
+#endif
+}
@@ -0,0 +1,193 @@
+#include "string.h"
+#include "fpu.h"
+#include <stdint.h>
+
+// Below this many bytes aligning first costs more than it saves
+#define SMALL_COPY 16
+
+// Allowed to alias whatever the caller's buffer holds
+typedef uint32_t __attribute__((may_alias)) word_t;
+
+// Nonzero if any byte of w is zero
+#define HAS_ZERO(w) (((w) - 0x01010101u) & ~(w) & 0x80808080u)
+
+/*
+ * memcpy - Copies n bytes from src to dst, which must not overlap
+ *
+ * Bytes are copied one at a time until dst is word aligned, then a word
+ * at a time with rep movsl. Misaligned loads from src are cheaper than
+ * misaligned stores, so only dst is aligned. Large copies from thread
+ * context use SSE2 for the bulk when the CPU has it.
+ *
+ * Returns: dst
+ */
+void *memcpy(void *dst, const void *src, size_t n) {
+    void *ret = dst;
+
+    if (n >= SMALL_COPY) {
+        int sse = (n >= SSE_COPY_MIN && kernel_fpu_begin());
+        size_t head = -(uint32_t)dst & (sse ? 15 : 3);
+        size_t words;
+
+        n -= head;
+        asm volatile("rep movsb" : "+D"(dst), "+S"(src), "+c"(head) : : "memory");
+        if (sse) {
+            size_t bulk = n & ~63;
+            memcpy_sse2(dst, src, bulk);
+            dst = (char *)dst + bulk;
+            src = (const char *)src + bulk;
+            n -= bulk;
+            kernel_fpu_end();
+        }
+        words = n >> 2;
+        asm volatile("rep movsl" : "+D"(dst), "+S"(src), "+c"(words) : : "memory");
+        n &= 3;
+    }
+    asm volatile("rep movsb" : "+D"(dst), "+S"(src), "+c"(n) : : "memory");
+    return ret;
+}
+
+/*
+ * memmove - Copies n bytes from src to dst, which may overlap
+ *
+ * Unless dst lies inside [src, src + n) a forward copy is safe and this
+ * is memcpy. Otherwise the copy runs from the end downwards with the
+ * direction flag set, again a word at a time once dst is aligned.
+ *
+ * Returns: dst
+ */
+void *memmove(void *dst, const void *src, size_t n) {
+    if ((uint32_t)dst - (uint32_t)src >= n) {
+        return memcpy(dst, src, n);
+    }
+
+    // Point at the last byte of each buffer
+    char *d = (char *)dst + n - 1;
+    const char *s = (const char *)src + n - 1;
+
+    asm volatile("std");
+    if (n >= SMALL_COPY) {
+        size_t tail = ((uint32_t)d + 1) & 3;
+        size_t words;
+
+        n -= tail;
+        asm volatile("rep movsb" : "+D"(d), "+S"(s), "+c"(tail) : : "memory");
+        // movsl moves the word ending at the current byte
+        d -= 3;
+        s -= 3;
+        words = n >> 2;
+        asm volatile("rep movsl" : "+D"(d), "+S"(s), "+c"(words) : : "memory");
+        d += 3;
+        s += 3;
+        n &= 3;
+    }
+    asm volatile("rep movsb" : "+D"(d), "+S"(s), "+c"(n) : : "memory");
+    asm volatile("cld");
+    return dst;
+}
+
+/*
+ * memset - Fills n bytes at dst with the byte c
+ *
+ * Like memcpy, large fills (such as clearing a frame) use SSE2 when
+ * possible.
+ *
+ * Returns: dst
+ */
+void *memset(void *dst, int c, size_t n) {
+    void *ret = dst;
+    uint32_t pattern = (uint8_t)c * 0x01010101u;
+
+    if (n >= SMALL_COPY) {
+        int sse = (n >= SSE_COPY_MIN && kernel_fpu_begin());
+        size_t head = -(uint32_t)dst & (sse ? 15 : 3);
+        size_t words;
+
+        n -= head;
+        asm volatile("rep stosb" : "+D"(dst), "+c"(head) : "a"(pattern) : "memory");
+        if (sse) {
+            size_t bulk = n & ~63;
+            memset_sse2(dst, pattern, bulk);
+            dst = (char *)dst + bulk;
+            n -= bulk;
+            kernel_fpu_end();
+        }
+        words = n >> 2;
+        asm volatile("rep stosl" : "+D"(dst), "+c"(words) : "a"(pattern) : "memory");
+        n &= 3;
+    }
+    asm volatile("rep stosb" : "+D"(dst), "+c"(n) : "a"(pattern) : "memory");
+    return ret;
+}
+
+/*
+ * strlen - Length of a NUL terminated string
+ *
+ * After reaching a word boundary, checks four bytes per load for a zero.
+ * An aligned word never straddles a page, so reading past the terminator
+ * can't fault.
+ */
+size_t strlen(const char *s) {
+    const char *p = s;
+
+    while ((uint32_t)p & 3) {
+        if (*p == '\0') {
+            return p - s;
+        }
+        p++;
+    }
+
+    const word_t *w = (const word_t *)p;
+    while (!HAS_ZERO(*w)) {
+        w++;
+    }
+    p = (const char *)w;
+    while (*p != '\0') {
+        p++;
+    }
+    return p - s;
+}
+
+/*
+ * strcmp - Compares two NUL terminated strings
+ *
+ * When both strings have the same alignment they are compared a word at
+ * a time until the words differ or contain the terminator; the bytes
+ * from there on decide the result.
+ *
+ * Returns: <0, 0 or >0 as s1 sorts before, equal to or after s2
+ */
+int strcmp(const char *s1, const char *s2) {
+    if ((((uint32_t)s1 ^ (uint32_t)s2) & 3) == 0) {
+        while (((uint32_t)s1 & 3) && *s1 && *s1 == *s2) {
+            s1++;
+            s2++;
+        }
+        if (((uint32_t)s1 & 3) == 0) {
+            const word_t *w1 = (const word_t *)s1;
+            const word_t *w2 = (const word_t *)s2;
+            while (*w1 == *w2 && !HAS_ZERO(*w1)) {
+                w1++;
+                w2++;
+            }
+            s1 = (const char *)w1;
+            s2 = (const char *)w2;
+        }
+    }
+
+    while (*s1 && *s1 == *s2) {
+        s1++;
+        s2++;
+    }
+    return *(unsigned char *)s1 - *(unsigned char *)s2;
+}
+
+int strncmp(const char *s1, const char *s2, size_t n) {
+    while (n > 0 && *s1 && (*s1 == *s2)) {
+        s1++;
+        s2++;
+        n--;
+    }
+    if (n == 0) return 0;
+    return *(unsigned char *)s1 - *(unsigned char *)s2;
+}
@@ -0,0 +1,19 @@
+#ifndef STRING_H
+#define STRING_H
+
+#include <stddef.h>
+
+/*
+ * Kernel memory and string routines. Bulk copies and fills use rep movsl/
+ * rep stosl once the destination is aligned, and the string functions
+ * look at a whole word at a time. gcc may also emit calls to memcpy and
+ * memset for structure copies, so the names follow the C library.
+ */
+void *memcpy(void *dst, const void *src, size_t n);
+void *memmove(void *dst, const void *src, size_t n);
+void *memset(void *dst, int c, size_t n);
+size_t strlen(const char *s);
+int strcmp(const char *s1, const char *s2);
+int strncmp(const char *s1, const char *s2, size_t n);
+
+#endif
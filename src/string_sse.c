@@ -0,0 +1,52 @@
+#include "fpu.h"
+
+/*
+ * SSE2 versions of the bulk string routines. This file is built with SSE
+ * enabled (see the _sse rule in the Makefile) while the rest of the kernel
+ * stays general-register only, so nothing here may run unless
+ * kernel_fpu_begin succeeded: that is what makes CPUID the dispatcher.
+ */
+
+void memcpy_sse2(void *dst, const void *src, uint32_t n) {
+    if (n == 0) {
+        return;
+    }
+    // Unaligned loads, aligned stores, 64 bytes per iteration
+    asm volatile(
+        "1:\n"
+        "movdqu   (%1), %%xmm0\n"
+        "movdqu 16(%1), %%xmm1\n"
+        "movdqu 32(%1), %%xmm2\n"
+        "movdqu 48(%1), %%xmm3\n"
+        "movdqa %%xmm0,   (%0)\n"
+        "movdqa %%xmm1, 16(%0)\n"
+        "movdqa %%xmm2, 32(%0)\n"
+        "movdqa %%xmm3, 48(%0)\n"
+        "add $64, %1\n"
+        "add $64, %0\n"
+        "sub $64, %2\n"
+        "jnz 1b\n"
+        : "+r"(dst), "+r"(src), "+r"(n)
+        :
+        : "xmm0", "xmm1", "xmm2", "xmm3", "memory", "cc");
+}
+
+void memset_sse2(void *dst, uint32_t pattern, uint32_t n) {
+    if (n == 0) {
+        return;
+    }
+    asm volatile(
+        "movd %3, %%xmm0\n"
+        "pshufd $0, %%xmm0, %%xmm0\n"
+        "1:\n"
+        "movdqa %%xmm0,   (%0)\n"
+        "movdqa %%xmm0, 16(%0)\n"
+        "movdqa %%xmm0, 32(%0)\n"
+        "movdqa %%xmm0, 48(%0)\n"
+        "add $64, %0\n"
+        "sub $64, %1\n"
+        "jnz 1b\n"
+        : "=r"(dst), "=r"(n)
+        : "0"(dst), "r"(pattern), "1"(n)
+        : "xmm0", "memory", "cc");
+}
@@ -0,0 +1,29 @@
+# Kernel thread context switch
+# C Prototype: void switch_context(uint32_t *old_esp, uint32_t new_esp)
+#
+# Only the callee-saved registers need saving: the C compiler already
+# assumes EAX, ECX and EDX are clobbered across the call. EIP is the return
+# address on the stack, so switching stacks switches where we return to.
+
+    .code32
+    .section .text
+    .global switch_context
+switch_context:
+    movl 4(%esp), %eax      # Where to save the old stack pointer
+    movl 8(%esp), %edx      # Stack pointer to switch to
+
+    pushl %ebp
+    pushl %ebx
+    pushl %esi
+    pushl %edi
+
+    movl %esp, (%eax)
+    movl %edx, %esp
+
+    popl %edi
+    popl %esi
+    popl %ebx
+    popl %ebp
+    ret
+
+.section .note.GNU-stack,"",@progbits
@@ -0,0 +1,555 @@
+#include "thread.h"
+#include "smp.h"
+#include "apic.h"
+#include "user.h"
+#include "printk.h"
+#include <stddef.h>
+
+struct thread threads[MAX_THREADS];
+
+// Protects allocation of thread slots
+static struct spinlock thread_table_lock = SPINLOCK_INIT("threads");
+static int next_tid = 0;
+
+// Index of the highest set bit
+static inline int highest_bit(uint32_t bitmap) {
+    uint32_t bit;
+    asm("bsr %1, %0" : "=r"(bit) : "rm"(bitmap));
+    return bit;
+}
+
+static void rq_enqueue(struct run_queue *rq, struct thread *t) {
+    int p = t->priority;
+
+    t->next = NULL;
+    if (rq->tail[p] == NULL) {
+        rq->head[p] = t;
+    } else {
+        rq->tail[p]->next = t;
+    }
+    rq->tail[p] = t;
+    rq->bitmap |= (1 << p);
+    if (p != PRIORITY_IDLE) {
+        rq->nr_ready++;
+    }
+}
+
+static void rq_remove(struct run_queue *rq, struct thread *t, struct thread *prev) {
+    int p = t->priority;
+
+    if (prev == NULL) {
+        rq->head[p] = t->next;
+    } else {
+        prev->next = t->next;
+    }
+    if (rq->tail[p] == t) {
+        rq->tail[p] = prev;
+    }
+    if (rq->head[p] == NULL) {
+        rq->bitmap &= ~(1 << p);
+    }
+    if (p != PRIORITY_IDLE) {
+        rq->nr_ready--;
+    }
+    t->next = NULL;
+}
+
+static struct thread *rq_dequeue(struct run_queue *rq) {
+    if (rq->bitmap == 0) {
+        return NULL;
+    }
+
+    struct thread *t = rq->head[highest_bit(rq->bitmap)];
+    rq_remove(rq, t, NULL);
+    return t;
+}
+
+/*
+ * rq_steal - Take the best thread another CPU could run
+ *
+ * Skips idle threads and threads still on their way off a CPU (woken before
+ * they finished switching out), whose saved context isn't valid yet.
+ */
+static struct thread *rq_steal(struct run_queue *rq) {
+    uint32_t bitmap = rq->bitmap & ~(1 << PRIORITY_IDLE);
+
+    while (bitmap != 0) {
+        int p = highest_bit(bitmap);
+        struct thread *prev = NULL;
+        for (struct thread *t = rq->head[p]; t != NULL; prev = t, t = t->next) {
+            if (!t->on_cpu) {
+                rq_remove(rq, t, prev);
+                return t;
+            }
+        }
+        bitmap &= ~(1 << p);
+    }
+    return NULL;
+}
+
+// Called with self's run queue locked and nothing but idle left on it
+static struct thread *steal_work(struct cpu *self) {
+    struct cpu *busiest = NULL;
+
+    for (int i = 0; i < num_cpus; i++) {
+        struct cpu *c = &cpus[i];
+        if (c == self || !c->started) {
+            continue;
+        }
+        if (c->rq.nr_ready > 0 && (busiest == NULL || c->rq.nr_ready > busiest->rq.nr_ready)) {
+            busiest = c;
+        }
+    }
+    if (busiest == NULL) {
+        return NULL;
+    }
+
+    // Never wait for another queue's lock while holding our own
+    if (!spin_trylock(&busiest->rq.lock)) {
+        return NULL;
+    }
+    struct thread *t = rq_steal(&busiest->rq);
+    spin_unlock(&busiest->rq.lock);
+
+    if (t != NULL) {
+        t->cpu = self->id;
+        self->steals++;
+    }
+    return t;
+}
+
+// Ask an idle CPU other than skip to come and look for work
+static void kick_idle_cpu(struct cpu *skip) {
+    if (!apic_active()) {
+        return;
+    }
+    for (int i = 0; i < num_cpus; i++) {
+        struct cpu *c = &cpus[i];
+        if (c != skip && c->started && c->current == c->idle) {
+            lapic_send_ipi(c->apic_id, RESCHEDULE_VECTOR);
+            return;
+        }
+    }
+}
+
+/*
+ * make_ready - Put a thread on its CPU's run queue
+ *
+ * If it outranks what that CPU is running, that CPU is asked to reschedule.
+ * Otherwise an idle CPU is woken so it can steal the thread.
+ */
+static void make_ready(struct thread *t) {
+    struct cpu *self = this_cpu();
+    struct cpu *c = &cpus[t->cpu];
+
+    spin_lock(&c->rq.lock);
+    t->state = THREAD_READY;
+    rq_enqueue(&c->rq, t);
+    int preempt = (c->current != NULL && t->priority > c->current->priority);
+    if (preempt) {
+        c->need_resched = 1;
+    }
+    spin_unlock(&c->rq.lock);
+
+    if (preempt && c != self) {
+        lapic_send_ipi(c->apic_id, RESCHEDULE_VECTOR);
+    } else if (!preempt) {
+        kick_idle_cpu(c);
+    }
+}
+
+static void copy_name(char *dest, const char *src) {
+    int i = 0;
+    while (src != NULL && src[i] != '\0' && i < 15) {
+        dest[i] = src[i];
+        i++;
+    }
+    dest[i] = '\0';
+}
+
+/*
+ * finish_switch - Runs on the new thread right after a context switch
+ *
+ * The run queue lock taken by schedule() is held across switch_context so
+ * nobody can steal the previous thread before its registers are saved. We
+ * release it here, on whichever thread the CPU switched to.
+ */
+static void finish_switch(void) {
+    struct cpu *c = this_cpu();
+
+    c->switched_from->on_cpu = 0;
+    if (c->zombie != NULL) {
+        // The stack is kept with the slot and reused by thread_create
+        c->zombie->state = THREAD_UNUSED;
+        c->zombie = NULL;
+    }
+    spin_unlock(&c->rq.lock);
+}
+
+/*
+ * schedule - Pick the highest priority ready thread and switch to it
+ *
+ * The current thread goes to the back of its priority list if it is still
+ * runnable; a thread that blocked or exited set its state beforehand. When
+ * only the idle thread is left, we try to steal work from the busiest CPU.
+ */
+void schedule(void) {
+    uint32_t flags = irq_save();
+    struct cpu *c = this_cpu();
+    struct thread *prev = c->current;
+
+    spin_lock(&c->rq.lock);
+    if (prev->state == THREAD_RUNNING) {
+        prev->state = THREAD_READY;
+        rq_enqueue(&c->rq, prev);
+    }
+
+    struct thread *next = NULL;
+    if ((c->rq.bitmap & ~(1 << PRIORITY_IDLE)) == 0) {
+        next = steal_work(c);
+    }
+    if (next == NULL) {
+        // Never empty: the idle thread is always runnable
+        next = rq_dequeue(&c->rq);
+    }
+    next->state = THREAD_RUNNING;
+    next->timeslice = THREAD_TIMESLICE;
+    next->on_cpu = 1;
+    c->need_resched = 0;
+
+    if (next != prev) {
+        fpu_switch_out(prev);
+        if (next->esp0 != 0) {
+            user_set_kernel_stack(next->esp0);
+        }
+        c->current = next;
+        c->switched_from = prev;
+        c->context_switches++;
+        switch_context(&prev->esp, next->esp);
+        finish_switch();
+    } else {
+        spin_unlock(&c->rq.lock);
+    }
+
+    irq_restore(flags);
+}
+
+// First code a new thread runs, entered through switch_context's ret
+static void thread_bootstrap(void) {
+    finish_switch();
+    interrupts_enable();
+
+    struct thread *t = thread_current();
+    t->entry(t->arg);
+    thread_exit();
+}
+
+void thread_idle_loop(void) {
+    while (1) {
+        // Spend idle time rendering the kernel log, then clearing frames
+        // for later PFA_ZERO allocations. Any thread that becomes
+        // runnable preempts us as usual.
+        if (klog_flush(LOG_FLUSH_BATCH) > 0) {
+            continue;
+        }
+        if (pfa_zero_idle() > 0) {
+            continue;
+        }
+        __asm__ __volatile__("hlt");
+    }
+}
+
+static void idle_entry(void *arg) {
+    thread_idle_loop();
+}
+
+// Claim a thread slot; returns NULL if the table is full
+static struct thread *alloc_thread(void) {
+    struct thread *t = NULL;
+
+    spin_lock(&thread_table_lock);
+    for (int i = 0; i < MAX_THREADS; i++) {
+        if (threads[i].state == THREAD_UNUSED) {
+            t = &threads[i];
+            t->state = THREAD_BLOCKED;      // Reserved, not runnable yet
+            t->tid = next_tid++;
+            t->fpu_flags = 0;
+            t->esp0 = 0;
+            break;
+        }
+    }
+    spin_unlock(&thread_table_lock);
+    return t;
+}
+
+/*
+ * thread_init - Start the scheduler on the boot CPU
+ *
+ * The code that calls this becomes the "main" thread, running on the boot
+ * stack. An idle thread is created to run whenever nothing else can.
+ */
+void thread_init(void) {
+    struct cpu *c = this_cpu();
+    spin_lock_init(&c->rq.lock, "runqueue");
+    struct thread *t = alloc_thread();
+
+    t->state = THREAD_RUNNING;
+    t->priority = PRIORITY_NORMAL;
+    t->timeslice = THREAD_TIMESLICE;
+    t->cpu = c->id;
+    t->on_cpu = 1;
+    t->stack = NULL;
+    copy_name(t->name, "main");
+    c->current = t;
+    c->started = 1;
+
+    c->idle = thread_create(idle_entry, NULL, PRIORITY_IDLE, "idle0");
+}
+
+/*
+ * thread_init_ap - Start the scheduler on an application processor
+ *
+ * The AP's startup context becomes its idle thread.
+ */
+void thread_init_ap(struct ppage *stack) {
+    struct cpu *c = this_cpu();
+    struct thread *t = alloc_thread();
+
+    t->state = THREAD_RUNNING;
+    t->priority = PRIORITY_IDLE;
+    t->timeslice = THREAD_TIMESLICE;
+    t->cpu = c->id;
+    t->on_cpu = 1;
+    t->stack = stack;
+    copy_name(t->name, "idle");
+    t->name[4] = '0' + c->id % 10;
+    t->name[5] = '\0';
+    c->current = t;
+    c->idle = t;
+}
+
+/*
+ * thread_create - Create a kernel thread
+ *
+ * entry: Function the thread runs; returning from it exits the thread
+ * arg: Argument passed to entry
+ * priority: 0 (idle) to THREAD_PRIORITIES-1
+ *
+ * The thread starts on the calling CPU's run queue; idle CPUs steal it
+ * from there.
+ *
+ * Returns: The new thread, or NULL if out of thread slots or memory
+ */
+struct thread *thread_create(void (*entry)(void *arg), void *arg, int priority, const char *name) {
+    if (priority < 0 || priority >= THREAD_PRIORITIES) {
+        return NULL;
+    }
+
+    struct thread *t = alloc_thread();
+    if (t == NULL) {
+        return NULL;
+    }
+
+    // Slots keep their stack after the thread exits
+    if (t->stack == NULL) {
+        t->stack = allocate_contiguous_pages(THREAD_STACK_PAGES);
+        if (t->stack == NULL) {
+            t->state = THREAD_UNUSED;
+            return NULL;
+        }
+    }
+
+    t->priority = priority;
+    t->timeslice = THREAD_TIMESLICE;
+    t->entry = entry;
+    t->arg = arg;
+    t->on_cpu = 0;
+    copy_name(t->name, name);
+
+    // Build the frame switch_context expects to pop: edi, esi, ebx, ebp,
+    // then the return address
+    uint32_t *sp = (uint32_t *)((uint32_t)t->stack->physical_addr + THREAD_STACK_PAGES * PAGE_SIZE);
+    *--sp = 0;                              // Fake return address for thread_bootstrap
+    *--sp = (uint32_t)thread_bootstrap;
+    *--sp = 0;                              // ebp
+    *--sp = 0;                              // ebx
+    *--sp = 0;                              // esi
+    *--sp = 0;                              // edi
+    t->esp = (uint32_t)sp;
+
+    uint32_t flags = irq_save();
+    t->cpu = this_cpu()->id;
+    make_ready(t);
+    irq_restore(flags);
+
+    if (!in_interrupt()) {
+        thread_preempt_check();
+    }
+    return t;
+}
+
+void thread_exit(void) {
+    interrupts_disable();
+    struct cpu *c = this_cpu();
+    c->current->state = THREAD_DEAD;
+    c->zombie = c->current;
+    schedule();
+
+    // Not reached
+    while (1) {
+        __asm__ __volatile__("hlt");
+    }
+}
+
+void thread_yield(void) {
+    schedule();
+}
+
+struct thread *thread_current(void) {
+    // Interrupts off so we can't migrate between reading the CPU and its thread
+    uint32_t flags = irq_save();
+    struct thread *t = this_cpu()->current;
+    irq_restore(flags);
+    return t;
+}
+
+int scheduler_running(void) {
+    return cpus[0].current != NULL;
+}
+
+// Called from the timer interrupt on every CPU
+void thread_tick(void) {
+    struct cpu *c = this_cpu();
+    if (c->current == NULL) {
+        return;
+    }
+    if (--c->current->timeslice <= 0) {
+        c->need_resched = 1;
+    }
+
+    // An idle CPU periodically looks for work it can steal
+    if (c->current == c->idle) {
+        for (int i = 0; i < num_cpus; i++) {
+            if (cpus[i].rq.nr_ready > 0) {
+                c->need_resched = 1;
+                break;
+            }
+        }
+    }
+}
+
+// Reschedule if an interrupt or wake-up asked for it
+void thread_preempt_check(void) {
+    uint32_t flags = irq_save();
+    struct cpu *c = this_cpu();
+    if (c->current != NULL && c->need_resched) {
+        schedule();
+    }
+    irq_restore(flags);
+}
+
+uint32_t thread_context_switches(void) {
+    uint32_t total = 0;
+    for (int i = 0; i < num_cpus; i++) {
+        total += cpus[i].context_switches;
+    }
+    return total;
+}
+
+// name labels the queue's lock in lock_stats_dump
+void wait_queue_init(struct wait_queue *wq, const char *name) {
+    spin_lock_init(&wq->lock, name);
+    wq->head = NULL;
+    wq->tail = NULL;
+}
+
+/*
+ * prepare_to_wait - Queue the current thread on a wait queue
+ *
+ * Must be called with the queue locked and interrupts disabled, after
+ * checking the condition being waited for. The caller then drops the lock
+ * and calls schedule(). Use wait_event rather than calling this directly.
+ */
+void prepare_to_wait(struct wait_queue *wq) {
+    struct thread *t = this_cpu()->current;
+
+    t->state = THREAD_BLOCKED;
+    t->next = NULL;
+    if (wq->tail == NULL) {
+        wq->head = t;
+    } else {
+        wq->tail->next = t;
+    }
+    wq->tail = t;
+}
+
+// Wake the thread that has waited longest. Queue must be locked.
+static void wake_one_locked(struct wait_queue *wq) {
+    struct thread *t = wq->head;
+    if (t != NULL) {
+        wq->head = t->next;
+        if (wq->head == NULL) {
+            wq->tail = NULL;
+        }
+        make_ready(t);
+    }
+}
+
+// Wake every thread on the queue
+void wake_up(struct wait_queue *wq) {
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+
+    struct thread *t = wq->head;
+    wq->head = NULL;
+    wq->tail = NULL;
+    while (t != NULL) {
+        struct thread *next = t->next;
+        make_ready(t);
+        t = next;
+    }
+
+    spin_unlock_irqrestore(&wq->lock, flags);
+    if (!in_interrupt()) {
+        thread_preempt_check();
+    }
+}
+
+void wake_up_one(struct wait_queue *wq) {
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    wake_one_locked(wq);
+    spin_unlock_irqrestore(&wq->lock, flags);
+    if (!in_interrupt()) {
+        thread_preempt_check();
+    }
+}
+
+void mutex_init(struct mutex *m, const char *name) {
+    m->locked = 0;
+    m->owner = NULL;
+    wait_queue_init(&m->waiters, name);
+}
+
+// The waiters' lock also protects the mutex state
+void mutex_lock(struct mutex *m) {
+    uint32_t flags = spin_lock_irqsave(&m->waiters.lock);
+    while (m->locked) {
+        prepare_to_wait(&m->waiters);
+        spin_unlock(&m->waiters.lock);
+        schedule();
+        spin_lock(&m->waiters.lock);
+    }
+    m->locked = 1;
+    m->owner = this_cpu()->current;
+    spin_unlock_irqrestore(&m->waiters.lock, flags);
+}
+
+void mutex_unlock(struct mutex *m) {
+    uint32_t flags = spin_lock_irqsave(&m->waiters.lock);
+    m->locked = 0;
+    m->owner = NULL;
+    wake_one_locked(&m->waiters);
+    spin_unlock_irqrestore(&m->waiters.lock, flags);
+    if (!in_interrupt()) {
+        thread_preempt_check();
+    }
+}
@@ -0,0 +1,128 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+#include <stdint.h>
+#include "interrupt.h"
+#include "spinlock.h"
+#include "page.h"
+#include "fpu.h"
+
+// Priorities: higher number runs first. The idle thread sits alone at 0.
+#define THREAD_PRIORITIES 32
+#define PRIORITY_IDLE     0
+#define PRIORITY_LOW      8
+#define PRIORITY_NORMAL   16
+#define PRIORITY_HIGH     24
+
+#define MAX_THREADS 64
+#define THREAD_STACK_PAGES 4    // 16 KB kernel stack per thread
+#define THREAD_TIMESLICE 5      // Timer ticks before round-robin preemption
+
+enum thread_state {
+    THREAD_UNUSED = 0,
+    THREAD_READY,
+    THREAD_RUNNING,
+    THREAD_BLOCKED,
+    THREAD_DEAD,
+};
+
+/*
+ * Kernel thread control block. Saved register state lives on the thread's
+ * own stack; only the stack pointer is kept here.
+ */
+struct thread {
+    uint32_t esp;                 // Saved stack pointer while switched out
+    int tid;
+    int state;
+    int priority;
+    int timeslice;
+    char name[16];
+    int cpu;                      // CPU whose run queue the thread belongs to
+    volatile int on_cpu;          // Set from switch-in until fully switched out
+    struct ppage *stack;          // Stack frames, NULL for the boot thread
+    void (*entry)(void *arg);
+    void *arg;
+    struct thread *next;          // Link in a run queue or wait queue
+    uint32_t esp0;                // Kernel stack for entries from ring 3, 0 if not running a program
+    int fpu_flags;                // FPU_USED, FPU_LIVE, FPU_ACTIVE
+    uint8_t fpu_state[FPU_STATE_SIZE] __attribute__((aligned(16)));  // Saved by fpu_switch_out
+};
+
+/*
+ * O(1) priority run queue: one FIFO per priority plus a bitmap with bit p
+ * set when list p is non-empty. Picking the next thread is a single bsr.
+ * Each CPU has its own.
+ */
+struct run_queue {
+    struct spinlock lock;
+    uint32_t bitmap;
+    int nr_ready;                 // Queued threads, not counting idle
+    struct thread *head[THREAD_PRIORITIES];
+    struct thread *tail[THREAD_PRIORITIES];
+};
+
+// FIFO of threads blocked on some event
+struct wait_queue {
+    struct spinlock lock;
+    struct thread *head;
+    struct thread *tail;
+};
+
+// Static initializer, for queues that live as long as the kernel
+#define WAIT_QUEUE_INIT(lock_name) { SPINLOCK_INIT(lock_name), 0, 0 }
+
+// Sleeping lock: contended callers block instead of spinning
+struct mutex {
+    int locked;
+    struct thread *owner;
+    struct wait_queue waiters;
+};
+
+/*
+ * Function declarations
+ */
+void thread_init(void);
+void thread_init_ap(struct ppage *stack);
+void thread_idle_loop(void);
+struct thread *thread_create(void (*entry)(void *arg), void *arg, int priority, const char *name);
+void thread_exit(void);
+void thread_yield(void);
+struct thread *thread_current(void);
+int scheduler_running(void);
+void schedule(void);
+void thread_tick(void);
+void thread_preempt_check(void);
+uint32_t thread_context_switches(void);
+
+void wait_queue_init(struct wait_queue *wq, const char *name);
+void prepare_to_wait(struct wait_queue *wq);
+void wake_up(struct wait_queue *wq);
+void wake_up_one(struct wait_queue *wq);
+
+void mutex_init(struct mutex *m, const char *name);
+void mutex_lock(struct mutex *m);
+void mutex_unlock(struct mutex *m);
+
+// Low level stack switch in switch.s
+void switch_context(uint32_t *old_esp, uint32_t new_esp);
+
+/*
+ * wait_event - Block the current thread until condition is true
+ *
+ * The condition is checked with the queue's lock held, and wakers take the
+ * same lock after making the condition true, so a wake_up from another CPU
+ * or an interrupt handler between the check and going to sleep is not lost.
+ */
+#define wait_event(wq, condition)                                   \
+    do {                                                            \
+        uint32_t __flags = spin_lock_irqsave(&(wq)->lock);          \
+        while (!(condition)) {                                      \
+            prepare_to_wait(wq);                                    \
+            spin_unlock(&(wq)->lock);                               \
+            schedule();                                             \
+            spin_lock(&(wq)->lock);                                 \
+        }                                                           \
+        spin_unlock_irqrestore(&(wq)->lock, __flags);               \
+    } while (0)
+
+#endif
@@ -0,0 +1,44 @@
+#include "timer.h"
+#include "interrupt.h"
+#include "thread.h"
+#include "io.h"
+
+// 8253/8254 PIT ports
+#define PIT_CHANNEL0 0x40
+#define PIT_COMMAND  0x43
+#define PIT_FREQUENCY 1193182
+
+static volatile uint32_t ticks = 0;
+
+/*
+ * timer_handle_tick - Called on every scheduler tick of every CPU
+ *
+ * global: Set on the one CPU that keeps the system tick count
+ */
+void timer_handle_tick(int global) {
+    if (global) {
+        ticks++;
+    }
+    thread_tick();
+}
+
+static void timer_irq_handler(struct interrupt_frame *frame) {
+    timer_handle_tick(1);
+}
+
+// Program PIT channel 0 to fire IRQ0 HZ times a second. Once the APICs
+// are up the local APIC timers take over and IRQ0 stays masked.
+void timer_init(void) {
+    uint32_t divisor = PIT_FREQUENCY / HZ;
+
+    outb(PIT_COMMAND, 0x36);    // Channel 0, lobyte/hibyte, square wave
+    outb(PIT_CHANNEL0, divisor & 0xFF);
+    outb(PIT_CHANNEL0, (divisor >> 8) & 0xFF);
+
+    register_interrupt_handler(IRQ_BASE + IRQ_TIMER, timer_irq_handler);
+    irq_unmask(IRQ_TIMER);
+}
+
+uint32_t timer_ticks(void) {
+    return ticks;
+}
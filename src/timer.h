@@ -0,0 +1,30 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+// Timer interrupt frequency
+#define HZ 100
+
+void timer_init(void);
+uint32_t timer_ticks(void);
+void timer_handle_tick(int global);
+
+// Read the CPU's time stamp counter
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Cycle counts in thousands/millions. Shifting first keeps the division
+// 32-bit, since we don't link libgcc for 64-bit division.
+static inline uint32_t kcycles(uint64_t cycles) {
+    return (uint32_t)(cycles >> 3) / 125;
+}
+
+static inline uint32_t mcycles(uint64_t cycles) {
+    return (uint32_t)(cycles >> 6) / 15625;
+}
+
+#endif
@@ -0,0 +1,89 @@
+# Application processor startup trampoline
+# smp_init copies this code to AP_TRAMPOLINE_ADDR (0x8000) and sends the AP
+# a STARTUP IPI pointing there. The AP wakes up in 16-bit real mode, so
+# every address below is computed relative to where the copy runs.
+# smp_init fills in ap_trampoline_cr3, ap_trampoline_cr4, ap_trampoline_nx
+# and ap_trampoline_stack first.
+
+    .set TRAMPOLINE_BASE, 0x8000
+
+    .section .text
+    .global ap_trampoline_start
+    .global ap_trampoline_end
+    .global ap_trampoline_cr3
+    .global ap_trampoline_cr4
+    .global ap_trampoline_nx
+    .global ap_trampoline_stack
+
+    .code16
+ap_trampoline_start:
+    cli
+    cld
+    xorw %ax, %ax
+    movw %ax, %ds
+
+    # Load a temporary flat GDT and switch to protected mode
+    lgdtl (ap_gdt_ptr - ap_trampoline_start + TRAMPOLINE_BASE)
+    movl %cr0, %eax
+    orl $1, %eax
+    movl %eax, %cr0
+    ljmpl $0x08, $(ap_protected_mode - ap_trampoline_start + TRAMPOLINE_BASE)
+
+    .code32
+ap_protected_mode:
+    movw $0x10, %ax
+    movw %ax, %ds
+    movw %ax, %es
+    movw %ax, %fs
+    movw %ax, %gs
+    movw %ax, %ss
+
+    # Same paging mode as the BSP (PAE, NX) before its page tables are used
+    movl (ap_trampoline_cr4 - ap_trampoline_start + TRAMPOLINE_BASE), %eax
+    movl %eax, %cr4
+    cmpl $0, (ap_trampoline_nx - ap_trampoline_start + TRAMPOLINE_BASE)
+    je 1f
+    movl $0xC0000080, %ecx          # EFER
+    rdmsr
+    orl $0x800, %eax                # NXE
+    wrmsr
+1:
+    # Use the BSP's page directory and turn on paging
+    movl (ap_trampoline_cr3 - ap_trampoline_start + TRAMPOLINE_BASE), %eax
+    movl %eax, %cr3
+    movl %cr0, %eax
+    orl $0x80000001, %eax
+    movl %eax, %cr0
+
+    movl (ap_trampoline_stack - ap_trampoline_start + TRAMPOLINE_BASE), %esp
+    xorl %ebp, %ebp
+
+    # Absolute jump into the kernel proper
+    movl $ap_main, %eax
+    call *%eax
+
+.ap_halt:
+    hlt
+    jmp .ap_halt
+
+    .align 8
+ap_gdt:
+    .quad 0x0000000000000000
+    .quad 0x00CF9A000000FFFF        # Code, ring 0
+    .quad 0x00CF92000000FFFF        # Data, ring 0
+ap_gdt_ptr:
+    .word ap_gdt_ptr - ap_gdt - 1
+    .long (ap_gdt - ap_trampoline_start + TRAMPOLINE_BASE)
+
+    .align 4
+ap_trampoline_cr3:
+    .long 0
+ap_trampoline_cr4:
+    .long 0
+ap_trampoline_nx:
+    .long 0
+ap_trampoline_stack:
+    .long 0
+ap_trampoline_end:
+
+.section .note.GNU-stack,"",@progbits
@@ -0,0 +1,164 @@
+#include "user.h"
+#include "gdt.h"
+#include "interrupt.h"
+#include "thread.h"
+#include "smp.h"
+#include "vm.h"
+#include "elf.h"
+#include "rprintf.h"
+#include <stddef.h>
+
+extern int putc(int c);
+
+int sysenter_enabled = 0;
+
+static inline void wrmsr(uint32_t msr, uint32_t value) {
+    asm volatile("wrmsr" : : "c"(msr), "a"(value), "d"(0));
+}
+
+/*
+ * CPUID.1:EDX.SEP is also set by the first Pentium Pros, whose sysenter
+ * doesn't work: family 6, model below 3, stepping below 3.
+ */
+static int sep_supported(void) {
+    uint32_t eax = 0, ebx, ecx, edx;
+    asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    if (eax < 1) {
+        return 0;
+    }
+    eax = 1;
+    asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    uint32_t family = (eax >> 8) & 0xF;
+    uint32_t model = (eax >> 4) & 0xF;
+    uint32_t stepping = eax & 0xF;
+    if (family == 6 && model < 3 && stepping < 3) {
+        return 0;
+    }
+    return (edx & CPUID_SEP) != 0;
+}
+
+// The user buffer must lie entirely in the user window
+static int user_range_ok(uint32_t addr, uint32_t len) {
+    return addr >= VM_USER_START && addr + len <= VM_USER_END && addr + len >= addr;
+}
+
+static int sys_write(const char *buf, int len) {
+    if (len < 0 || !user_range_ok((uint32_t)buf, len)) {
+        return -1;
+    }
+    for (int i = 0; i < len; i++) {
+        putc(buf[i]);
+    }
+    return len;
+}
+
+/*
+ * syscall_dispatch - Run a system call for the current program
+ *
+ * Called from both entry paths with interrupts enabled, in the context of
+ * the calling thread, so system calls may sleep.
+ *
+ * Returns: The value for the program's EAX, -1 for an unknown call
+ */
+int syscall_dispatch(uint32_t nr, uint32_t arg1, uint32_t arg2, uint32_t arg3) {
+    switch (nr) {
+    case SYS_EXIT:
+        user_exit(arg1);
+    case SYS_WRITE:
+        return sys_write((const char *)arg1, arg2);
+    case SYS_GETTID:
+        return thread_current()->tid;
+    default:
+        return -1;
+    }
+}
+
+// int 0x80, the path that works on every CPU
+static void syscall_interrupt(struct interrupt_frame *frame) {
+    interrupts_enable();
+    frame->eax = syscall_dispatch(frame->eax, frame->ebx, frame->esi, frame->edi);
+}
+
+/*
+ * syscall_init_cpu - Program the sysenter MSRs on the calling CPU
+ *
+ * MSR_SYSENTER_ESP follows the running program; see user_set_kernel_stack.
+ */
+void syscall_init_cpu(void) {
+    if (!sysenter_enabled) {
+        return;
+    }
+    wrmsr(MSR_SYSENTER_CS, KERNEL_CS);
+    wrmsr(MSR_SYSENTER_EIP, (uint32_t)sysenter_entry);
+}
+
+void syscall_init(void) {
+    register_interrupt_handler(SYSCALL_VECTOR, syscall_interrupt);
+    idt_allow_user(SYSCALL_VECTOR);
+
+    sysenter_enabled = sep_supported();
+    syscall_init_cpu();
+    esp_printf(putc, "System calls: int 0x80%s\r\n", sysenter_enabled ? ", sysenter" : "");
+}
+
+/*
+ * user_set_kernel_stack - Where this CPU enters the kernel from ring 3
+ *
+ * Called by user_enter and by schedule() when switching to a thread that
+ * is running a program, with interrupts disabled.
+ */
+void user_set_kernel_stack(uint32_t esp0) {
+    tss_set_esp0(this_cpu()->id, esp0);
+    if (sysenter_enabled) {
+        wrmsr(MSR_SYSENTER_ESP, esp0);
+    }
+}
+
+// End the current program, e.g. after a fault it caused. user_run returns code.
+void user_exit(int code) {
+    user_return(thread_current()->esp0, code);
+}
+
+/*
+ * user_run - Run a program from the FAT volume in ring 3
+ *
+ * path: ELF executable linked into the user window
+ * exit_code: Receives the value the program passed to SYS_EXIT, or -1 if
+ * it was killed
+ *
+ * The program gets a demand-zero stack below VM_USER_END and is called as
+ * _start(int fast), where fast says whether sysenter may be used. Runs on
+ * the calling thread, which is blocked in here until the program exits.
+ *
+ * Returns: 0 if the program ran, -1 if it couldn't be loaded
+ */
+int user_run(const char *path, int *exit_code) {
+    struct elf_image image;
+    struct vm_region stack = {
+        .start = VM_USER_END - USER_STACK_SIZE, .end = VM_USER_END,
+        .flags = VM_USER | VM_WRITE, .name = "user stack",
+    };
+
+    if (elf_load(path, &image) != 0) {
+        return -1;
+    }
+    if (vm_region_add(&stack) != 0) {
+        elf_unload(&image);
+        return -1;
+    }
+
+    // _start's argument above a null return address
+    uint32_t *sp = (uint32_t *)(stack.end - 8);
+    sp[0] = 0;
+    sp[1] = sysenter_enabled;
+
+    struct thread *t = thread_current();
+    *exit_code = user_enter(image.entry, (uint32_t)sp, &t->esp0);
+    t->esp0 = 0;
+
+    esp_printf(putc, "%s: %d KB of %d KB paged in\r\n",
+               path, elf_pages_present(&image) * 4, image.file_size / 1024);
+    vm_region_remove(&stack);
+    elf_unload(&image);
+    return 0;
+}
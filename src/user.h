@@ -0,0 +1,39 @@
+#ifndef USER_H
+#define USER_H
+
+#include <stdint.h>
+
+/*
+ * System calls. The number goes in EAX and up to three arguments in EBX,
+ * ESI and EDI; the result comes back in EAX. Both entry paths use the same
+ * registers, since sysenter/sysexit need ECX and EDX for the user stack
+ * and return address.
+ */
+#define SYS_EXIT   0        // (int code) Does not return
+#define SYS_WRITE  1        // (const char *buf, int len) Prints to the console
+#define SYS_GETTID 2        // () The calling thread's id
+
+// MSRs programmed for sysenter
+#define MSR_SYSENTER_CS  0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+#define CPUID_SEP (1 << 11)     // sysenter/sysexit supported
+
+#define USER_STACK_SIZE 0x10000 // Just below VM_USER_END
+
+extern int sysenter_enabled;
+
+void syscall_init(void);
+void syscall_init_cpu(void);
+void user_set_kernel_stack(uint32_t esp0);
+int user_run(const char *path, int *exit_code);
+void user_exit(int code) __attribute__((noreturn));
+int syscall_dispatch(uint32_t nr, uint32_t arg1, uint32_t arg2, uint32_t arg3);
+
+// In user_entry.s
+int user_enter(uint32_t eip, uint32_t esp, uint32_t *esp0);
+void user_return(uint32_t esp0, int code) __attribute__((noreturn));
+void sysenter_entry(void);
+
+#endif
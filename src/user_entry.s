@@ -0,0 +1,101 @@
+# Switching between the kernel and ring 3 programs. The selectors match
+# gdt.h.
+
+    .code32
+    .section .text
+
+    .set KERNEL_DS, 0x10
+    .set USER_CS, 0x1B
+    .set USER_DS, 0x23
+
+# C Prototype: int user_enter(uint32_t eip, uint32_t esp, uint32_t *esp0)
+#
+# Saves the callee-saved registers and EFLAGS like switch_context does,
+# records the stack pointer in *esp0 as the kernel stack for entries from
+# ring 3, and irets to the program. Entries from ring 3 push below the
+# saved registers, so they survive until user_return unwinds to them and
+# this call returns the exit code.
+    .global user_enter
+user_enter:
+    pushfl
+    pushl %ebp
+    pushl %ebx
+    pushl %esi
+    pushl %edi
+    cli
+
+    movl 32(%esp), %eax     # esp0
+    movl %esp, (%eax)
+    pushl %esp
+    call user_set_kernel_stack
+    addl $4, %esp
+
+    movl 24(%esp), %ecx     # Program entry point
+    movl 28(%esp), %edx     # User stack
+    movw $USER_DS, %ax
+    movw %ax, %ds
+    movw %ax, %es
+    movw %ax, %fs
+    movw %ax, %gs
+
+    pushl $USER_DS          # ss
+    pushl %edx              # esp
+    pushl $0x202            # eflags: interrupts on
+    pushl $USER_CS          # cs
+    pushl %ecx              # eip
+    iret
+
+# C Prototype: void user_return(uint32_t esp0, int code)
+#
+# Abandons whatever is on the kernel stack below esp0 and returns code
+# from the user_enter call that saved it.
+    .global user_return
+user_return:
+    movl 8(%esp), %eax
+    movl 4(%esp), %esp
+
+    movw $KERNEL_DS, %cx
+    movw %cx, %ds
+    movw %cx, %es
+    movw %cx, %fs
+    movw %cx, %gs
+
+    popl %edi
+    popl %esi
+    popl %ebx
+    popl %ebp
+    popfl
+    ret
+
+# Fast system call entry, in MSR_SYSENTER_EIP. sysenter has loaded the
+# kernel CS and SS and ESP from MSR_SYSENTER_ESP, and turned interrupts
+# off. The caller left its stack pointer in ECX and return address in EDX.
+# EBX, ESI and EDI are callee-saved in C, so they still hold the caller's
+# values when we return.
+    .global sysenter_entry
+sysenter_entry:
+    pushl %ecx
+    pushl %edx
+    movw $KERNEL_DS, %cx
+    movw %cx, %ds
+    movw %cx, %es
+    cld
+    sti
+
+    pushl %edi
+    pushl %esi
+    pushl %ebx
+    pushl %eax
+    call syscall_dispatch
+    addl $16, %esp
+
+    cli
+    movw $USER_DS, %cx
+    movw %cx, %ds
+    movw %cx, %es
+    popl %edx
+    popl %ecx
+    sti                     # Takes effect after sysexit, in ring 3
+    sysexit
+
+.section .note.GNU-stack,"",@progbits
@@ -0,0 +1,290 @@
+#include "virtio_blk.h"
+#include "pci.h"
+#include "blk.h"
+#include "io.h"
+#include "page.h"
+#include "mmu.h"
+#include "interrupt.h"
+#include "spinlock.h"
+#include "atomic.h"
+#include "rprintf.h"
+#include "string.h"
+#include <stddef.h>
+
+extern int putc(int c);
+
+#define VIRTQ_MAX_SIZE 1024
+
+/*
+ * One outstanding request: the header and status byte the device reads
+ * and writes, plus the batch to complete. Kept in .bss, which is in
+ * lowmem, so dma_addr always finds them.
+ */
+struct virtio_blk_slot {
+    struct virtio_blk_req_hdr hdr;
+    volatile uint8_t status;
+    int in_use;
+    struct blk_request *batch;
+};
+
+static uint16_t iobase;
+static uint16_t queue_size;
+static struct vring_desc *desc;
+static struct vring_avail *avail;
+static volatile struct vring_used *used;
+static uint16_t last_used = 0;          // Next used ring entry to look at
+
+// Descriptors not in any chain, linked through next
+static uint16_t free_head;
+static unsigned int num_free;
+
+static struct virtio_blk_slot slots[VIRTIO_BLK_MAX_REQUESTS];
+static struct virtio_blk_slot *head_slot[VIRTQ_MAX_SIZE];  // Chain head -> slot
+
+// Protects the rings, the descriptor free list and the slots
+static struct spinlock vq_lock = SPINLOCK_INIT("virtio_blk");
+
+static int virtio_blk_submit(unsigned int lba, unsigned int count, struct blk_request *batch);
+
+static struct blk_device virtio_device = {
+    .name = "virtio-blk",
+    .max_sectors = BLK_MAX_SECTORS,
+    .max_segments = VIRTIO_BLK_MAX_SEGMENTS,
+    .submit = virtio_blk_submit,
+};
+
+static uint16_t alloc_desc(void) {
+    uint16_t d = free_head;
+    free_head = desc[d].next;
+    num_free--;
+    return d;
+}
+
+static void free_chain(uint16_t head) {
+    uint16_t d = head;
+    for (;;) {
+        uint16_t flags = desc[d].flags;
+        uint16_t next = desc[d].next;
+        desc[d].next = free_head;
+        free_head = d;
+        num_free++;
+        if (!(flags & VRING_DESC_F_NEXT)) break;
+        d = next;
+    }
+}
+
+static void set_desc(uint16_t d, uint32_t paddr, uint32_t len, uint16_t flags) {
+    desc[d].addr = paddr;
+    desc[d].len = len;
+    desc[d].flags = flags;
+}
+
+/*
+ * Data descriptors a request needs: one per physically contiguous piece
+ * of its buffer, since a vmalloc buffer's pages are scattered. Returns -1
+ * if part of the buffer is outside lowmem.
+ */
+static int data_descriptors(struct blk_request *r) {
+    uint32_t len = r->count * 512;
+    uint32_t paddr;
+    int n = 0;
+    for (uint32_t off = 0; off < len; n++) {
+        uint32_t run = dma_segment(r->buffer + off, len - off, &paddr);
+        if (run == 0) {
+            return -1;
+        }
+        off += run;
+    }
+    return n;
+}
+
+/*
+ * virtio_blk_submit - Post a batch as one descriptor chain
+ *
+ * The chain is the request header, the data descriptors of each request
+ * in the batch (the device writes into them for reads), then the status
+ * byte. Buffers are given by physical address a contiguous piece at a
+ * time, so vmalloc buffers work; one with a page outside lowmem fails.
+ * Completion is reported by the interrupt handler.
+ */
+static int virtio_blk_submit(unsigned int lba, unsigned int count, struct blk_request *batch) {
+    unsigned int segments = 0;
+    for (struct blk_request *r = batch; r != NULL; r = r->next) {
+        int n = data_descriptors(r);
+        if (n < 0) {
+            return -1;
+        }
+        segments += n;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&vq_lock);
+
+    struct virtio_blk_slot *slot = NULL;
+    for (int i = 0; i < VIRTIO_BLK_MAX_REQUESTS; i++) {
+        if (!slots[i].in_use) {
+            slot = &slots[i];
+            break;
+        }
+    }
+    if (slot == NULL || num_free < segments + 2) {
+        spin_unlock_irqrestore(&vq_lock, flags);
+        return -1;
+    }
+
+    slot->in_use = 1;
+    slot->batch = batch;
+    slot->hdr.type = batch->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    slot->hdr.reserved = 0;
+    slot->hdr.sector = lba;
+    slot->status = 0xFF;
+
+    uint16_t head = alloc_desc();
+    set_desc(head, dma_addr(&slot->hdr), sizeof(slot->hdr), VRING_DESC_F_NEXT);
+    uint16_t prev = head;
+    for (struct blk_request *r = batch; r != NULL; r = r->next) {
+        uint32_t len = r->count * 512;
+        uint32_t paddr;
+        for (uint32_t off = 0; off < len; ) {
+            uint32_t run = dma_segment(r->buffer + off, len - off, &paddr);
+            uint16_t d = alloc_desc();
+            set_desc(d, paddr, run, VRING_DESC_F_NEXT | (batch->write ? 0 : VRING_DESC_F_WRITE));
+            desc[prev].next = d;
+            prev = d;
+            off += run;
+        }
+    }
+    uint16_t d = alloc_desc();
+    set_desc(d, dma_addr((void *)&slot->status), 1, VRING_DESC_F_WRITE);
+    desc[prev].next = d;
+    head_slot[head] = slot;
+
+    // Publish the chain before the index that makes it visible
+    avail->ring[avail->idx % queue_size] = head;
+    barrier();
+    avail->idx++;
+    barrier();
+
+    spin_unlock_irqrestore(&vq_lock, flags);
+
+    outw(iobase + VIRTIO_PCI_QUEUE_NOTIFY, 0);
+    return 0;
+}
+
+static void virtio_blk_irq_handler(struct interrupt_frame *frame) {
+    struct blk_request *done_batch[VIRTIO_BLK_MAX_REQUESTS];
+    int done_status[VIRTIO_BLK_MAX_REQUESTS];
+    int ndone = 0;
+
+    // Reading the ISR status acknowledges the interrupt
+    if (!(inb(iobase + VIRTIO_PCI_ISR) & 1)) {
+        return;
+    }
+
+    spin_lock(&vq_lock);
+    while (last_used != used->idx && ndone < VIRTIO_BLK_MAX_REQUESTS) {
+        barrier();
+        uint16_t head = used->ring[last_used % queue_size].id;
+        last_used++;
+
+        struct virtio_blk_slot *slot = head_slot[head];
+        done_batch[ndone] = slot->batch;
+        done_status[ndone] = (slot->status == 0) ? 0 : -1;
+        ndone++;
+        slot->in_use = 0;
+        free_chain(head);
+    }
+    spin_unlock(&vq_lock);
+
+    // Callbacks may submit more work, so they run without our lock
+    for (int i = 0; i < ndone; i++) {
+        blk_complete(done_batch[i], done_status[i]);
+    }
+}
+
+static unsigned int align_up(unsigned int x, unsigned int align) {
+    return (x + align - 1) & ~(align - 1);
+}
+
+// Allocate and hand queue 0 to the device. Returns 0 on success.
+static int setup_queue(void) {
+    outw(iobase + VIRTIO_PCI_QUEUE_SEL, 0);
+    queue_size = inw(iobase + VIRTIO_PCI_QUEUE_SIZE);
+    if (queue_size == 0 || queue_size > VIRTQ_MAX_SIZE) {
+        return -1;
+    }
+
+    // Legacy layout: descriptors and avail ring, then the used ring on the
+    // next page boundary
+    unsigned int avail_end = 16 * queue_size + 6 + 2 * queue_size;
+    unsigned int used_offset = align_up(avail_end, PAGE_SIZE);
+    unsigned int bytes = used_offset + align_up(6 + 8 * queue_size, PAGE_SIZE);
+
+    struct ppage *pages = allocate_contiguous_pages(bytes / PAGE_SIZE);
+    if (pages == NULL) {
+        return -1;
+    }
+    uint8_t *ring = pages->physical_addr;
+    memset(ring, 0, bytes);
+
+    desc = (struct vring_desc *)ring;
+    avail = (struct vring_avail *)(ring + 16 * queue_size);
+    used = (struct vring_used *)(ring + used_offset);
+
+    free_head = 0;
+    num_free = queue_size;
+    for (uint16_t i = 0; i < queue_size; i++) {
+        desc[i].next = i + 1;
+    }
+
+    outl(iobase + VIRTIO_PCI_QUEUE_PFN, (uint32_t)ring / PAGE_SIZE);
+    return 0;
+}
+
+/*
+ * virtio_blk_init - Find a legacy virtio block device and make it the
+ * block layer's backend
+ *
+ * Expects pci_init and blk_init to have run. Returns 0 if a device was
+ * found and registered, -1 otherwise (leaving the current backend).
+ */
+int virtio_blk_init(void) {
+    struct pci_device *dev = pci_find_device(VIRTIO_VENDOR_ID, VIRTIO_BLK_DEVICE_ID);
+    if (dev == NULL || !(dev->bar[0] & PCI_BAR_IO)) {
+        return -1;
+    }
+    iobase = dev->bar[0] & ~0x3;
+    pci_enable(dev, PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+
+    // Reset, then announce ourselves
+    outb(iobase + VIRTIO_PCI_STATUS, 0);
+    outb(iobase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    outb(iobase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+    // None of the optional features are needed
+    inl(iobase + VIRTIO_PCI_HOST_FEATURES);
+    outl(iobase + VIRTIO_PCI_GUEST_FEATURES, 0);
+
+    if (setup_queue() != 0) {
+        outb(iobase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_FAILED);
+        esp_printf(putc, "virtio-blk: could not set up the virtqueue\r\n");
+        return -1;
+    }
+
+    // Each request needs the header and status descriptors besides its data
+    unsigned int depth = queue_size / (VIRTIO_BLK_MAX_SEGMENTS + 2);
+    if (depth == 0) depth = 1;
+    virtio_device.queue_depth = (depth < VIRTIO_BLK_MAX_REQUESTS) ? depth : VIRTIO_BLK_MAX_REQUESTS;
+
+    register_interrupt_handler(IRQ_BASE + dev->irq_line, virtio_blk_irq_handler);
+    irq_unmask(dev->irq_line);
+
+    outb(iobase + VIRTIO_PCI_STATUS,
+         VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+
+    uint32_t capacity = inl(iobase + VIRTIO_PCI_CONFIG);    // Low half, in sectors
+    esp_printf(putc, "virtio-blk: %d MB, queue size %d, %d requests in flight\r\n",
+               capacity / 2048, queue_size, virtio_device.queue_depth);
+
+    blk_register_device(&virtio_device);
+    return 0;
+}
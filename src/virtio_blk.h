@@ -0,0 +1,69 @@
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+#include <stdint.h>
+
+#define VIRTIO_VENDOR_ID        0x1AF4
+#define VIRTIO_BLK_DEVICE_ID    0x1001      // Transitional (legacy) block device
+
+// Legacy virtio PCI registers, offsets into BAR0's I/O space
+#define VIRTIO_PCI_HOST_FEATURES  0x00
+#define VIRTIO_PCI_GUEST_FEATURES 0x04
+#define VIRTIO_PCI_QUEUE_PFN      0x08
+#define VIRTIO_PCI_QUEUE_SIZE     0x0C
+#define VIRTIO_PCI_QUEUE_SEL      0x0E
+#define VIRTIO_PCI_QUEUE_NOTIFY   0x10
+#define VIRTIO_PCI_STATUS         0x12
+#define VIRTIO_PCI_ISR            0x13
+#define VIRTIO_PCI_CONFIG         0x14      // Device config when MSI-X is off
+
+// Device status bits
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x1
+#define VIRTIO_STATUS_DRIVER      0x2
+#define VIRTIO_STATUS_DRIVER_OK   0x4
+#define VIRTIO_STATUS_FAILED      0x80
+
+#define VRING_DESC_F_NEXT  0x1
+#define VRING_DESC_F_WRITE 0x2      // Device writes this buffer
+
+#define VIRTIO_BLK_T_IN  0
+#define VIRTIO_BLK_T_OUT 1
+
+#define VIRTIO_BLK_MAX_SEGMENTS 16      // Requests merged into one chain
+#define VIRTIO_BLK_MAX_REQUESTS 32
+
+// Split virtqueue layout
+struct vring_desc {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__((packed));
+
+struct vring_avail {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+} __attribute__((packed));
+
+struct vring_used_elem {
+    uint32_t id;
+    uint32_t len;
+} __attribute__((packed));
+
+struct vring_used {
+    uint16_t flags;
+    uint16_t idx;
+    struct vring_used_elem ring[];
+} __attribute__((packed));
+
+// Leads every request's descriptor chain
+struct virtio_blk_req_hdr {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} __attribute__((packed));
+
+int virtio_blk_init(void);
+
+#endif
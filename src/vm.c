@@ -0,0 +1,670 @@
+#include "vm.h"
+#include "mmu.h"
+#include "page.h"
+#include "interrupt.h"
+#include "spinlock.h"
+#include "smp.h"
+#include "user.h"
+#include "rprintf.h"
+#include "printk.h"
+#include "string.h"
+#include <stddef.h>
+
+extern int putc(int c);
+
+// Registered regions, in a height-balanced (AVL) tree keyed on start
+static struct vm_region *root = NULL;
+
+// Never mapped, so the kernel area starts with a guard page and every free
+// hole in it follows some region
+static struct vm_region arena_start = {
+    .start = VM_KERNEL_START, .end = VM_KERNEL_START + VM_GUARD_SIZE, .name = "guard",
+};
+
+// Descriptors for vm_area_alloc, linked through left while free
+static struct vm_region area_pool[MAX_VM_AREAS];
+static struct vm_region *free_areas = NULL;
+
+// Protects the tree and the area pool, and serializes demand-zero fills,
+// so two CPUs faulting on the same page don't both map a frame there
+static struct spinlock vm_lock = SPINLOCK_INIT("vm");
+
+static uint32_t zero_fills = 0;
+static uint32_t spurious_faults = 0;    // Page was mapped by someone else first
+static uint32_t cow_copies = 0;
+static uint32_t cow_reuses = 0;         // Last sharer got the frame back writable
+
+static int height(struct vm_region *n) {
+    return (n != NULL) ? n->height : 0;
+}
+
+static uint32_t subtree_gap(struct vm_region *n) {
+    return (n != NULL) ? n->max_gap : 0;
+}
+
+// Recompute a node's height and max_gap from its children
+static void update(struct vm_region *n) {
+    int hl = height(n->left), hr = height(n->right);
+    n->height = 1 + ((hl > hr) ? hl : hr);
+    n->max_gap = n->gap;
+    if (subtree_gap(n->left) > n->max_gap) n->max_gap = subtree_gap(n->left);
+    if (subtree_gap(n->right) > n->max_gap) n->max_gap = subtree_gap(n->right);
+}
+
+static struct vm_region *rotate_right(struct vm_region *y) {
+    struct vm_region *x = y->left;
+    y->left = x->right;
+    x->right = y;
+    update(y);
+    update(x);
+    return x;
+}
+
+static struct vm_region *rotate_left(struct vm_region *x) {
+    struct vm_region *y = x->right;
+    x->right = y->left;
+    y->left = x;
+    update(x);
+    update(y);
+    return y;
+}
+
+static struct vm_region *balance(struct vm_region *n) {
+    update(n);
+    int bf = height(n->left) - height(n->right);
+    if (bf > 1) {
+        if (height(n->left->left) < height(n->left->right)) {
+            n->left = rotate_left(n->left);
+        }
+        return rotate_right(n);
+    }
+    if (bf < -1) {
+        if (height(n->right->right) < height(n->right->left)) {
+            n->right = rotate_right(n->right);
+        }
+        return rotate_left(n);
+    }
+    return n;
+}
+
+static struct vm_region *tree_insert(struct vm_region *n, struct vm_region *r) {
+    if (n == NULL) {
+        r->left = NULL;
+        r->right = NULL;
+        update(r);
+        return r;
+    }
+    if (r->start < n->start) {
+        n->left = tree_insert(n->left, r);
+    } else {
+        n->right = tree_insert(n->right, r);
+    }
+    return balance(n);
+}
+
+static struct vm_region *tree_remove_min(struct vm_region *n, struct vm_region **min) {
+    if (n->left == NULL) {
+        *min = n;
+        return n->right;
+    }
+    n->left = tree_remove_min(n->left, min);
+    return balance(n);
+}
+
+static struct vm_region *tree_remove(struct vm_region *n, struct vm_region *r) {
+    if (n == NULL) {
+        return NULL;
+    }
+    if (r->start < n->start) {
+        n->left = tree_remove(n->left, r);
+    } else if (r->start > n->start) {
+        n->right = tree_remove(n->right, r);
+    } else {
+        if (n->right == NULL) {
+            return n->left;
+        }
+        struct vm_region *min;
+        struct vm_region *right = tree_remove_min(n->right, &min);
+        min->left = n->left;
+        min->right = right;
+        return balance(min);
+    }
+    return balance(n);
+}
+
+// Refresh max_gap on the path down to the region starting at start
+static void update_path(struct vm_region *n, uint32_t start) {
+    if (n == NULL) {
+        return;
+    }
+    if (start < n->start) {
+        update_path(n->left, start);
+    } else if (start > n->start) {
+        update_path(n->right, start);
+    }
+    update(n);
+}
+
+// The region with the greatest start <= addr
+static struct vm_region *tree_floor(uint32_t addr) {
+    struct vm_region *best = NULL;
+    for (struct vm_region *n = root; n != NULL; ) {
+        if (n->start <= addr) {
+            best = n;
+            n = n->right;
+        } else {
+            n = n->left;
+        }
+    }
+    return best;
+}
+
+// The region with the smallest start > addr
+static struct vm_region *tree_successor(uint32_t addr) {
+    struct vm_region *best = NULL;
+    for (struct vm_region *n = root; n != NULL; ) {
+        if (n->start > addr) {
+            best = n;
+            n = n->left;
+        } else {
+            n = n->right;
+        }
+    }
+    return best;
+}
+
+// Free space after n, counting only holes inside the kernel area
+static void set_gap(struct vm_region *n) {
+    if (n->end < VM_KERNEL_START || n->end >= VM_KERNEL_END) {
+        n->gap = 0;
+        return;
+    }
+    struct vm_region *next = tree_successor(n->start);
+    uint32_t limit = (next != NULL && next->start < VM_KERNEL_END) ? next->start : VM_KERNEL_END;
+    n->gap = limit - n->end;
+}
+
+static struct vm_region *find_region_locked(uint32_t addr) {
+    struct vm_region *r = tree_floor(addr);
+    return (r != NULL && addr < r->end) ? r : NULL;
+}
+
+struct vm_region *vm_region_find(uint32_t addr) {
+    uint32_t flags = spin_lock_irqsave(&vm_lock);
+    struct vm_region *r = find_region_locked(addr);
+    spin_unlock_irqrestore(&vm_lock, flags);
+    return r;
+}
+
+// Link a region into the tree and fix up the gaps around it
+static int insert_locked(struct vm_region *region) {
+    struct vm_region *prev = tree_floor(region->start);
+    struct vm_region *next = tree_successor(region->start);
+    if ((prev != NULL && prev->end > region->start) ||
+        (next != NULL && next->start < region->end)) {
+        return -1;
+    }
+
+    region->pages = 0;
+    set_gap(region);
+    root = tree_insert(root, region);
+    if (prev != NULL) {
+        set_gap(prev);
+        update_path(root, prev->start);
+    }
+    return 0;
+}
+
+static void remove_locked(struct vm_region *region) {
+    struct vm_region *prev = tree_floor(region->start - 1);
+    root = tree_remove(root, region);
+    if (prev != NULL && region->start != 0) {
+        set_gap(prev);
+        update_path(root, prev->start);
+    }
+}
+
+/*
+ * vm_region_add - Reserve a range of virtual addresses
+ *
+ * start and end must be page aligned. Nothing is allocated until pages in
+ * the region are touched.
+ *
+ * Returns: 0 on success, -1 if the range is malformed or overlaps another
+ * region
+ */
+int vm_region_add(struct vm_region *region) {
+    if ((region->start | region->end) & 0xFFF || region->start >= region->end) {
+        return -1;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&vm_lock);
+    int result = insert_locked(region);
+    spin_unlock_irqrestore(&vm_lock, flags);
+    return result;
+}
+
+/*
+ * vm_region_remove - Release a region and every frame it populated
+ *
+ * The caller must make sure nothing is still using the addresses. Must be
+ * called with interrupts enabled, since other CPUs are asked to flush
+ * their TLBs.
+ *
+ * Another CPU may still reach a frame through a stale TLB entry until the
+ * shootdown, so frames are unmapped a batch at a time and only released
+ * once every CPU has flushed.
+ */
+void vm_region_remove(struct vm_region *region) {
+    phys_addr_t batch[VM_FREE_BATCH];
+
+    uint32_t flags = spin_lock_irqsave(&vm_lock);
+    remove_locked(region);
+    spin_unlock_irqrestore(&vm_lock, flags);
+
+    uint32_t addr = region->start;
+    while (addr < region->end) {
+        int n = 0;
+        for (; addr < region->end && n < VM_FREE_BATCH; addr += PAGE_SIZE) {
+            phys_addr_t paddr = unmap_page((void *)addr);
+            if (paddr != 0) {
+                batch[n++] = paddr;
+            }
+        }
+        if (n == 0) {
+            break;
+        }
+        smp_tlb_shootdown();
+        for (int i = 0; i < n; i++) {
+            put_page(pfn_to_ppage(batch[i] >> 12));
+        }
+    }
+    region->pages = 0;
+}
+
+// Smallest gap of at least need bytes, skipping subtrees with no such gap
+static void best_fit(struct vm_region *n, uint32_t need, struct vm_region **best) {
+    if (n == NULL || n->max_gap < need) {
+        return;
+    }
+    if (n->gap >= need && (*best == NULL || n->gap < (*best)->gap)) {
+        *best = n;
+        if (n->gap == need) {
+            return;
+        }
+    }
+    best_fit(n->left, need, best);
+    best_fit(n->right, need, best);
+}
+
+/*
+ * vm_area_alloc - Reserve size bytes of kernel virtual space
+ *
+ * Picks the smallest hole that fits, leaving an unmapped guard page on
+ * either side so overruns fault instead of corrupting a neighbour. The
+ * area is backed lazily, like any other region.
+ *
+ * Returns: The new region, or NULL if no hole or descriptor is free
+ */
+struct vm_region *vm_area_alloc(uint32_t size, uint32_t flags, const char *name) {
+    size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (size == 0) {
+        return NULL;
+    }
+    uint32_t need = size + 2 * VM_GUARD_SIZE;
+
+    uint32_t irq = spin_lock_irqsave(&vm_lock);
+    struct vm_region *best = NULL;
+    best_fit(root, need, &best);
+    struct vm_region *area = free_areas;
+    if (best == NULL || area == NULL) {
+        spin_unlock_irqrestore(&vm_lock, irq);
+        return NULL;
+    }
+    free_areas = area->left;
+
+    area->start = best->end + VM_GUARD_SIZE;
+    area->end = area->start + size;
+    area->flags = flags | VM_AREA;
+    area->name = name;
+    area->fault = NULL;
+    area->private = NULL;
+    insert_locked(area);
+    spin_unlock_irqrestore(&vm_lock, irq);
+    return area;
+}
+
+// Unmap and free everything in an area from vm_area_alloc, then the area
+void vm_area_free(struct vm_region *area) {
+    if (area == NULL || !(area->flags & VM_AREA)) {
+        return;
+    }
+    vm_region_remove(area);
+
+    uint32_t flags = spin_lock_irqsave(&vm_lock);
+    area->flags = 0;
+    area->left = free_areas;
+    free_areas = area;
+    spin_unlock_irqrestore(&vm_lock, flags);
+}
+
+/*
+ * vmalloc - Allocate a virtually contiguous, writable kernel buffer
+ *
+ * The frames behind it come from the frame allocator one at a time and
+ * needn't be physically contiguous. They are mapped up front, so the
+ * buffer can be used where a page fault would not be safe. The contents
+ * are not cleared.
+ *
+ * Returns: The buffer, or NULL if out of address space or memory
+ */
+void *vmalloc(uint32_t size) {
+    struct vm_region *area = vm_area_alloc(size, VM_WRITE, "vmalloc");
+    if (area == NULL) {
+        return NULL;
+    }
+
+    for (uint32_t addr = area->start; addr < area->end; addr += PAGE_SIZE) {
+        struct ppage *frame = allocate_physical_pages(1);
+        if (frame == NULL || map_page((void *)addr, ppage_phys(frame), PAGE_WRITE) != 0) {
+            free_physical_pages(frame);
+            vm_area_free(area);
+            return NULL;
+        }
+        area->pages++;
+    }
+    return (void *)area->start;
+}
+
+// Release a buffer from vmalloc
+void vfree(void *addr) {
+    struct vm_region *area = vm_region_find((uint32_t)addr);
+    if (area != NULL && area->start == (uint32_t)addr) {
+        vm_area_free(area);
+    }
+}
+
+// How pages of a region are mapped
+static uint32_t region_map_flags(struct vm_region *region) {
+    uint32_t map_flags = 0;
+    if (region->flags & VM_WRITE) map_flags |= PAGE_WRITE;
+    if (region->flags & VM_USER) map_flags |= PAGE_USER;
+    if (region->flags & VM_EXEC) map_flags |= PAGE_EXEC;
+    return map_flags;
+}
+
+/*
+ * vm_map_zero - Back one page of a region with a zeroed frame
+ *
+ * region: Region containing addr
+ * addr: Page aligned address to populate
+ *
+ * Returns: 0 on success, -1 if out of memory
+ */
+int vm_map_zero(struct vm_region *region, uint32_t addr) {
+    // Only reached through this mapping, so highmem will do, but a frame
+    // an idle CPU already cleared comes first
+    struct ppage *frame = allocate_page(PFA_ZERO | PFA_HIGHMEM);
+    if (frame == NULL) {
+        return -1;
+    }
+
+    if (map_page((void *)addr, ppage_phys(frame), region_map_flags(region)) != 0) {
+        free_physical_pages(frame);
+        return -1;
+    }
+    zero_fills++;
+    return 0;
+}
+
+/*
+ * vm_install_page - Map a frame a fault handler filled in
+ *
+ * Handlers run without vm_lock, so another CPU faulting on the same page
+ * may have installed its own frame meanwhile. Then ours is released and
+ * the existing mapping kept. region->pages counts only the frame that
+ * won, and is updated under vm_lock.
+ *
+ * Returns: 0 if the page is mapped, -1 if out of memory
+ */
+int vm_install_page(struct vm_region *region, uint32_t addr, struct ppage *frame) {
+    uint32_t map_flags = region_map_flags(region);
+
+    uint32_t flags = spin_lock_irqsave(&vm_lock);
+    struct page *pte = get_pte((void *)addr, 0);
+    if (pte != NULL && pte->present) {
+        spurious_faults++;
+        spin_unlock_irqrestore(&vm_lock, flags);
+        put_page(frame);
+        return 0;
+    }
+    int result = map_page((void *)addr, ppage_phys(frame), map_flags);
+    if (result == 0) {
+        region->pages++;
+    }
+    spin_unlock_irqrestore(&vm_lock, flags);
+    if (result != 0) {
+        put_page(frame);
+    }
+    return result;
+}
+
+// Halts the system, or just ends the program if the fault came from ring 3
+static void page_fault_fatal(struct interrupt_frame *frame, uint32_t addr, const char *why) {
+    klog_flush(LOG_RECORDS);    // What led up to it
+    const char *access = (frame->err_code & PF_FETCH) ? "exec" :
+                         (frame->err_code & PF_WRITE) ? "write" : "read";
+    esp_printf(putc, "\r\n*** Page fault at 0x%x: %s (%s %s, eip 0x%x) ***\r\n", addr, why,
+               (frame->err_code & PF_USER) ? "user" : "kernel", access, frame->eip);
+    if (frame->err_code & PF_USER) {
+        esp_printf(putc, "Program killed.\r\n");
+        user_exit(-1);
+    }
+    esp_printf(putc, "System halted.\r\n");
+    while (1) {
+        asm volatile("cli; hlt");
+    }
+}
+
+/*
+ * cow_fault - Resolve a write to a copy-on-write page
+ *
+ * The last user of a frame just gets it back writable; otherwise the
+ * writer gets a private copy and drops its reference to the shared frame.
+ *
+ * Returns: 0 if the write can be retried, -1 if this wasn't a COW page
+ */
+static int cow_fault(uint32_t page) {
+    uint32_t flags = spin_lock_irqsave(&vm_lock);
+    struct page *pte = get_pte((void *)page, 0);
+    if (pte == NULL || !pte->present) {
+        spin_unlock_irqrestore(&vm_lock, flags);
+        return -1;
+    }
+    if (pte->rw) {
+        // Another CPU broke the sharing first; our TLB entry was stale
+        spurious_faults++;
+        invlpg((void *)page);
+        spin_unlock_irqrestore(&vm_lock, flags);
+        return 0;
+    }
+    if (!(pte->available & PTE_COW)) {
+        spin_unlock_irqrestore(&vm_lock, flags);
+        return -1;
+    }
+
+    struct ppage *old = pfn_to_ppage(pte->frame);
+    if (old->refcount == 1) {
+        pte->available &= ~PTE_COW;
+        pte->rw = 1;
+        invlpg((void *)page);
+        cow_reuses++;
+        spin_unlock_irqrestore(&vm_lock, flags);
+        return 0;
+    }
+
+    struct ppage *copy = allocate_page(PFA_HIGHMEM);
+    if (copy == NULL) {
+        spin_unlock_irqrestore(&vm_lock, flags);
+        return -1;
+    }
+    // Interrupts are off under vm_lock, as the kmap windows need
+    void *src = kmap_atomic(old, KMAP_SRC);
+    void *dst = kmap_atomic(copy, KMAP_DST);
+    memcpy(dst, src, PAGE_SIZE);
+    kunmap_atomic(dst);
+    kunmap_atomic(src);
+    map_page((void *)page, ppage_phys(copy), pte_flags(pte) | PAGE_WRITE);
+    put_page(old);
+    cow_copies++;
+    spin_unlock_irqrestore(&vm_lock, flags);
+
+    // Other CPUs may still translate the page to the shared frame
+    if (interrupts_enabled()) {
+        smp_tlb_shootdown();
+    }
+    return 0;
+}
+
+/*
+ * page_fault_handler - Vector 14
+ *
+ * Populates missing pages inside registered regions and breaks
+ * copy-on-write sharing. Anything else (no region, a write to a read-only
+ * region, any other protection fault) is fatal.
+ */
+static void page_fault_handler(struct interrupt_frame *frame) {
+    uint32_t addr = read_cr2();
+    uint32_t page = addr & ~0xFFF;
+
+    // CR2 is safe now, so let interrupts back in if the faulting code had them
+    if (frame->eflags & EFLAGS_IF) {
+        interrupts_enable();
+    }
+
+    if (frame->err_code & PF_PRESENT) {
+        if ((frame->err_code & PF_WRITE) && cow_fault(page) == 0) {
+            return;
+        }
+        page_fault_fatal(frame, addr, "protection violation");
+    }
+
+    uint32_t flags = spin_lock_irqsave(&vm_lock);
+    struct vm_region *r = find_region_locked(addr);
+    if (r == NULL) {
+        spin_unlock_irqrestore(&vm_lock, flags);
+        page_fault_fatal(frame, addr, "not mapped");
+    }
+    if ((frame->err_code & PF_WRITE) && !(r->flags & VM_WRITE)) {
+        spin_unlock_irqrestore(&vm_lock, flags);
+        page_fault_fatal(frame, addr, "write to read-only region");
+    }
+    if ((frame->err_code & PF_USER) && !(r->flags & VM_USER)) {
+        spin_unlock_irqrestore(&vm_lock, flags);
+        page_fault_fatal(frame, addr, "kernel region");
+    }
+
+    // Another CPU may have filled the page while we were getting here
+    struct page *pte = get_pte((void *)page, 0);
+    if (pte != NULL && pte->present) {
+        spurious_faults++;
+        spin_unlock_irqrestore(&vm_lock, flags);
+        invlpg((void *)page);
+        return;
+    }
+
+    if (r->fault == NULL) {
+        int result = vm_map_zero(r, page);
+        if (result == 0) {
+            r->pages++;
+        }
+        spin_unlock_irqrestore(&vm_lock, flags);
+        if (result != 0) {
+            page_fault_fatal(frame, addr, "out of memory");
+        }
+        return;
+    }
+
+    // Backed regions may need to sleep, so their handler runs unlocked
+    spin_unlock_irqrestore(&vm_lock, flags);
+    if (r->fault(r, page) != 0) {
+        page_fault_fatal(frame, addr, "region could not supply the page");
+    }
+}
+
+/*
+ * vm_region_clone - Share every populated page of src with dst
+ *
+ * dst must be a registered region of the same size with nothing
+ * populated yet. Pages become read-only copy-on-write in both, and each
+ * frame gains a reference, so the clone costs page table entries rather
+ * than copies. Writable pages are copied on the first write to either side.
+ *
+ * Must be called with interrupts enabled. Returns the pages shared, or -1
+ * if the regions don't match.
+ */
+int vm_region_clone(struct vm_region *dst, struct vm_region *src) {
+    if (dst->end - dst->start != src->end - src->start) {
+        return -1;
+    }
+
+    int shared = 0;
+    uint32_t flags = spin_lock_irqsave(&vm_lock);
+    for (uint32_t offset = 0; offset < src->end - src->start; offset += PAGE_SIZE) {
+        struct page *spte = get_pte((void *)(src->start + offset), 0);
+        if (spte == NULL || !spte->present) {
+            continue;
+        }
+        if (spte->rw) {
+            spte->rw = 0;
+            spte->available |= PTE_COW;
+        }
+
+        phys_addr_t paddr = ENTRY_ADDR(*spte);
+        uint32_t map_flags = region_map_flags(dst) & ~PAGE_WRITE;
+        if (map_page((void *)(dst->start + offset), paddr, map_flags) != 0) {
+            break;
+        }
+        if (spte->available & PTE_COW) {
+            get_pte((void *)(dst->start + offset), 0)->available |= PTE_COW;
+        }
+        get_page(pfn_to_ppage(paddr >> 12));
+        shared++;
+    }
+    dst->pages = shared;
+    spin_unlock_irqrestore(&vm_lock, flags);
+
+    // src's pages just became read-only
+    smp_tlb_shootdown();
+    return shared;
+}
+
+void vm_init(void) {
+    free_areas = NULL;
+    for (int i = 0; i < MAX_VM_AREAS; i++) {
+        area_pool[i].left = free_areas;
+        free_areas = &area_pool[i];
+    }
+    vm_region_add(&arena_start);
+    register_interrupt_handler(14, page_fault_handler);
+}
+
+static void dump_tree(struct vm_region *n) {
+    if (n == NULL) {
+        return;
+    }
+    dump_tree(n->left);
+    esp_printf(putc, "  %-12s 0x%x-0x%x %d of %d pages present, %d KB free after\r\n",
+               n->name, n->start, n->end, n->pages, (n->end - n->start) / PAGE_SIZE, n->gap / 1024);
+    dump_tree(n->right);
+}
+
+void vm_stats_dump(void) {
+    esp_printf(putc, "vm: %d zero fills, %d spurious faults, %d COW copies, %d COW reuses\r\n",
+               zero_fills, spurious_faults, cow_copies, cow_reuses);
+    uint32_t flags = spin_lock_irqsave(&vm_lock);
+    esp_printf(putc, "  region tree height %d, largest hole %d KB\r\n",
+               height(root), subtree_gap(root) / 1024);
+    dump_tree(root);
+    spin_unlock_irqrestore(&vm_lock, flags);
+}
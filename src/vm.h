@@ -0,0 +1,79 @@
+#ifndef VM_H
+#define VM_H
+
+#include <stdint.h>
+
+// Kernel virtual address space above the identity map of RAM (which is
+// capped at 256 MB) and below where PCI devices get placed
+#define VM_KERNEL_START 0x40000000
+#define VM_KERNEL_END   0x80000000
+
+// Programs loaded from disk are linked above the kernel area and below
+// the PCI hole, where firmware places device memory
+#define VM_USER_START   0x80000000
+#define VM_USER_END     0xB0000000
+
+#define VM_GUARD_SIZE   0x1000      // Unmapped gap on each side of an allocated area
+#define MAX_VM_AREAS    128         // Areas vm_area_alloc can hand out at once
+#define VM_FREE_BATCH   64          // Frames vm_region_remove frees per TLB shootdown
+
+// Region flags
+#define VM_WRITE 0x1
+#define VM_USER  0x2
+#define VM_AREA  0x4                // Came from vm_area_alloc
+#define VM_EXEC  0x8                // Code; other regions are non-executable under NX
+
+// Page fault error code bits
+#define PF_PRESENT 0x1      // Protection violation rather than a missing page
+#define PF_WRITE   0x2
+#define PF_USER    0x4
+#define PF_FETCH   0x10     // Instruction fetch from a non-executable page
+
+struct vm_region;
+struct ppage;
+
+// Makes the page at addr present, normally through vm_install_page.
+// Returns 0 on success.
+typedef int (*vm_fault_t)(struct vm_region *region, uint32_t addr);
+
+/*
+ * A range of virtual addresses [start, end) that is backed lazily: nothing
+ * is mapped until a page is touched. With fault NULL pages are filled with
+ * zeroes, from highmem when there is any; otherwise fault supplies them
+ * (e.g. from a file).
+ *
+ * Regions never overlap, so a balanced tree ordered by start address
+ * answers "which region contains addr" in O(log n). Each node also records
+ * the free space between its end and the next region (gap) and the
+ * largest such gap in its subtree (max_gap), so vm_area_alloc can find
+ * the best fitting hole without visiting subtrees that can't hold it.
+ */
+struct vm_region {
+    uint32_t start;
+    uint32_t end;
+    uint32_t flags;
+    const char *name;
+    vm_fault_t fault;
+    void *private;              // For the fault handler's use
+    uint32_t pages;             // Pages populated so far
+    struct vm_region *left;     // Tree links, maintained by vm.c
+    struct vm_region *right;
+    int height;
+    uint32_t gap;
+    uint32_t max_gap;
+};
+
+void vm_init(void);
+int vm_region_add(struct vm_region *region);
+void vm_region_remove(struct vm_region *region);
+struct vm_region *vm_region_find(uint32_t addr);
+int vm_map_zero(struct vm_region *region, uint32_t addr);
+int vm_install_page(struct vm_region *region, uint32_t addr, struct ppage *frame);
+struct vm_region *vm_area_alloc(uint32_t size, uint32_t flags, const char *name);
+void vm_area_free(struct vm_region *area);
+void *vmalloc(uint32_t size);
+void vfree(void *addr);
+int vm_region_clone(struct vm_region *dst, struct vm_region *src);
+void vm_stats_dump(void);
+
+#endif
@@ -0,0 +1,626 @@
+#include "workload.h"
+#include "fat.h"
+#include "thread.h"
+#include "smp.h"
+#include "timer.h"
+#include "rprintf.h"
+#include "string.h"
+#include "fpu.h"
+#include "blk.h"
+#include "vm.h"
+#include "atomic.h"
+#include <stdint.h>
+
+#define MAX_CHECKSUM_FILES 4096     // Enough for the tree corpus
+#define CHECKSUM_PATH_MAX 64
+#define CHECKSUM_MAX_DEPTH 10       // collect_files keeps a fat_dir per level
+#define CHECKSUM_BUFFER_SIZE 4096
+#define CHECKSUM_WORKERS 8          // Threads sharing the file list
+#define CHECKSUM_LIST_MAX 32        // Above this, print only the summary
+
+#define BLOCK_TEST_LBA 2048     // Start of the FAT partition
+#define BLOCK_TEST_SECTORS 64
+
+#define FAT_BENCH_MANIFEST "/CORPUS.TXT"    // Written by mkcorpus.sh
+#define FAT_BENCH_MAX_DEPTH 10
+#define FAT_BENCH_CHUNK 65536               // Sequential read size
+#define FAT_BENCH_RANDOM_SIZE 4096
+#define FAT_BENCH_RANDOM_READS 256          // From each file of at least
+#define FAT_BENCH_RANDOM_MIN 0x100000       // this many bytes
+
+extern int putc(int c);
+
+struct checksum_job {
+    char path[CHECKSUM_PATH_MAX];
+    unsigned int size;      // From the directory entry
+    int bytes;              // Bytes actually read and checksummed, -1 if not opened
+    uint32_t crc;
+    int cpu;                // CPU the worker finished on
+};
+
+static struct checksum_job jobs[MAX_CHECKSUM_FILES];
+static int njobs;
+static int skipped_files;   // Found after jobs[] filled up
+static int skipped_paths;   // Too long or too deep to walk
+static int dir_errors;      // Directories cut short by a disk error
+
+static struct wait_queue done_wq = WAIT_QUEUE_INIT("checksum");
+static volatile int jobs_remaining;
+static volatile uint32_t next_job;
+
+// Bitwise CRC-32 (IEEE 802.3), deliberately table-free so it is compute
+// bound. Start crc at 0xFFFFFFFF and invert it after the last block.
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, int len) {
+    for (int i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return crc;
+}
+
+// Read the whole file a buffer at a time. bytes ends short of size if the
+// chain or the disk gave out first.
+static void checksum_file(struct checksum_job *job, char *buffer) {
+    struct file *f = fatOpen(job->path);
+    if (f == NULL) {
+        job->bytes = -1;
+        return;
+    }
+
+    uint32_t crc = 0xFFFFFFFF;
+    unsigned int offset = 0;
+    int n;
+    while (offset < job->size &&
+           (n = fatReadAt(f, offset, buffer, CHECKSUM_BUFFER_SIZE)) > 0) {
+        crc = crc32_update(crc, (uint8_t *)buffer, n);
+        offset += n;
+    }
+    fatClose(f);
+    job->bytes = offset;
+    job->crc = ~crc;
+}
+
+static void checksum_worker(void *arg) {
+    char buffer[CHECKSUM_BUFFER_SIZE];
+
+    for (;;) {
+        uint32_t i = xadd(&next_job, 1);
+        if (i >= (uint32_t)njobs) {
+            break;
+        }
+        checksum_file(&jobs[i], buffer);
+        jobs[i].cpu = thread_current()->cpu;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&done_wq.lock);
+    jobs_remaining--;
+    spin_unlock_irqrestore(&done_wq.lock, flags);
+    wake_up(&done_wq);
+}
+
+/*
+ * collect_files - Add every file below a directory to jobs[]
+ *
+ * path: The directory, without a trailing '/' ("" for the root). The
+ *       buffer is CHECKSUM_PATH_MAX bytes and is extended in place for
+ *       each entry, then cut back to len.
+ * len: strlen(path)
+ * depth: Directories above this one
+ *
+ * Files past MAX_CHECKSUM_FILES and entries whose path would not fit are
+ * counted in skipped_files and skipped_paths rather than dropped silently,
+ * and directories whose listing failed part way in dir_errors.
+ */
+static void collect_files(char *path, int len, int depth) {
+    struct fat_dir dir;
+    char name[13];
+    unsigned int size;
+    int kind;
+
+    if (fatOpenDir(len == 0 ? "/" : path, &dir) != 0) {
+        skipped_paths++;
+        return;
+    }
+    while ((kind = fatReadDir(&dir, name, &size)) >= 0) {
+        int name_len = strlen(name);
+        if (len + 1 + name_len >= CHECKSUM_PATH_MAX ||
+            (kind == 1 && depth + 1 == CHECKSUM_MAX_DEPTH)) {
+            skipped_paths++;
+            continue;
+        }
+        path[len] = '/';
+        memcpy(path + len + 1, name, name_len + 1);
+
+        if (kind == 1) {
+            collect_files(path, len + 1 + name_len, depth + 1);
+        } else if (njobs == MAX_CHECKSUM_FILES) {
+            skipped_files++;
+        } else {
+            memcpy(jobs[njobs].path, path, len + name_len + 2);
+            jobs[njobs].size = size;
+            jobs[njobs].bytes = -1;
+            njobs++;
+        }
+        path[len] = '\0';
+    }
+    if (kind == -2) {
+        dir_errors++;
+    }
+}
+
+/*
+ * checksum_workload - CRC every file on the FAT volume in parallel
+ *
+ * Walks the whole directory tree, then queues CHECKSUM_WORKERS threads on
+ * this CPU that take files from the list until it runs out; the other
+ * CPUs pick the workers up by stealing. Prints each result (or a summary
+ * when there are many), which CPU computed it and the total time, so runs
+ * with different -smp values can be compared. Files that couldn't be
+ * listed or were read short are reported.
+ */
+void checksum_workload(void) {
+    char path[CHECKSUM_PATH_MAX];
+
+    njobs = 0;
+    skipped_files = 0;
+    skipped_paths = 0;
+    dir_errors = 0;
+    path[0] = '\0';
+    collect_files(path, 0, 0);
+    esp_printf(putc, "Checksumming %d files on %d CPUs\r\n", njobs, num_cpus);
+    if (skipped_files > 0) {
+        esp_printf(putc, "  %d more files skipped, the list holds %d\r\n",
+                   skipped_files, MAX_CHECKSUM_FILES);
+    }
+    if (skipped_paths > 0) {
+        esp_printf(putc, "  %d entries skipped, path over %d bytes or %d levels\r\n",
+                   skipped_paths, CHECKSUM_PATH_MAX - 1, CHECKSUM_MAX_DEPTH);
+    }
+    if (dir_errors > 0) {
+        esp_printf(putc, "  %d directories only partly listed, disk error\r\n", dir_errors);
+    }
+
+    uint32_t steals_before = 0;
+    for (int i = 0; i < num_cpus; i++) {
+        steals_before += cpus[i].steals;
+    }
+
+    uint64_t start = rdtsc();
+    uint32_t start_ticks = timer_ticks();
+    int workers = (njobs < CHECKSUM_WORKERS) ? njobs : CHECKSUM_WORKERS;
+    next_job = 0;
+    jobs_remaining = workers;
+    for (int i = 0; i < workers; i++) {
+        if (thread_create(checksum_worker, NULL, PRIORITY_NORMAL, "checksum") == NULL) {
+            uint32_t flags = spin_lock_irqsave(&done_wq.lock);
+            jobs_remaining--;
+            spin_unlock_irqrestore(&done_wq.lock, flags);
+        }
+    }
+    if (jobs_remaining == 0 && njobs > 0) {
+        // No worker started, so do the work here rather than report nothing
+        jobs_remaining = 1;
+        checksum_worker(NULL);
+    }
+    wait_event(&done_wq, jobs_remaining == 0);
+    uint64_t cycles = rdtsc() - start;
+    uint32_t elapsed_ticks = timer_ticks() - start_ticks;
+
+    int failed = 0;
+    int truncated = 0;
+    uint32_t total = 0;
+    for (int i = 0; i < njobs; i++) {
+        struct checksum_job *job = &jobs[i];
+        if (job->bytes < 0) {
+            failed++;
+            esp_printf(putc, "  %s: failed\r\n", job->path);
+            continue;
+        }
+        total += job->bytes;
+        if ((unsigned int)job->bytes < job->size) {
+            truncated++;
+            esp_printf(putc, "  %s: read %d of %d bytes, crc32 0x%x (cpu %d)\r\n",
+                       job->path, job->bytes, job->size, job->crc, job->cpu);
+        } else if (njobs <= CHECKSUM_LIST_MAX) {
+            esp_printf(putc, "  %s: crc32 0x%x over %d bytes (cpu %d)\r\n",
+                       job->path, job->crc, job->bytes, job->cpu);
+        }
+    }
+    esp_printf(putc, "%d files, %d KB checksummed, %d failed, %d truncated\r\n",
+               njobs, total / 1024, failed, truncated);
+
+    uint32_t steals = 0;
+    for (int i = 0; i < num_cpus; i++) {
+        steals += cpus[i].steals;
+    }
+    esp_printf(putc, "Checksum workload: %d ticks, %d Mcycles, %d threads stolen\r\n",
+               elapsed_ticks, mcycles(cycles), steals - steals_before);
+}
+
+static unsigned char block_buffer[BLOCK_TEST_SECTORS * 512];
+static struct blk_request block_reqs[BLOCK_TEST_SECTORS];
+static struct wait_queue block_wq = WAIT_QUEUE_INIT("block_test");
+static volatile int block_remaining;
+
+static void block_done(struct blk_request *req) {
+    uint32_t flags = spin_lock_irqsave(&block_wq.lock);
+    block_remaining--;
+    spin_unlock_irqrestore(&block_wq.lock, flags);
+    wake_up(&block_wq);
+}
+
+/*
+ * block_workload - Compare ways of reading the same run of sectors
+ *
+ * One large read, one synchronous read per sector, and every sector
+ * submitted at once in scattered order. With the request queue the last
+ * should merge back into a few large commands and come close to the first.
+ */
+void block_workload(void) {
+
+    uint64_t start = rdtsc();
+    blk_read_sync(BLOCK_TEST_LBA, block_buffer, BLOCK_TEST_SECTORS);
+    uint32_t sequential = kcycles(rdtsc() - start);
+
+    start = rdtsc();
+    for (int i = 0; i < BLOCK_TEST_SECTORS; i++) {
+        blk_read_sync(BLOCK_TEST_LBA + i, block_buffer + i * 512, 1);
+    }
+    uint32_t one_by_one = kcycles(rdtsc() - start);
+
+    start = rdtsc();
+    block_remaining = BLOCK_TEST_SECTORS;
+    for (int i = 0; i < BLOCK_TEST_SECTORS; i++) {
+        int sector = (i * 37) % BLOCK_TEST_SECTORS;    // 37 is coprime to 64
+        struct blk_request *req = &block_reqs[sector];
+        req->lba = BLOCK_TEST_LBA + sector;
+        req->count = 1;
+        req->write = 0;
+        req->buffer = block_buffer + sector * 512;
+        req->done = block_done;
+        if (blk_submit(req) != 0) {
+            block_done(req);
+        }
+    }
+    wait_event(&block_wq, block_remaining == 0);
+    uint32_t queued = kcycles(rdtsc() - start);
+
+    esp_printf(putc, "Reading %d sectors: %d Kcycles in one request, %d Kcycles one at a time, "
+               "%d Kcycles queued at once\r\n", BLOCK_TEST_SECTORS, sequential, one_by_one, queued);
+}
+
+static char fat_bench_buffer[FAT_BENCH_CHUNK];
+
+// Next "PATH SIZE" line of the manifest, split in place. Returns 0 at the end.
+static int next_corpus_file(char **pos, char **path, unsigned int *size) {
+    char *p = *pos;
+    while (*p == '\n' || *p == '\r') {
+        p++;
+    }
+    if (*p == '\0') {
+        return 0;
+    }
+    *path = p;
+    while (*p != ' ' && *p != '\0') {
+        p++;
+    }
+    if (*p == ' ') {
+        *p++ = '\0';
+    }
+    *size = 0;
+    while (*p >= '0' && *p <= '9') {
+        *size = *size * 10 + (*p++ - '0');
+    }
+    while (*p != '\n' && *p != '\0') {
+        p++;
+    }
+    *pos = p;
+    return 1;
+}
+
+// How many directories deep a path is
+static int path_depth(const char *path) {
+    int depth = 0;
+    for (path++; *path != '\0'; path++) {
+        if (*path == '/') {
+            depth++;
+        }
+    }
+    return (depth < FAT_BENCH_MAX_DEPTH) ? depth : FAT_BENCH_MAX_DEPTH - 1;
+}
+
+// Directory and FAT reads since *before, which is then moved up to now
+static void fat_metadata_report(struct fat_stats *before) {
+    struct fat_stats now;
+    fat_get_stats(&now);
+    esp_printf(putc, "  metadata: %d directory sectors, %d of %d cluster lookups from the hint, "
+               "%d FAT sectors for %d chain steps\r\n",
+               now.dir_sectors - before->dir_sectors,
+               now.hint_hits - before->hint_hits, now.cluster_lookups - before->cluster_lookups,
+               now.fat_sectors - before->fat_sectors, now.chain_steps - before->chain_steps);
+    *before = now;
+}
+
+static void fat_throughput_report(const char *what, uint32_t kb, uint64_t cycles, uint32_t ticks,
+                                  uint32_t requests) {
+    esp_printf(putc, "  %s: %d KB in %d Mcycles, %d KB/s, %d disk requests\r\n",
+               what, kb, mcycles(cycles), ticks ? kb * HZ / ticks : 0, requests);
+}
+
+/*
+ * fat_workload - Time lookups and reads over the corpus volume
+ *
+ * Reads the file list left in FAT_BENCH_MANIFEST by mkcorpus.sh, then
+ * opens every file (lookup time by directory depth), reads every file
+ * front to back, and reads FAT_BENCH_RANDOM_READS blocks at scattered
+ * offsets from each large file. The offsets come from a fixed seed, so
+ * two kernels are compared on the same reads. After each phase the
+ * directory and FAT reads it caused show how much of the metadata had to
+ * come from disk.
+ */
+void fat_workload(void) {
+    struct file *f = fatOpen(FAT_BENCH_MANIFEST);
+    if (f == NULL) {
+        esp_printf(putc, "No %s on this volume, see make corpus\r\n", FAT_BENCH_MANIFEST);
+        return;
+    }
+    unsigned int manifest_size = f->rde.file_size;
+    char *manifest = vmalloc(manifest_size + 1);
+    if (manifest == NULL || fatReadAt(f, 0, manifest, manifest_size) != (int)manifest_size) {
+        esp_printf(putc, "Can't read %s\r\n", FAT_BENCH_MANIFEST);
+        fatClose(f);
+        if (manifest != NULL) {
+            vfree(manifest);
+        }
+        return;
+    }
+    fatClose(f);
+    manifest[manifest_size] = '\0';
+
+    struct fat_stats before;
+    fat_get_stats(&before);
+    uint64_t lookup_cycles[FAT_BENCH_MAX_DEPTH] = { 0 };
+    uint32_t lookup_max[FAT_BENCH_MAX_DEPTH] = { 0 };
+    int lookups[FAT_BENCH_MAX_DEPTH] = { 0 };
+    int nfiles = 0, missing = 0;
+    char *pos, *path;
+    unsigned int size;
+
+    // Every lookup reads each directory on the path until the name turns up
+    pos = manifest;
+    while (next_corpus_file(&pos, &path, &size)) {
+        uint64_t start = rdtsc();
+        f = fatOpen(path);
+        uint32_t cycles = (uint32_t)(rdtsc() - start);
+        if (f == NULL) {
+            missing++;
+            continue;
+        }
+        fatClose(f);
+        int depth = path_depth(path);
+        lookup_cycles[depth] += cycles;
+        lookups[depth]++;
+        if (cycles > lookup_max[depth]) {
+            lookup_max[depth] = cycles;
+        }
+        nfiles++;
+    }
+    esp_printf(putc, "FAT workload on %d files (%d missing):\r\n", nfiles, missing);
+    for (int d = 0; d < FAT_BENCH_MAX_DEPTH; d++) {
+        if (lookups[d] > 0) {
+            esp_printf(putc, "  lookup at depth %d: %d files, avg %d max %d Kcycles\r\n",
+                       d, lookups[d], kcycles(lookup_cycles[d]) / lookups[d], kcycles(lookup_max[d]));
+        }
+    }
+    fat_metadata_report(&before);
+
+    // Whole files in FAT_BENCH_CHUNK reads
+    uint32_t kb = 0;
+    uint32_t requests = blk_request_count();
+    uint32_t start_ticks = timer_ticks();
+    uint64_t start = rdtsc();
+    pos = manifest;
+    while (next_corpus_file(&pos, &path, &size)) {
+        f = fatOpen(path);
+        if (f == NULL) {
+            continue;
+        }
+        int bytes;
+        unsigned int offset = 0;
+        while ((bytes = fatReadAt(f, offset, fat_bench_buffer, FAT_BENCH_CHUNK)) > 0) {
+            offset += bytes;
+        }
+        kb += offset / 1024;
+        fatClose(f);
+    }
+    fat_throughput_report("sequential", kb, rdtsc() - start, timer_ticks() - start_ticks,
+                          blk_request_count() - requests);
+    fat_metadata_report(&before);
+
+    // Scattered blocks from the large files
+    uint32_t seed = 12345;
+    int reads = 0;
+    kb = 0;
+    requests = blk_request_count();
+    start_ticks = timer_ticks();
+    start = rdtsc();
+    pos = manifest;
+    while (next_corpus_file(&pos, &path, &size)) {
+        if (size < FAT_BENCH_RANDOM_MIN || (f = fatOpen(path)) == NULL) {
+            continue;
+        }
+        unsigned int blocks = size / FAT_BENCH_RANDOM_SIZE;
+        for (int i = 0; i < FAT_BENCH_RANDOM_READS; i++) {
+            seed = seed * 1103515245 + 12345;
+            unsigned int offset = ((seed >> 8) % blocks) * FAT_BENCH_RANDOM_SIZE;
+            if (fatReadAt(f, offset, fat_bench_buffer, FAT_BENCH_RANDOM_SIZE) > 0) {
+                kb += FAT_BENCH_RANDOM_SIZE / 1024;
+                reads++;
+            }
+        }
+        fatClose(f);
+    }
+    if (reads > 0) {
+        uint64_t cycles = rdtsc() - start;
+        fat_throughput_report("random", kb, cycles, timer_ticks() - start_ticks,
+                              blk_request_count() - requests);
+        esp_printf(putc, "  %d random reads of %d bytes, avg %d Kcycles\r\n",
+                   reads, FAT_BENCH_RANDOM_SIZE, kcycles(cycles) / reads);
+        fat_metadata_report(&before);
+    }
+
+    vfree(manifest);
+}
+
+#define STRING_TEST_SIZE 16384
+#define STRING_TEST_ROUNDS 16
+
+static char string_src[STRING_TEST_SIZE];
+static char string_dst[STRING_TEST_SIZE];
+static char string_ref[STRING_TEST_SIZE];
+
+// The byte loops the string library replaced, for comparison
+static void byte_copy(char *dst, const char *src, unsigned int n) {
+    for (unsigned int i = 0; i < n; i++) {
+        dst[i] = src[i];
+    }
+}
+
+static void byte_copy_backward(char *dst, const char *src, unsigned int n) {
+    while (n-- > 0) {
+        dst[n] = src[n];
+    }
+}
+
+static void byte_fill(char *dst, char c, unsigned int n) {
+    for (unsigned int i = 0; i < n; i++) {
+        dst[i] = c;
+    }
+}
+
+static unsigned int byte_strlen(const char *s) {
+    unsigned int len = 0;
+    while (s[len] != '\0') {
+        len++;
+    }
+    return len;
+}
+
+static int byte_strcmp(const char *s1, const char *s2) {
+    while (*s1 && (*s1 == *s2)) {
+        s1++;
+        s2++;
+    }
+    return *(unsigned char *)s1 - *(unsigned char *)s2;
+}
+
+// Report if the library left string_dst different from the byte loop's string_ref
+static void string_check(const char *name, unsigned int n) {
+    for (unsigned int i = 0; i < n; i++) {
+        if (string_dst[i] != string_ref[i]) {
+            esp_printf(putc, "  %s: result mismatch at byte %d\r\n", name, i);
+            return;
+        }
+    }
+}
+
+static void string_result(const char *name, uint64_t bytes_cycles, uint64_t lib_cycles) {
+    esp_printf(putc, "  %s: %d Kcycles, byte loop %d Kcycles\r\n",
+               name, kcycles(lib_cycles), kcycles(bytes_cycles));
+}
+
+/*
+ * string_workload - Time the string library against plain byte loops
+ *
+ * Each operation runs STRING_TEST_ROUNDS times over a STRING_TEST_SIZE
+ * buffer. The copies start one byte into the source so the alignment
+ * handling is exercised, and their results are checked against the byte
+ * loop's.
+ */
+void string_workload(void) {
+    const unsigned int n = STRING_TEST_SIZE - 1;
+    uint64_t start, bytes, lib;
+    volatile int result_bytes = 0, result_lib = 0;
+
+    for (unsigned int i = 0; i < n; i++) {
+        string_src[i] = 'A' + i % 26;
+    }
+    string_src[n] = '\0';
+    esp_printf(putc, "String routines (%s), %d rounds of %d bytes:\r\n",
+               fpu_enabled ? "SSE2" : "i386", STRING_TEST_ROUNDS, n);
+
+    start = rdtsc();
+    for (int r = 0; r < STRING_TEST_ROUNDS; r++) {
+        byte_copy(string_ref, string_src + 1, n);
+    }
+    bytes = rdtsc() - start;
+    start = rdtsc();
+    for (int r = 0; r < STRING_TEST_ROUNDS; r++) {
+        memcpy(string_dst, string_src + 1, n);
+    }
+    lib = rdtsc() - start;
+    string_result("memcpy", bytes, lib);
+    string_check("memcpy", n);
+
+    // Shift the buffer up a byte at a time, so source and destination overlap
+    start = rdtsc();
+    for (int r = 0; r < STRING_TEST_ROUNDS; r++) {
+        byte_copy_backward(string_ref + 1, string_ref, n - 1);
+    }
+    bytes = rdtsc() - start;
+    start = rdtsc();
+    for (int r = 0; r < STRING_TEST_ROUNDS; r++) {
+        memmove(string_dst + 1, string_dst, n - 1);
+    }
+    lib = rdtsc() - start;
+    string_result("memmove", bytes, lib);
+    string_check("memmove", n);
+
+    start = rdtsc();
+    for (int r = 0; r < STRING_TEST_ROUNDS; r++) {
+        byte_fill(string_ref + 1, 'z', n - 1);
+    }
+    bytes = rdtsc() - start;
+    start = rdtsc();
+    for (int r = 0; r < STRING_TEST_ROUNDS; r++) {
+        memset(string_dst + 1, 'z', n - 1);
+    }
+    lib = rdtsc() - start;
+    string_result("memset", bytes, lib);
+    string_check("memset", n);
+
+    start = rdtsc();
+    for (int r = 0; r < STRING_TEST_ROUNDS; r++) {
+        result_bytes += byte_strlen(string_src);
+    }
+    bytes = rdtsc() - start;
+    start = rdtsc();
+    for (int r = 0; r < STRING_TEST_ROUNDS; r++) {
+        result_lib += strlen(string_src);
+    }
+    lib = rdtsc() - start;
+    string_result("strlen", bytes, lib);
+    if (result_bytes != result_lib) {
+        esp_printf(putc, "  strlen: result mismatch\r\n");
+    }
+
+    // Equal strings, so the whole length is compared
+    memcpy(string_dst, string_src, STRING_TEST_SIZE);
+    result_bytes = result_lib = 0;
+    start = rdtsc();
+    for (int r = 0; r < STRING_TEST_ROUNDS; r++) {
+        result_bytes |= byte_strcmp(string_src, string_dst);
+    }
+    bytes = rdtsc() - start;
+    start = rdtsc();
+    for (int r = 0; r < STRING_TEST_ROUNDS; r++) {
+        result_lib |= strcmp(string_src, string_dst);
+    }
+    lib = rdtsc() - start;
+    string_result("strcmp", bytes, lib);
+    if (result_bytes != result_lib) {
+        esp_printf(putc, "  strcmp: result mismatch\r\n");
+    }
+}
@@ -0,0 +1,9 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+void checksum_workload(void);
+void block_workload(void);
+void fat_workload(void);
+void string_workload(void);
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ * Test program for the ELF loader and ring 3, copied onto the FAT volume
+ * as HELLO.ELF. Most of the file is a table it never reads, so loading it
+ * should only bring in the few pages it touches. It times a null system
+ * call through each entry path.
+ */
+#include "syscall.h"
+
+#define ROUNDS 1000
+
+// Kept in the file but never touched beyond its first page
+__attribute__((used)) const char padding[256 * 1024] = { 1 };
+
+static int table[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };     // .data
+static int counter;                                     // .bss
+
+static int length(const char *s) {
+    int n = 0;
+    while (s[n] != '\0') {
+        n++;
+    }
+    return n;
+}
+
+static void print(const char *s) {
+    sys_write(s, length(s));
+}
+
+static void print_num(unsigned int n) {
+    char buf[12];
+    int i = sizeof(buf);
+    do {
+        buf[--i] = '0' + n % 10;
+        n /= 10;
+    } while (n != 0);
+    sys_write(buf + i, sizeof(buf) - i);
+}
+
+// Cycles per round trip of a call that does no work. 32 bits of the
+// TSC are plenty for ROUNDS calls, and need no 64-bit division.
+static unsigned int time_syscall(int fast) {
+    unsigned int start = rdtsc_low();
+    for (int i = 0; i < ROUNDS; i++) {
+        if (fast) {
+            syscall_fast(SYS_GETTID, 0, 0, 0);
+        } else {
+            syscall_int(SYS_GETTID, 0, 0, 0);
+        }
+    }
+    return (rdtsc_low() - start) / ROUNDS;
+}
+
+__attribute__((section(".text.start")))
+void _start(int fast) {
+    print("Hello from ring 3\r\n");
+
+    print("Null system call: int 0x80 ");
+    print_num(time_syscall(0));
+    if (fast) {
+        print(" cycles, sysenter ");
+        print_num(time_syscall(1));
+    }
+    print(" cycles\r\n");
+
+    for (int i = 0; i < 8; i++) {
+        counter += table[i];
+    }
+    sys_exit(counter + padding[0]);
+}
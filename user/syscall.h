@@ -0,0 +1,52 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+/*
+ * System call stubs for programs in user/. Numbers and registers match
+ * src/user.h: number in EAX, arguments in EBX, ESI and EDI.
+ */
+#define SYS_EXIT   0
+#define SYS_WRITE  1
+#define SYS_GETTID 2
+
+// Through the int 0x80 gate, which works on every CPU
+static inline int syscall_int(int nr, int a1, int a2, int a3) {
+    int ret;
+    asm volatile("int $0x80"
+                 : "=a"(ret)
+                 : "a"(nr), "b"(a1), "S"(a2), "D"(a3)
+                 : "memory");
+    return ret;
+}
+
+// Through sysenter, if _start was told it is available. sysexit returns
+// to the address in EDX with the stack pointer from ECX.
+static inline int syscall_fast(int nr, int a1, int a2, int a3) {
+    int ret;
+    asm volatile("movl %%esp, %%ecx\n"
+                 "movl $1f, %%edx\n"
+                 "sysenter\n"
+                 "1:\n"
+                 : "=a"(ret)
+                 : "a"(nr), "b"(a1), "S"(a2), "D"(a3)
+                 : "ecx", "edx", "memory");
+    return ret;
+}
+
+static inline void sys_exit(int code) {
+    syscall_int(SYS_EXIT, code, 0, 0);
+    while (1) {
+    }
+}
+
+static inline int sys_write(const char *buf, int len) {
+    return syscall_int(SYS_WRITE, (int)buf, len, 0);
+}
+
+static inline unsigned int rdtsc_low(void) {
+    unsigned int lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return lo;
+}
+
+#endif